@@ -1,6 +1,6 @@
 #!/usr/bin/env python
 from optparse import OptionParser, SUPPRESS_HELP
-import os, random, sys, subprocess
+import os, random, shutil, struct, sys, subprocess, zlib
 import quake
 
 ############################################################
@@ -10,6 +10,9 @@ import quake
 # to separate trusted/untrusted kmers.
 ############################################################
 
+# first bytes of a binary mer file, as in mer_file.h
+mer_file_magic = 'QUAKEMER'
+
 ############################################################
 # main
 ############################################################
@@ -50,23 +53,28 @@ def main():
 # Make a histogram of kmers to give to R to learn the cutoff
 ############################################################
 def model_cutoff(ctsf, ratio):
-    # make kmer histogram
-    cov_max = 0
-    for line in open(ctsf):
-        cov = int(line.split()[1])
-        if cov > cov_max:
-            cov_max = cov
-
-    kmer_hist = [0]*cov_max
-    for line in open(ctsf):
-        cov = int(line.split()[1])
-        kmer_hist[cov-1] += 1
+    histf = counter_stats(ctsf, '.hist')
+    if histf:
+        # the counter made it
+        shutil.copy(histf, 'kmers.hist')
 
-    cov_out = open('kmers.hist', 'w')
-    for cov in range(0,cov_max):
-        if kmer_hist[cov]:
-            print >> cov_out, '%d\t%d' % (cov+1,kmer_hist[cov])
-    cov_out.close()
+    else:
+        # make kmer histogram
+        cov_max = 0
+        for (kmer,cov) in read_counts(ctsf):
+            cov = int(cov)
+            if cov > cov_max:
+                cov_max = cov
+
+        kmer_hist = [0]*cov_max
+        for (kmer,cov) in read_counts(ctsf):
+            kmer_hist[int(cov)-1] += 1
+
+        cov_out = open('kmers.hist', 'w')
+        for cov in range(0,cov_max):
+            if kmer_hist[cov]:
+                print >> cov_out, '%d\t%d' % (cov+1,kmer_hist[cov])
+        cov_out.close()
 
     p = subprocess.Popen('R --slave --args %d < %s/cov_model.r 2> r.log' % (ratio,quake.quake_dir), shell=True)
     os.waitpid(p.pid,0)
@@ -81,11 +89,14 @@ def model_cutoff(ctsf, ratio):
 # kmer.
 ############################################################
 def model_q_cutoff(ctsf, sample, ratio, no_sample=False):
-    if not no_sample:
+    samplef = counter_stats(ctsf, '.sample')
+    if not no_sample and samplef:
+        # subsample the counter's sample
+        write_sample([line.rstrip() for line in open(samplef)], sample)
+
+    elif not no_sample:
         # count number of kmer coverages
-        num_covs = 0
-        for line in open(ctsf):
-            num_covs += 1
+        num_covs = num_counts(ctsf)
 
         # choose random kmer coverages
         div100 = False
@@ -103,16 +114,16 @@ def model_q_cutoff(ctsf, sample, ratio, no_sample=False):
         out = open('kmers.txt', 'w')
         kmer_i = 0
         rand_i = 0
-        for line in open(ctsf):
+        for (kmer,cov) in read_counts(ctsf):
             if div100:
                 if kmer_i % 100 == 0 and kmer_i/100 == rand_covs[rand_i]:
-                    print >> out, line.split()[1]
+                    print >> out, cov
                     rand_i += 1
                     if rand_i >= sample:
                         break
             else:
                 if kmer_i == rand_covs[rand_i]:
-                    print >> out, line.split()[1]
+                    print >> out, cov
                     rand_i += 1
                     if rand_i >= sample:
                         break
@@ -131,36 +142,46 @@ def model_q_cutoff(ctsf, sample, ratio, no_sample=False):
 ############################################################
 def model_q_gc_cutoffs(ctsf, sample, ratio):
     # count number of kmer coverages at each at
-    k = len(open(ctsf).readline().split()[0])
-    num_covs_at = [0]*(k+1)
-    for line in open(ctsf):
-        kmer = line.split()[0]
-        num_covs_at[count_at(kmer)] += 1
+    k = len(read_counts(ctsf).next()[0])
+    at_samplef = counter_stats(ctsf, '.at.sample')
+    if at_samplef:
+        # the counter sampled each AT bin
+        at_covs = [[] for at in range(k+1)]
+        for line in open(at_samplef):
+            (at,cov) = line.split()
+            at_covs[int(at)].append(cov)
+    else:
+        num_covs_at = [0]*(k+1)
+        for (kmer,cov) in read_counts(ctsf):
+            num_covs_at[count_at(kmer)] += 1
 
     # for each AT bin
     at_cutoffs = []
     for at in range(1,k):
-        # sample covs
-        if sample >= num_covs_at[at]:
-            rand_covs = range(num_covs_at[at])
-        else:
-            rand_covs = random.sample(xrange(num_covs_at[at]), sample)
-        rand_covs.sort()
+        if at_samplef:
+            write_sample(at_covs[at], sample)
 
-        # print to file
-        out = open('kmers.txt', 'w')
-        kmer_i = 0
-        rand_i = 0
-        for line in open(ctsf):
-            (kmer,cov) = line.split()
-            if count_at(kmer) == at:
-                if kmer_i == rand_covs[rand_i]:
-                    print >> out, cov
-                    rand_i += 1
-                    if rand_i >= sample:
-                        break
-                kmer_i += 1
-        out.close()
+        else:
+            # sample covs
+            if sample >= num_covs_at[at]:
+                rand_covs = range(num_covs_at[at])
+            else:
+                rand_covs = random.sample(xrange(num_covs_at[at]), sample)
+            rand_covs.sort()
+
+            # print to file
+            out = open('kmers.txt', 'w')
+            kmer_i = 0
+            rand_i = 0
+            for (kmer,cov) in read_counts(ctsf):
+                if count_at(kmer) == at:
+                    if kmer_i == rand_covs[rand_i]:
+                        print >> out, cov
+                        rand_i += 1
+                        if rand_i >= sample:
+                            break
+                    kmer_i += 1
+            out.close()
         
         p = subprocess.Popen('R --slave --args %d < %s/cov_model_qmer.r 2> r%d.log' % (ratio,quake.quake_dir,at), shell=True)
         os.waitpid(p.pid,0)
@@ -190,8 +211,7 @@ def model_q_gc_cutoffs(ctsf, sample, ratio):
 def model_q_gc_cutoffs_bigmem(ctsf, sample, ratio):
     # input coverages
     k = 0
-    for line in open(ctsf):
-        (kmer,cov) = line.split()
+    for (kmer,cov) in read_counts(ctsf):
         if k == 0:
             k = len(kmer)
             at_covs = ['']*(k+1)
@@ -235,6 +255,100 @@ def model_q_gc_cutoffs_bigmem(ctsf, sample, ratio):
     out.close()
         
     
+############################################################
+# counter_stats
+#
+# Return the file of coverage statistics with the given
+# suffix that count-mers --hist wrote along with ctsf, or
+# None if there isn't one as new as ctsf
+############################################################
+def counter_stats(ctsf, suffix):
+    statsf = ctsf + suffix
+    if os.path.isfile(statsf) and os.path.getmtime(statsf) >= os.path.getmtime(ctsf):
+        return statsf
+    return None
+
+
+############################################################
+# write_sample
+#
+# Write at most 'sample' of the coverages 'covs', chosen at
+# random, to kmers.txt
+############################################################
+def write_sample(covs, sample):
+    if sample < len(covs):
+        covs = random.sample(covs, sample)
+    out = open('kmers.txt', 'w')
+    for cov in covs:
+        print >> out, cov
+    out.close()
+
+
+############################################################
+# read_counts
+#
+# Generate (kmer, count) pairs of strings from a file of
+# kmer counts, either text or a binary mer file, decoding
+# its blocks of varint differences and counts.
+############################################################
+def read_counts(ctsf):
+    cts_in = open(ctsf, 'rb')
+    if cts_in.read(len(mer_file_magic)) != mer_file_magic:
+        cts_in.seek(0)
+        for line in cts_in:
+            (kmer,cov) = line.split()
+            yield (kmer,cov)
+        return
+
+    (version,k,quality,block_mers,count_scale,mers,blocks,index_offset) = struct.unpack('<IIIIdQQQ', cts_in.read(48))
+    cts_in.seek(index_offset)
+    index = [struct.unpack('<QQIIII', cts_in.read(32)) for b in range(blocks)]
+
+    for (first_mer,offset,zbytes,raw_bytes,block_mers,pad) in index:
+        cts_in.seek(offset)
+        raw = zlib.decompress(cts_in.read(zbytes))
+        mer = first_mer
+        i = 0
+        for m in range(block_mers):
+            vals = []
+            for v in range(2):
+                val = 0
+                shift = 0
+                while True:
+                    b = ord(raw[i])
+                    i += 1
+                    val |= (b & 0x7f) << shift
+                    shift += 7
+                    if b < 0x80:
+                        break
+                vals.append(val)
+            mer += vals[0]
+
+            kmer = ''.join(['ACGT'[(mer >> 2*(k-1-j)) & 3] for j in range(k)])
+            if quality:
+                yield (kmer, '%f' % (vals[1] / count_scale))
+            else:
+                yield (kmer, '%d' % vals[1])
+
+
+############################################################
+# num_counts
+#
+# Number of kmers in a file of kmer counts, from the header
+# of a binary mer file
+############################################################
+def num_counts(ctsf):
+    cts_in = open(ctsf, 'rb')
+    if cts_in.read(len(mer_file_magic)) == mer_file_magic:
+        cts_in.seek(32)
+        return struct.unpack('<Q', cts_in.read(8))[0]
+
+    num_covs = 0
+    for line in open(ctsf):
+        num_covs += 1
+    return num_covs
+
+
 ############################################################
 # count_at
 #
@@ -23,23 +23,26 @@ def main():
     # General options
     parser.add_option('-r', dest='readsf', help='Fastq file of reads')
     parser.add_option('-f', dest='reads_listf', help='File containing fastq file names, one per line or two per line for paired end reads.')
-    parser.add_option('-k', dest='k', type='int', help='Size of k-mers to correct')
+    parser.add_option('-k', dest='k', type='int', help='Size of k-mers to correct. If not given, it is chosen from estimates of the genome size made by a pass over the reads')
     parser.add_option('-p', dest='proc', type='int', default=4, help='Number of processes [default: %default]')
     parser.add_option('-q', dest='quality_scale', type='int', default=-1, help='Quality value ascii scale, generally 64 or 33. If not specified, it will guess.')
 
 
     # Count options
     count_group = OptionGroup(parser, 'K-mer counting')
-    count_group.add_option('--no_jelly', dest='no_jelly', action='store_true', default=False, help='Count k-mers using a simpler program than Jellyfish')
+    count_group.add_option('--jelly', dest='jelly', action='store_true', default=False, help='Count k-mers using Jellyfish rather than count-mers [default: %default]')
+    count_group.add_option('--no_jelly', dest='no_jelly', action='store_true', default=False, help='Count k-mers using the older single-threaded programs')
     count_group.add_option('--no_count', dest='no_count', action='store_true', default=False, help='Kmers are already counted and in expected file [reads file].qcts or [reads file].cts [default: %default]')    
     count_group.add_option('--int', dest='count_kmers', action='store_true', default=False, help='Count kmers as integers w/o the use of quality values [default: %default]')
     count_group.add_option('--count_only', dest='count_only', action='store_true', default=False, help=SUPPRESS_HELP)
-    count_group.add_option('--hash_size', dest='hash_size', type='int', help='Jellyfish hash-size parameter. Quake will estimate using k if not given')
+    count_group.add_option('--count_limit', dest='count_limit', type='float', help='Gigabyte limit on RAM for count-mers, which then counts k-mers in bins on disk')
+    count_group.add_option('--hash_size', dest='hash_size', type='int', help='Initial hash table size for count-mers or Jellyfish. Quake will estimate using k if not given')
     parser.add_option_group(count_group)
 
     # Model options
     model_group = OptionGroup(parser, 'Coverage model')
     model_group.add_option('--no_cut', dest='no_cut', action='store_true', default=False, help='Coverage model is optimized and cutoff was printed to expected file cutoff.txt [default: %default]')
+    model_group.add_option('--cutoff', dest='cutoff', type='float', help='Trusted k-mer cutoff to use rather than modeling coverage. count-mers then writes the trusted k-mers straight to a bithash for correct, without a counts file.')
     model_group.add_option('--ratio', dest='ratio', type='int', default=200, help='Likelihood ratio to set trusted/untrusted cutoff.  Generally set between 10-1000 with lower numbers suggesting a lower threshold. [default: %default]')
     parser.add_option_group(model_group)
 
@@ -63,11 +66,6 @@ def main():
         quality_scale = guess_quality_scale(options.readsf, options.reads_listf)
     else:
         quality_scale = options.quality_scale
-    if not options.k:
-        parser.error('Must provide k-mer size with -k')
-    elif options.k > 20:
-        print >> sys.stderr, 'k=%d is a high k-mer value and should be reserved for enormous genomes (see the FAQ on the Quake website). Nevertheless, the program will proceed assuming you have chosen well.' % options.k
-
     if options.count_kmers:
         cts_suf = 'cts'
     else:
@@ -79,14 +77,35 @@ def main():
         ctsf = '%s.%s' % (os.path.split(options.reads_listf)[1], cts_suf)
         reads_str = '-f %s' % options.reads_listf
 
+    # estimate k and the table size, unless given or, for count-mers, grown
+    counting = not options.no_count and not options.no_cut
+    if not options.k or (counting and options.jelly and not options.hash_size):
+        estimates = estimate_mers(reads_str, options.k, options.proc)
+        if not options.k:
+            if 'recommended_k' not in estimates:
+                parser.error('Could not estimate the genome size to choose a k-mer size; provide it with -k')
+            options.k = int(estimates['recommended_k'])
+            print >> sys.stderr, 'Estimated genome size %s, choosing k=%d' % (estimates['genome_size'], options.k)
+        # sized for k, or if it wasn't tested, the nearest k that was
+        if not options.hash_size and 'table_size' in estimates:
+            options.hash_size = int(estimates['table_size'])
+    if options.k > 20:
+        print >> sys.stderr, 'k=%d is a high k-mer value and should be reserved for enormous genomes (see the FAQ on the Quake website). Nevertheless, the program will proceed assuming you have chosen well.' % options.k
+
+    # count straight into trusted k-mers given a cutoff
+    direct = options.cutoff and not options.jelly and not options.no_jelly
+    bithashf = os.path.splitext(ctsf)[0] + '.bithash'
+
     ############################################
     # count kmers
     ############################################
     if not options.no_count and not options.no_cut:
         if options.no_jelly:
             count_kmers(options.readsf, options.reads_listf, options.k, ctsf, quality_scale)
-        else:
+        elif options.jelly:
             jellyfish(options.readsf, options.reads_listf, options.k, ctsf, quality_scale, options.hash_size, options.proc)
+        else:
+            count_mers(reads_str, options.k, ctsf, quality_scale, options.hash_size, options.count_limit, options.proc, direct and (options.cutoff, bithashf))
 
         if options.count_only:
             exit(0)
@@ -94,7 +113,7 @@ def main():
     ############################################
     # model coverage
     ############################################
-    if not options.no_cut:
+    if not options.no_cut and not options.cutoff:
         # clear file
         if os.path.isfile('cutoff.txt'):
             os.remove('cutoff.txt')
@@ -115,19 +134,74 @@ def main():
     # correct reads
     ############################################
     correct_options = make_cor_opts(options)
-    if options.model_gc:        
+    if direct:
+        # run correct C++ code on the trusted k-mers
+        p = subprocess.Popen('%s/correct %s %s -b %s -q %d' % (quake_dir, correct_options, reads_str, bithashf, quality_scale), shell=True)
+        os.waitpid(p.pid, 0)
+
+    elif options.model_gc and not options.cutoff:        
         # run correct C++ code
         p = subprocess.Popen('%s/correct %s %s -m %s -a cutoffs.gc.txt -q %d' % (quake_dir, correct_options, reads_str, ctsf, quality_scale), shell=True)
         os.waitpid(p.pid, 0)
 
     else:
-        cutoff = get_cutoff()            
+        if options.cutoff:
+            cutoff = str(options.cutoff)
+        else:
+            cutoff = get_cutoff()
 
         # run correct C++ code
         p = subprocess.Popen('%s/correct %s %s -m %s -c %s -q %d' % (quake_dir, correct_options, reads_str, ctsf, cutoff, quality_scale), shell=True)
         os.waitpid(p.pid, 0)
 
 
+################################################################################
+# count_mers
+#
+# Count kmers in the reads files using my multi-threaded program, which reads
+# all the files itself, zipped or not.  Given 'trusted', a cutoff and a bithash
+# file, write only the trusted kmers to the bithash instead.
+################################################################################
+def count_mers(reads_str, k, ctsf, quality_scale, hash_size, count_limit, proc, trusted=None):
+    count_opts = '-k %d -p %d -q %d' % (k, proc, quality_scale)
+    if hash_size:
+        count_opts += ' -s %d' % hash_size
+    if count_limit:
+        count_opts += ' -l %f' % count_limit
+    if ctsf[-5:] != '.qcts':
+        count_opts += ' --int'
+
+    if trusted:
+        count_opts += ' -c %f --bithash %s' % trusted
+    else:
+        count_opts += ' -o %s --hist %s' % (ctsf, ctsf)
+
+    p = subprocess.Popen('%s/count-mers %s %s' % (quake_dir, count_opts, reads_str), shell=True)
+    os.waitpid(p.pid, 0)
+
+
+################################################################################
+# estimate_mers
+#
+# Estimate the k-mers of the reads for k, or a range of k if not given, with
+# count-mers --estimate, returning its recommendations, e.g. recommended_k and
+# table_size, as strings by name.
+################################################################################
+def estimate_mers(reads_str, k, proc):
+    est_opts = '-p %d' % proc
+    if k:
+        est_opts += ' -k %d' % k
+
+    p = subprocess.Popen('%s/count-mers --estimate %s %s' % (quake_dir, est_opts, reads_str), shell=True, stdout=subprocess.PIPE)
+    estimates = {}
+    for line in p.stdout:
+        a = line.split()
+        if len(a) == 2:
+            estimates[a[0]] = a[1]
+    p.wait()
+    return estimates
+
+
 ################################################################################
 # count_kmers
 #
@@ -1,5 +1,10 @@
 #include "Read.h"
 #include "bithash.h"
+#include "fastq.h"
+#include "kmer.h"
+#include "memo.h"
+#include "metrics.h"
+#include "quality.h"
 #include <iostream>
 #include <math.h>
 #include <algorithm>
@@ -45,18 +50,23 @@ Read::Read(const string & h, const unsigned int* s, const string & q, vector<int
   seq = new unsigned int[read_length];
   quals = new unsigned int[read_length];
   prob = new float[read_length];
+  quals_to_ints(q.data(), read_length, quality_scale, quals);
+  const quality_table & qtable = quality_lookup();
   for(int i = 0; i < read_length; i++) {
     seq[i] = s[i];
     // quality values of 0,1 lead to p < .25
-    quals[i] = q[i] - quality_scale;
     if(quals[i] >= max_qual) {
 	 cerr << "Quality value " << quals[i] << "larger than maximum allowed quality value " << max_qual << ". Increase the variable 'max_qual' in Read.h." << endl;
 	 exit(EXIT_FAILURE);
     }	 
-    prob[i] = max(.25, 1.0-pow(10.0,-(quals[i]/10.0)));
+    prob[i] = qtable.prob(quals[i]);
   }
   trusted_read = 0;
   global_like = 1.0;
+  context_lookups = 0;
+  context_hits = 0;
+  context_verified = 0;
+  metrics = NULL;
 }
 
 Read::~Read() {
@@ -162,7 +172,7 @@ int Read::correct_cc(vector<short> region, vector<int> untrusted_subset, bithash
     quality_quicksort(region, 0, region.size()-1);
   else
     // die quietly and try again with bigger region
-    return 3;
+    return record_cc(3, 0, 0, 0);
 
   ////////////////////////////////////////
   // stats
@@ -192,7 +202,7 @@ int Read::correct_cc(vector<short> region, vector<int> untrusted_subset, bithash
   if(learning) {
     if(nt99 >= 8 || non_acgt > 1) {
       //out << header << "\t" << print_seq() << "\t." << endl;
-      return 2;
+      return record_cc(2, 0, 0, nt99);
     }
     mylike_t = learning_min_t;
     myglobal_t = learning_min_t;
@@ -202,7 +212,7 @@ int Read::correct_cc(vector<short> region, vector<int> untrusted_subset, bithash
     if(TESTING)
 	cerr << header << "\t" << print_seq() << "\t." << endl;
     //cerr << header << "\t" << region.size() << "\t" << untrusted_subset.size() << "\t" << nt90 << "\t" << nt99 << "\t" << exp_errors << "\t0\t0\t0\t0" << endl;
-    return 2;
+    return record_cc(2, 0, 0, nt99);
 
   } else if(nt99 >= 11) {  
     // proceed very cautiously
@@ -427,21 +437,39 @@ int Read::correct_cc(vector<short> region, vector<int> untrusted_subset, bithash
   
   if(trusted_read != 0) {
     //cerr << header << "\t" << region.size() << "\t" << untrusted_subset.size() << "\t" << nt90 << "\t" << nt99 << "\t" << exp_errors << "\t" << cpq_adds << "\t" << check_count << "\t1\t" << trusted_read->likelihood << endl;
-    return 0;
+    return record_cc(0, cpq_adds, check_count, nt99);
   } else {
     if(TESTING && mylike_t > correct_min_t)
       cerr << header << "\t" << print_seq() << "\t." << endl;
     //cerr << header << "\t" << region.size() << "\t" << untrusted_subset.size() << "\t" << nt90 << "\t" << nt99 << "\t" << exp_errors << "\t" << cpq_adds << "\t" << check_count << "\t0\t0" << endl;
 
     if(ambiguous_flag)
-      return 1;
+      return record_cc(1, cpq_adds, check_count, nt99);
     else if(cpq.size() > max_queue_size)
-      return 2;
+      return record_cc(2, cpq_adds, check_count, nt99);
     else
-      return 3;
+      return record_cc(3, cpq_adds, check_count, nt99);
   }
 }
 
+
+////////////////////////////////////////////////////////////
+// record_cc
+//
+// Record a correct_cc search's result 'code', number of
+// corrected reads queued, kmers checked and low quality
+// nts in metrics, if set, and return 'code'.
+////////////////////////////////////////////////////////////
+int Read::record_cc(int code, unsigned int cpq_adds, unsigned int check_count, int nt99) {
+  if(metrics != NULL) {
+    metrics->cc_results[code]++;
+    metrics->queue_adds.add_log2(cpq_adds);
+    metrics->trust_checks.add_log2(check_count);
+    metrics->nt99.add(nt99);
+  }
+  return code;
+}
+
 ////////////////////////////////////////////////////////////
 // print_seq
 ////////////////////////////////////////////////////////////
@@ -486,9 +514,18 @@ string Read::print_corrected(vector<correction> & cor, int print_nt) {
 // Perform correction by breaking up untrusted kmers
 // into connected components and correcting them
 // independently.
+//
+// Returns the length of the corrected read after
+// trimming, and sets 'cors' to the corrections to apply
+// to it rather than printing it.
+//
+// If 'context_memo' is given, each component first tries
+// the correction cached for its error context, which is
+// used if it makes all the component's kmers trusted, and
+// components corrected by search save their corrections.
 ////////////////////////////////////////////////////////////
 //string Read::correct(bithash *trusted, double (&ntnt_prob)[4][4], double prior_prob[4], bool learning) {
-string Read::correct(bithash *trusted, double ntnt_prob[][4][4], double prior_prob[4], bool learning) {
+int Read::correct(bithash *trusted, double ntnt_prob[][4][4], double prior_prob[4], vector<correction> & cors, bool learning, memo_table * context_memo) {
   ////////////////////////////////////////
   // find connected components
   ////////////////////////////////////////
@@ -511,42 +548,65 @@ string Read::correct(bithash *trusted, double ntnt_prob[][4][4], double prior_pr
   ////////////////////////////////////////
   // process connected components
   ////////////////////////////////////////
-  vector<correction> multi_cors;
+  vector<correction> & multi_cors = cors;
+  multi_cors.clear();
   vector<short> chop_region;
   vector<short> big_region;
   int chop_correct_code, big_correct_code;
+  unsigned long long ckey = 0;
+  unsigned long long cvalue;
+  int cstart = 0;
   for(cc = 0; cc < cc_untrusted.size(); cc++) {
-    // try chopped error region
-    chop_region = error_region_chop(cc_untrusted[cc]);
-    chop_correct_code = correct_cc(chop_region, cc_untrusted[cc], trusted, ntnt_prob, prior_prob, learning);
-    if(chop_correct_code > 0) {
-      // try bigger error region
-      big_region = error_region(cc_untrusted[cc]);
-      if(chop_region.size() == big_region.size()) {
-	// cannot correct, and nothing found so trim to untrusted
-	if(chop_correct_code == 1)
-	  return print_corrected(multi_cors, chop_region.front());
-	else
-	  return print_corrected(multi_cors, cc_untrusted[cc].front());
-
-      } else {
-	big_correct_code = correct_cc(big_region, cc_untrusted[cc], trusted, ntnt_prob, prior_prob, learning);
+    // try the correction cached for this error context
+    bool cached = false;
+    if(context_memo != NULL && !learning) {
+      ckey = context_key(cc_untrusted[cc], cstart);
+      context_lookups++;
+      if(context_memo->lookup(ckey, cvalue)) {
+	context_hits++;
+	if(context_correct(cc_untrusted[cc], cvalue, cstart, trusted, ntnt_prob, prior_prob)) {
+	  context_verified++;
+	  cached = true;
+	}
+      }
+    }
 
-	if(big_correct_code == 1) {
-	  // ambiguous
-	  // cannot correct, but trim to region
+    if(!cached) {
+      // try chopped error region
+      chop_region = error_region_chop(cc_untrusted[cc]);
+      chop_correct_code = correct_cc(chop_region, cc_untrusted[cc], trusted, ntnt_prob, prior_prob, learning);
+      if(chop_correct_code > 0) {
+	// try bigger error region
+	big_region = error_region(cc_untrusted[cc]);
+	if(chop_region.size() == big_region.size()) {
+	  // cannot correct, and nothing found so trim to untrusted
 	  if(chop_correct_code == 1)
-	    return print_corrected(multi_cors, chop_region.front());
+	    return chop_region.front();
 	  else
-	    return print_corrected(multi_cors, big_region.front());
+	    return cc_untrusted[cc].front();
+
+	} else {
+	  big_correct_code = correct_cc(big_region, cc_untrusted[cc], trusted, ntnt_prob, prior_prob, learning);
+
+	  if(big_correct_code == 1) {
+	    // ambiguous
+	    // cannot correct, but trim to region
+	    if(chop_correct_code == 1)
+	      return chop_region.front();
+	    else
+	      return big_region.front();
 
-	} else if(big_correct_code == 2 || big_correct_code == 3) {
-	  // cannot correct, and chaotic or nothing found so trim to untrusted
-	  return print_corrected(multi_cors, cc_untrusted[cc].front());
+	  } else if(big_correct_code == 2 || big_correct_code == 3) {
+	    // cannot correct, and chaotic or nothing found so trim to untrusted
+	    return cc_untrusted[cc].front();
+	  }
 	}
       }
+      // else, corrected!
+
+      if(context_memo != NULL && !learning)
+	context_save(context_memo, ckey, cstart);
     }
-    // else, corrected!
 
     // corrected
     global_like *= trusted_read->likelihood;
@@ -561,8 +621,117 @@ string Read::correct(bithash *trusted, double ntnt_prob[][4][4], double prior_pr
   trusted_read = new corrected_read(multi_cors, tmp->untrusted, global_like, 0);
   delete tmp;
 
-  // print read with all corrections
-  return print_corrected(multi_cors);
+  // read with all corrections
+  return trim_length;
+}
+
+
+////////////////////////////////////////////////////////////
+// context_key
+//
+// Key for the error context of the untrusted kmers
+// 'untrusted_subset': the bases that any correction of
+// them and the kmers it affects can touch, where they lie
+// within the trimmed read, and the coarse quality values
+// of the untrusted kmers' bases.  Sets 'context_start' to
+// the first base of the context.
+////////////////////////////////////////////////////////////
+unsigned long long Read::context_key(const vector<int> & untrusted_subset, int & context_start) {
+  int front = untrusted_subset.front();
+  int back = untrusted_subset.back() + bithash::k - 1;
+  context_start = max(0, front - 2*(bithash::k-1));
+  int context_end = min(trim_length, back + bithash::k);
+
+  int layout[2] = {front - context_start, context_end - front};
+  unsigned long long h = hash_bytes((const char*)layout, sizeof(layout), 14695981039346656037ULL);
+  for(int i = context_start; i < context_end; i++) {
+    char nt = (char)seq[i];
+    h = hash_bytes(&nt, 1, h);
+  }
+
+  // quality values in steps of 10, up to 30
+  for(int i = front; i <= back && i < trim_length; i++) {
+    char q = (char)min(3u, quals[i] / 10);
+    h = hash_bytes(&q, 1, h);
+  }
+  return mix_hash(h);
+}
+
+
+////////////////////////////////////////////////////////////
+// context_correct
+//
+// Apply the corrections cached in 'value', relative to
+// 'context_start', to the untrusted kmers
+// 'untrusted_subset' and return true, setting
+// trusted_read, if they're all trusted afterwards and the
+// corrections are likely enough.
+////////////////////////////////////////////////////////////
+bool Read::context_correct(const vector<int> & untrusted_subset, unsigned long long value, int context_start, bithash *trusted, double ntnt_prob[][4][4], double prior_prob[4]) {
+  int unused;
+  vector<correction> cached;
+  unpack_correction_result(value, unused, cached);
+  if(cached.empty())
+    return false;
+
+  bitset<bitsize> bituntrusted;
+  for(int i = 0; i < untrusted_subset.size(); i++) {
+    if(untrusted_subset[i] >= bitsize)
+      return false;
+    bituntrusted.set(untrusted_subset[i]);
+  }
+
+  corrected_read *cr = new corrected_read(bituntrusted, 1.0, 0);
+  unsigned int check_count = 0;
+  float like = 1.0;
+  for(int c = 0; c < cached.size(); c++) {
+    short edit_i = context_start + cached[c].index;
+    short nt = cached[c].to;
+    if(edit_i >= trim_length || nt >= 4 || seq[edit_i] == nt) {
+      delete cr;
+      return false;
+    }
+
+    // as in correct_cc
+    if(seq[edit_i] < 4)
+      like *= (1.0-prob[edit_i]) * ntnt_prob[quals[edit_i]][nt][seq[edit_i]] * prior_prob[nt] / (prob[edit_i] * prior_prob[seq[edit_i]]);
+    else
+      like *= prior_prob[nt] / (1.0/3.0);
+
+    cr->corrections.push_back(correction(edit_i, nt));
+    check_trust(cr, trusted, check_count);
+  }
+
+  if(!cr->untrusted.none() || like < correct_min_t || global_like*like < correct_min_t) {
+    delete cr;
+    return false;
+  }
+
+  cr->likelihood = like;
+  if(trusted_read != 0)
+    delete trusted_read;
+  trusted_read = cr;
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////
+// context_save
+//
+// Cache trusted_read's corrections for the error context
+// 'key' starting at 'context_start', if they fit.
+////////////////////////////////////////////////////////////
+void Read::context_save(memo_table * context_memo, unsigned long long key, int context_start) {
+  vector<correction> relative;
+  for(int c = 0; c < trusted_read->corrections.size(); c++) {
+    if(trusted_read->corrections[c].index < context_start)
+      return;
+    relative.push_back(correction(trusted_read->corrections[c].index - context_start, trusted_read->corrections[c].to));
+  }
+
+  unsigned long long value;
+  if(pack_correction_result(0, relative, value))
+    context_memo->insert(key, value);
 }
 
 
@@ -782,27 +951,12 @@ bool Read::check_trust(corrected_read *cr, bithash *trusted, unsigned int & chec
 
   check_count += (kmer_end - kmer_start + 1);
 
-  bool non_acgt = false;
-  for(i = kmer_start; i < kmer_end+bithash::k; i++)
-    if(seq[i] >=4)
-      non_acgt = true;
-
-  //non_acgt = true;
-  if(non_acgt) {
-    // easier to just check kmers one by one
-    for(i = kmer_start; i <= kmer_end; i++)
-      // check kmer
-      cr->untrusted.set(i, !trusted->check(&seq[i]));
-
-  } else {
-    // check affected kmers
-    long long unsigned kmermap;
-    // check first kmer and save map value  
-    cr->untrusted.set(kmer_start, !trusted->check(&seq[kmer_start], kmermap));
-    for(i = kmer_start+1; i <= kmer_end; i++) {
-      // check kmer using map value
-      cr->untrusted.set(i, !trusted->check(kmermap, seq[i-1], seq[i+bithash::k-1]));
-    }
+  // check affected kmers, rolling the kmer along
+  kmer_roller roller(bithash::k);
+  for(i = kmer_start; i < kmer_end+bithash::k; i++) {
+    roller.add(seq[i]);
+    if(i >= kmer_start+bithash::k-1)
+      cr->untrusted.set(i-bithash::k+1, !roller.valid() || !trusted->check(roller.forward()));
   }
 
   // fix sequence
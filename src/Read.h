@@ -9,6 +9,9 @@
 
 using namespace::std;
 
+class memo_table;
+struct thread_metrics;
+
 //const int bitsize = 22;
 const int bitsize = 200;
 
@@ -76,7 +79,7 @@ class Read {
   ~Read();
 
   string trim(int t);
-  string correct(bithash *trusted, double ntnt_prob[][4][4], double prior_prob[4], bool learning = false);
+  int correct(bithash *trusted, double ntnt_prob[][4][4], double prior_prob[4], vector<correction> & cors, bool learning = false, memo_table * context_memo = NULL);
   int correct_cc(vector<short>, vector<int> untrusted_subset, bithash* trusted, double ntnt_prob[][4][4], double prior_prob[4], bool learning);
   vector<short> error_region(vector<int> untrusted_subset);
   vector<short> error_region_chop(vector<int> untrusted_subset);
@@ -95,6 +98,14 @@ class Read {
   vector<int> untrusted;
   corrected_read *trusted_read;
 
+  // error context cache use by correct
+  unsigned int context_lookups;
+  unsigned int context_hits;
+  unsigned int context_verified;
+
+  // if set, correct_cc records its searches here
+  thread_metrics * metrics;
+
   const static float trust_spread_t = .1;
   const static float correct_min_t = .000001;
   const static float learning_min_t = .00001;
@@ -105,6 +116,10 @@ class Read {
   bool untrusted_intersect(vector<int> untrusted_subset, vector<short> & region);
   void untrusted_union(vector<int> untrusted_subset, vector<short> & region);
   void quality_quicksort(vector<short> & indexes, int left, int right);
+  unsigned long long context_key(const vector<int> & untrusted_subset, int & context_start);
+  bool context_correct(const vector<int> & untrusted_subset, unsigned long long value, int context_start, bithash *trusted, double ntnt_prob[][4][4], double prior_prob[4]);
+  void context_save(memo_table * context_memo, unsigned long long key, int context_start);
+  int record_cc(int code, unsigned int cpq_adds, unsigned int check_count, int nt99);
 
   float global_like;  // to track likelihood across components
 
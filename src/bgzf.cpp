@@ -0,0 +1,379 @@
+#include "bgzf.h"
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+// empty block marking the end of a BGZF file
+static const char bgzf_eof[bgzf_eof_size] = {
+  31, -117, 8, 4, 0, 0, 0, 0, 0, -1, 6, 0, 66, 67, 2, 0, 27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+static const int bgzf_header_size = 18;
+static const int bgzf_footer_size = 8;
+
+////////////////////////////////////////////////////////////////////////////////
+// little endian helpers
+////////////////////////////////////////////////////////////////////////////////
+static void pack16(char* p, unsigned int x) {
+  p[0] = (char)(x & 0xff);
+  p[1] = (char)((x >> 8) & 0xff);
+}
+
+static void pack32(char* p, unsigned int x) {
+  pack16(p, x & 0xffff);
+  pack16(p+2, x >> 16);
+}
+
+static unsigned int unpack16(const char* p) {
+  return (unsigned int)(unsigned char)p[0] | ((unsigned int)(unsigned char)p[1] << 8);
+}
+
+static unsigned int unpack32(const char* p) {
+  return unpack16(p) | (unpack16(p+2) << 16);
+}
+
+bgzfstreambuf::bgzfstreambuf()
+  :file(NULL) {
+  ubuffer = new char[max_block_size];
+  cbuffer = new char[max_block_size];
+  indexing = false;
+  setp(ubuffer, ubuffer);
+  setg(ubuffer, ubuffer, ubuffer);
+}
+
+bgzfstreambuf::~bgzfstreambuf() {
+  close();
+  delete[] ubuffer;
+  delete[] cbuffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// open
+//
+// Open the file for reading or writing, but not both.
+////////////////////////////////////////////////////////////////////////////////
+bgzfstreambuf* bgzfstreambuf::open(const char* name, ios::openmode open_mode) {
+  if(is_open() || ((open_mode & ios::in) && (open_mode & ios::out)))
+    return NULL;
+
+  mode = open_mode;
+  file = fopen(name, (mode & ios::out) ? "wb" : "rb");
+  if(file == NULL)
+    return NULL;
+  file_name = name;
+
+  block_address = 0;
+  next_address = 0;
+  if(mode & ios::out)
+    setp(ubuffer, ubuffer + block_size);
+  else
+    setg(ubuffer, ubuffer, ubuffer);
+
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// close
+//
+// Write any buffered data, the EOF block, and the read index.
+////////////////////////////////////////////////////////////////////////////////
+bgzfstreambuf* bgzfstreambuf::close() {
+  if(!is_open())
+    return NULL;
+
+  bool ok = true;
+  if(mode & ios::out) {
+    int length = pptr() - pbase();
+    if(length > 0)
+      ok = write_block(length);
+    if(fwrite(bgzf_eof, 1, sizeof(bgzf_eof), file) != sizeof(bgzf_eof))
+      ok = false;
+    if(indexing)
+      write_index();
+  }
+
+  fclose(file);
+  file = NULL;
+  indexing = false;
+  return ok ? this : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// index_reads
+//
+// Index the records written from here on, which must be the start of the file.
+////////////////////////////////////////////////////////////////////////////////
+void bgzfstreambuf::index_reads(unsigned int lines_per_read, unsigned int interval) {
+  indexing = true;
+  index_lines = lines_per_read;
+  index_interval = interval;
+  lines = 0;
+  index_reads_at.clear();
+  index_offsets.clear();
+  index_reads_at.push_back(0);
+  index_offsets.push_back(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// overflow
+////////////////////////////////////////////////////////////////////////////////
+int bgzfstreambuf::overflow(int c) {
+  if(!is_open() || !(mode & ios::out))
+    return EOF;
+
+  int length = pptr() - pbase();
+  if(length > 0) {
+    if(!write_block(length))
+      return EOF;
+    setp(ubuffer, ubuffer + block_size);
+  }
+
+  if(c != EOF) {
+    *pptr() = (char)c;
+    pbump(1);
+  }
+  return (c == EOF) ? 0 : c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sync
+//
+// Partial blocks are deliberately not written so that frequent flushes don't
+// fragment the file.
+////////////////////////////////////////////////////////////////////////////////
+int bgzfstreambuf::sync() {
+  if(is_open() && (mode & ios::out))
+    fflush(file);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// write_block
+//
+// Compress and write the first 'length' bytes of the uncompressed buffer.
+////////////////////////////////////////////////////////////////////////////////
+bool bgzfstreambuf::write_block(int length) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+  zs.next_in = (Bytef*)ubuffer;
+  zs.avail_in = length;
+  zs.next_out = (Bytef*)(cbuffer + bgzf_header_size);
+  zs.avail_out = max_block_size - bgzf_header_size - bgzf_footer_size;
+  int status = deflate(&zs, Z_FINISH);
+  int clength = zs.total_out;
+  deflateEnd(&zs);
+  if(status != Z_STREAM_END) {
+    cerr << "BGZF block failed to compress in " << file_name << endl;
+    return false;
+  }
+
+  // header
+  int bsize = bgzf_header_size + clength + bgzf_footer_size;
+  const char header[bgzf_header_size] = {31, -117, 8, 4, 0, 0, 0, 0, 0, -1, 6, 0, 66, 67, 2, 0, 0, 0};
+  memcpy(cbuffer, header, bgzf_header_size);
+  pack16(cbuffer + 16, bsize - 1);
+
+  // footer
+  pack32(cbuffer + bgzf_header_size + clength, crc32(crc32(0L, Z_NULL, 0), (Bytef*)ubuffer, length));
+  pack32(cbuffer + bgzf_header_size + clength + 4, length);
+
+  if(indexing)
+    index_block(length, block_address + bsize);
+
+  if(fwrite(cbuffer, 1, bsize, file) != (size_t)bsize)
+    return false;
+  block_address += bsize;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// index_block
+//
+// Count lines in the block about to be written and save the virtual offsets
+// of indexed reads starting in it.
+////////////////////////////////////////////////////////////////////////////////
+void bgzfstreambuf::index_block(int length, unsigned long long next_block) {
+  const char* end = ubuffer + length;
+  for(const char* p = ubuffer; (p = (const char*)memchr(p, '\n', end-p)) != NULL; p++) {
+    if(++lines % index_lines == 0) {
+      unsigned long long read = lines / index_lines;
+      if(read % index_interval == 0) {
+	int u = p + 1 - ubuffer;
+	index_reads_at.push_back(read);
+	if(u < length)
+	  index_offsets.push_back((block_address << 16) | u);
+	else
+	  index_offsets.push_back(next_block << 16);
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// write_index
+//
+// Print the read index as lines of 'read number<tab>virtual offset', ending
+// with the total number of reads and the virtual offset of the end of data.
+////////////////////////////////////////////////////////////////////////////////
+void bgzfstreambuf::write_index() {
+  unsigned long long reads = lines / index_lines;
+  while(!index_reads_at.empty() && index_reads_at.back() >= reads) {
+    index_reads_at.pop_back();
+    index_offsets.pop_back();
+  }
+
+  string indexf = file_name + ".ridx";
+  ofstream index_out(indexf.c_str());
+  for(unsigned int i = 0; i < index_reads_at.size(); i++)
+    index_out << index_reads_at[i] << "\t" << index_offsets[i] << "\n";
+  index_out << reads << "\t" << (block_address << 16) << "\n";
+  index_out.close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// read_block
+//
+// Read and decompress the block at next_address.  Returns false at EOF.
+////////////////////////////////////////////////////////////////////////////////
+bool bgzfstreambuf::read_block() {
+  block_address = next_address;
+  setg(ubuffer, ubuffer, ubuffer);
+
+  char header[bgzf_header_size];
+  size_t n = fread(header, 1, bgzf_header_size, file);
+  if(n == 0)
+    return false;
+  if(n != bgzf_header_size || (unsigned char)header[0] != 31 || (unsigned char)header[1] != 139 || header[3] != 4 || unpack16(header+10) != 6 || header[12] != 'B' || header[13] != 'C') {
+    cerr << file_name << " is not in BGZF format" << endl;
+    exit(EXIT_FAILURE);
+  }
+  int bsize = unpack16(header+16) + 1;
+  int remaining = bsize - bgzf_header_size;
+  if(remaining < bgzf_footer_size || fread(cbuffer, 1, remaining, file) != (size_t)remaining) {
+    cerr << "Truncated BGZF block in " << file_name << endl;
+    exit(EXIT_FAILURE);
+  }
+  next_address = block_address + bsize;
+
+  int length = unpack32(cbuffer + remaining - 4);
+  if(length > 0) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, -15);
+    zs.next_in = (Bytef*)cbuffer;
+    zs.avail_in = remaining - bgzf_footer_size;
+    zs.next_out = (Bytef*)ubuffer;
+    zs.avail_out = max_block_size;
+    int status = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if(status != Z_STREAM_END || zs.total_out != (uLong)length) {
+      cerr << "Corrupt BGZF block in " << file_name << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  setg(ubuffer, ubuffer, ubuffer + length);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// underflow
+////////////////////////////////////////////////////////////////////////////////
+int bgzfstreambuf::underflow() {
+  if(gptr() < egptr())
+    return *(unsigned char*)gptr();
+  if(!is_open() || !(mode & ios::in))
+    return EOF;
+
+  // skip empty blocks
+  while(read_block()) {
+    if(gptr() < egptr())
+      return *(unsigned char*)gptr();
+  }
+  return EOF;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// seekoff
+//
+// Only supports telling the current virtual offset.
+////////////////////////////////////////////////////////////////////////////////
+streampos bgzfstreambuf::seekoff(streamoff off, ios::seekdir dir, ios::openmode) {
+  if(!is_open() || off != 0 || dir != ios::cur)
+    return streampos(streamoff(-1));
+  if(mode & ios::out)
+    return streampos(streamoff((block_address << 16) | (pptr() - pbase())));
+  else
+    return streampos(streamoff((block_address << 16) | (gptr() - eback())));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// seekpos
+//
+// Seek an input file to a virtual offset.
+////////////////////////////////////////////////////////////////////////////////
+streampos bgzfstreambuf::seekpos(streampos sp, ios::openmode) {
+  if(!is_open() || !(mode & ios::in))
+    return streampos(streamoff(-1));
+
+  unsigned long long voffset = (unsigned long long)streamoff(sp);
+  next_address = voffset >> 16;
+  unsigned int u = voffset & 0xffff;
+  if(fseeko(file, (off_t)next_address, SEEK_SET) != 0)
+    return streampos(streamoff(-1));
+  if(!read_block()) {
+    // end of file
+    if(u != 0)
+      return streampos(streamoff(-1));
+  } else if(u > egptr() - eback())
+    return streampos(streamoff(-1));
+  else
+    setg(eback(), eback() + u, egptr());
+
+  return sp;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// bgzfstreambase
+////////////////////////////////////////////////////////////////////////////////
+bgzfstreambase::bgzfstreambase(const char* name, ios::openmode open_mode) {
+  init(&buf);
+  open(name, open_mode);
+}
+
+bgzfstreambase::~bgzfstreambase() {
+  buf.close();
+}
+
+void bgzfstreambase::open(const char* name, ios::openmode open_mode) {
+  if(!buf.open(name, open_mode))
+    clear(rdstate() | ios::badbit);
+}
+
+void bgzfstreambase::close() {
+  if(buf.is_open())
+    if(!buf.close())
+      clear(rdstate() | ios::badbit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// load_read_index
+//
+// Load the read index for the BGZF file given, returning false if there is
+// none.  The last entry holds the total number of reads.
+////////////////////////////////////////////////////////////////////////////////
+bool load_read_index(string bgzff, vector<unsigned long long> & reads, vector<unsigned long long> & offsets) {
+  string indexf = bgzff + ".ridx";
+  ifstream index_in(indexf.c_str());
+  if(!index_in.good())
+    return false;
+
+  unsigned long long r, v;
+  while(index_in >> r >> v) {
+    reads.push_back(r);
+    offsets.push_back(v);
+  }
+  return !reads.empty();
+}
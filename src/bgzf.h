@@ -0,0 +1,117 @@
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace::std;
+
+// reads between entries of a read index
+const unsigned int read_index_interval = 1000;
+// size of the empty block marking the end of a BGZF file
+const unsigned int bgzf_eof_size = 28;
+
+////////////////////////////////////////////////////////////////////////////////
+// bgzfstreambuf
+//
+// Stream buffer for BGZF, the blocked gzip format of samtools/tabix.  Each
+// block is a separate gzip member holding at most 64 KB of data, so a byte is
+// addressed by a virtual offset: the compressed offset of its block shifted
+// left 16 bits, OR'ed with its offset within the uncompressed block.  BGZF
+// files are valid gzip files and can still be read by igzstream or gunzip.
+//
+// On output, the buffer can also index the records it writes, saving the
+// virtual offset of every read_index_interval'th read to <file>.ridx when
+// closed.  Blocks are only written when full or on close, so flushing the
+// stream (e.g. by endl) does not produce short blocks.
+////////////////////////////////////////////////////////////////////////////////
+class bgzfstreambuf : public streambuf {
+ public:
+  bgzfstreambuf();
+  ~bgzfstreambuf();
+  bgzfstreambuf* open(const char* name, ios::openmode open_mode);
+  bgzfstreambuf* close();
+  bool is_open() { return file != NULL; }
+  void index_reads(unsigned int lines_per_read, unsigned int interval);
+
+  const static int block_size = 0xff00;  // uncompressed data per block
+  const static int max_block_size = 0x10000;
+
+ protected:
+  virtual int overflow(int c = EOF);
+  virtual int underflow();
+  virtual int sync();
+  virtual streampos seekoff(streamoff off, ios::seekdir dir, ios::openmode which = ios::in | ios::out);
+  virtual streampos seekpos(streampos sp, ios::openmode which = ios::in | ios::out);
+
+ private:
+  bool write_block(int length);
+  bool read_block();
+  void index_block(int length, unsigned long long next_address);
+  void write_index();
+
+  FILE* file;
+  string file_name;
+  ios::openmode mode;
+  char* ubuffer;  // uncompressed block
+  char* cbuffer;  // compressed block
+  unsigned long long block_address;  // compressed offset of the current block
+  unsigned long long next_address;   // compressed offset of the following block
+
+  // read index
+  bool indexing;
+  unsigned int index_lines;
+  unsigned int index_interval;
+  unsigned long long lines;
+  vector<unsigned long long> index_reads_at;
+  vector<unsigned long long> index_offsets;
+};
+
+class bgzfstreambase : virtual public ios {
+ protected:
+  bgzfstreambuf buf;
+ public:
+  bgzfstreambase() { init(&buf); }
+  bgzfstreambase(const char* name, ios::openmode open_mode);
+  ~bgzfstreambase();
+  void open(const char* name, ios::openmode open_mode);
+  void close();
+  bgzfstreambuf* rdbuf() { return &buf; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// ibgzfstream / obgzfstream
+//
+// Use analogously to ifstream and ofstream.  seekg and tellg on an ibgzfstream
+// take and return virtual offsets, e.g. from a read index.
+////////////////////////////////////////////////////////////////////////////////
+class ibgzfstream : public bgzfstreambase, public istream {
+ public:
+  ibgzfstream() : istream(&buf) {}
+  ibgzfstream(const char* name, ios::openmode open_mode = ios::in)
+    : bgzfstreambase(name, open_mode), istream(&buf) {}
+  bgzfstreambuf* rdbuf() { return bgzfstreambase::rdbuf(); }
+  void open(const char* name, ios::openmode open_mode = ios::in) {
+    bgzfstreambase::open(name, open_mode);
+  }
+};
+
+class obgzfstream : public bgzfstreambase, public ostream {
+ public:
+  obgzfstream() : ostream(&buf) {}
+  obgzfstream(const char* name, ios::openmode open_mode = ios::out)
+    : bgzfstreambase(name, open_mode), ostream(&buf) {}
+  bgzfstreambuf* rdbuf() { return bgzfstreambase::rdbuf(); }
+  void open(const char* name, ios::openmode open_mode = ios::out) {
+    bgzfstreambase::open(name, open_mode);
+  }
+  void index_reads(unsigned int lines_per_read = 4, unsigned int interval = read_index_interval) {
+    buf.index_reads(lines_per_read, interval);
+  }
+};
+
+bool load_read_index(string bgzff, vector<unsigned long long> & reads, vector<unsigned long long> & offsets);
+
+#endif
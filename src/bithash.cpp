@@ -1,4 +1,6 @@
 #include "bithash.h"
+#include "kmer.h"
+#include "mer_file.h"
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
@@ -25,47 +27,6 @@ void bithash::add(unsigned long long kmer) {
 }
 
 
-////////////////////////////////////////////////////////////
-// check
-//
-// Check for the presence of a sequence in the tree
-//
-// Can handle N's!  Returns False!
-////////////////////////////////////////////////////////////
-bool bithash::check(unsigned kmer[]) {
-  unsigned long long kmermap = 0;
-  for(int i = 0; i < k; i++) {
-    if(kmer[i] < 4) {
-      kmermap <<= 2;
-      kmermap |= kmer[i];
-    } else
-      return false;
-  }
-  return bits[kmermap];
-}
-
-////////////////////////////////////////////////////////////
-// check
-//
-// Check for the presence of a sequence in the tree.
-// Pass the kmer map value back by reference to be re-used
-//
-// Can't handle N's!
-////////////////////////////////////////////////////////////
-bool bithash::check(unsigned kmer[], unsigned long long & kmermap) {
-  kmermap = 0;
-  for(int i = 0; i < k; i++) {
-    if(kmer[i] < 4) {
-      kmermap <<= 2;
-      kmermap |= kmer[i];
-    } else {
-      cerr << "Non-ACGT given to bithash::check" << endl;
-      exit(EXIT_FAILURE);
-    }
-  }
-  return bits[kmermap];
-}
-
 ////////////////////////////////////////////////////////////
 // check
 //
@@ -75,27 +36,6 @@ bool bithash::check(unsigned long long kmermap) {
   return bits[kmermap];
 }
 
-////////////////////////////////////////////////////////////
-// check
-//
-// Check for the presence of a sequence in the tree.
-// Pass the kmer map value back by reference to be re-used
-//
-// Can't handle N's!
-////////////////////////////////////////////////////////////
-bool bithash::check(unsigned long long & kmermap, unsigned last, unsigned next) {
-  if(next >= 4) {
-    cerr << "Non-ACGT given to bithash::check" << endl;
-    exit(EXIT_FAILURE);
-  } else {
-    kmermap <<= 2;
-    kmermap &= mask;
-    kmermap |= next;
-  }
-  return bits[kmermap];
-}
-
-
 ////////////////////////////////////////////////////////////
 // file_load
 //
@@ -153,11 +93,11 @@ void bithash::tab_file_load(istream & mer_in, const double boundary, unsigned lo
       
     // compare to boundary
     if(count >= boundary) {
-      // add to tree
-      add(binary_kmer(line.substr(0,k)));
-
-      // add reverse to tree
-      add(binary_rckmer(line.substr(0,k)));
+      // add it and its reverse to tree
+      unsigned long long fwd, rev;
+      encode_kmer(line.data(), k, fwd, rev);
+      add(fwd);
+      add(rev);
 
       // count gc
       if(atgc != NULL) {
@@ -194,11 +134,11 @@ void bithash::tab_file_load(istream & mer_in, const vector<double> boundary, uns
       
     // compare to boundary
     if(count >= boundary[at]) {
-      // add to tree
-      add(binary_kmer(line.substr(0,k)));
-
-      // add reverse to tree
-      add(binary_rckmer(line.substr(0,k)));
+      // add it and its reverse to tree
+      unsigned long long fwd, rev;
+      encode_kmer(line.data(), k, fwd, rev);
+      add(fwd);
+      add(rev);
 
       // count gc
       if(atgc != NULL) {
@@ -210,6 +150,54 @@ void bithash::tab_file_load(istream & mer_in, const vector<double> boundary, uns
   }
 }
 
+////////////////////////////////////////////////////////////
+// mer_file_load
+//
+// Make a prefix_tree from kmers in the binary mer file given
+// that occur >= "boundary" times, or >= boundary[at] times
+// for kmers with at A's and T's, decoding blocks in parallel
+////////////////////////////////////////////////////////////
+void bithash::mer_file_load(const char* merf, const double boundary, unsigned long long atgc[]) {
+  mer_file_load(merf, vector<double>(k+1, boundary), atgc);
+}
+
+void bithash::mer_file_load(const char* merf, const vector<double> boundary, unsigned long long atgc[]) {
+  mer_file_reader mer_in(merf);
+  if(mer_in.k() != k) {
+    cerr << "Kmers in " << merf << " are of length " << mer_in.k() << ", not " << k << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned long long at_sum = 0, gc_sum = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:at_sum,gc_sum)
+  for(long long b = 0; b < (long long)mer_in.blocks(); b++) {
+    vector<mer_count> mers;
+    mer_in.read_block(b, mers);
+
+    vector<unsigned long long> trusted_mers;
+    for(unsigned int i = 0; i < mers.size(); i++) {
+      int at = count_at(mers[i].mer);
+      if(mers[i].count >= boundary[at]) {
+	trusted_mers.push_back(mers[i].mer);
+	at_sum += at;
+	gc_sum += k-at;
+      }
+    }
+
+    // bits share words, so add them one block at a time
+#pragma omp critical
+    for(unsigned int i = 0; i < trusted_mers.size(); i++) {
+      add(trusted_mers[i]);
+      add(reverse_complement_kmer(trusted_mers[i], k));
+    }
+  }
+
+  if(atgc != NULL) {
+    atgc[0] += at_sum;
+    atgc[1] += gc_sum;
+  }
+}
+
 ////////////////////////////////////////////////////////////
 // binary_file_output
 //
@@ -332,49 +320,21 @@ int bithash::count_at(string seq) {
 }
 
 int bithash::count_at(unsigned long long seq) {
-  int at = 0;
-  unsigned long long mask = 3;
-  unsigned long long nt;
-  for(int i = 0; i < k; i++) {
-    nt = seq & mask;
-    seq >>= 2;
-
-    if(nt == 0 || nt == 3)
-      at++;
-  }
-  return at;
+  return kmer_at(seq, k);
 }
 
 //  Convert string  s  to its binary equivalent in  mer .
 unsigned long long  bithash::binary_kmer(const string & s) {
-  int  i;
-  unsigned long long mer = 0;
-  for  (i = 0; i < s.length(); i++) {
-    mer <<= 2;
-    mer |= binary_nt(s[i]);
-  }
-  return mer;
+  unsigned long long fwd, rev;
+  encode_kmer(s.data(), s.length(), fwd, rev);
+  return fwd;
 }
 
 //  Convert string s to its binary equivalent in mer .
 unsigned long long  bithash::binary_rckmer(const string & s) {
-  int  i;
-  unsigned long long mer = 0;
-  for  (i = s.length()-1; i >= 0; i--) {
-    mer <<= 2;
-    mer |= 3 - binary_nt(s[i]);
-  }
-  return mer;
-}
-
-//  Return the binary equivalent of  ch .
-unsigned bithash::binary_nt(char ch) {
-  switch  (tolower (ch)) {
-  case  'a' : return  0;
-  case  'c' : return  1;
-  case  'g' : return  2;
-  case  't' : return  3;
-  }
+  unsigned long long fwd, rev;
+  encode_kmer(s.data(), s.length(), fwd, rev);
+  return rev;
 }
 
 
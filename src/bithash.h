@@ -12,13 +12,12 @@ class bithash {
   bithash(int _k);
   ~bithash();
   void add(long long unsigned kmer);
-  bool check(unsigned kmer[]);
-  bool check(unsigned kmer[], long long unsigned & kmermap);
-  bool check(long long unsigned & kmermap, unsigned last, unsigned next);
   bool check(long long unsigned kmermap);
   void meryl_file_load(const char* merf, const double boundary);
   void tab_file_load(istream & mer_in, const double boundary, unsigned long long atgc[]);
   void tab_file_load(istream & mer_in, const vector<double> boundary, unsigned long long atgc[]);
+  void mer_file_load(const char* merf, const double boundary, unsigned long long atgc[]);
+  void mer_file_load(const char* merf, const vector<double> boundary, unsigned long long atgc[]);
   long long unsigned binary_kmer(const string &s);
   long long unsigned binary_rckmer(const string &s);
   void binary_file_output(char* outf);
@@ -28,7 +27,6 @@ class bithash {
 
   static int k;
  private:  
-  unsigned binary_nt(char ch);
   int count_at(string seq);
   int count_at(unsigned long long seq);
 
@@ -8,6 +8,7 @@
 #include <iomanip>
 #include <sstream>
 #include "bithash.h"
+#include "mer_file.h"
 
 using namespace::std;
 int bithash::k;
@@ -43,8 +44,9 @@ static void  Usage
            "\n"
            "Options:\n"
 	   " -m <file>\n"
-	   "    File containg kmer counts in format `seq\tcount`.\n"
-	   "    Can also be piped in with '-'\n"
+	   "    File containg kmer counts in format `seq\tcount`,\n"
+	   "    or in binary from count-mers -o. Text can also be\n"
+	   "    piped in with '-'\n"
 	   " -k <num>\n"
            "    K-mer size to correct.\n"
 	   " -c <num>\n"
@@ -171,7 +173,12 @@ int main(int argc, char **argv) {
   
   // make trusted kmer data structure
   bithash *trusted = new bithash(k);
-  if(ATcutf != NULL) {
+  if(strcmp(merf,"-") != 0 && mer_file_reader::is_mer_file(merf)) {
+    if(ATcutf != NULL)
+      trusted->mer_file_load(merf, load_AT_cutoffs(), NULL);
+    else
+      trusted->mer_file_load(merf, cutoff, NULL);
+  } else if(ATcutf != NULL) {
     if(strcmp(merf,"-") == 0)
       trusted->tab_file_load(cin, load_AT_cutoffs(), NULL);
     else {
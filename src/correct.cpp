@@ -1,6 +1,13 @@
 #include "bithash.h"
 #include "Read.h"
 #include "edit.h"
+#include "fastq.h"
+#include "kmer.h"
+#include "mer_file.h"
+#include "scheduler.h"
+#include "memo.h"
+#include "metrics.h"
+#include "trace.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -12,6 +19,7 @@
 #include <omp.h>
 #include <cstdlib>
 #include <iomanip>
+#include <algorithm>
 #include <sys/stat.h>
 #include <gzstream.h>
 
@@ -22,6 +30,16 @@ const static char* myopts = "r:f:k:m:b:c:a:t:q:l:p:zCuh";
 static struct option  long_options [] = {
   {"headers", 0, 0, 1000},
   {"log", 0, 0, 1001},
+  {"bgzf", 0, 0, 1002},
+  {"model", 1, 0, 1003},
+  {"save-model", 1, 0, 1004},
+  {"learn-once", 0, 0, 1005},
+  {"interleaved", 0, 0, 1006},
+  {"dup-cache", 1, 0, 1007},
+  {"context-cache", 1, 0, 1008},
+  {"metrics", 1, 0, 1009},
+  {"metrics-interval", 1, 0, 1010},
+  {"trace", 1, 0, 1011},
   {0, 0, 0, 0}
 };
 
@@ -32,6 +50,10 @@ static struct option  long_options [] = {
 
 // -z, zip output files
 //bool zip_output = false;
+// --bgzf, zip output files as BGZF with read indexes
+//bool bgzf_output = false;
+// --interleaved, paired end reads interleaved in one file
+//bool interleaved = false;
 
 // -k, kmer size
 static int k = 0;
@@ -66,6 +88,24 @@ static bool uncorrected_out = false;
 // --log, output correction log
 static bool out_log = false;
 
+// --model, load error model rather than learning it
+static char* modelf = NULL;
+// --save-model, save learned error model
+static char* save_modelf = NULL;
+// --learn-once, learn error model from the first file only
+static bool learn_once = false;
+// --dup-cache, MB for a cache of duplicate reads' corrections
+static unsigned int dup_cache_mb = 0;
+// --context-cache, MB for a cache of error contexts' corrections
+static unsigned int context_cache_mb = 0;
+// --metrics, prefix of periodic metrics files
+static char* metricsf = NULL;
+// --metrics-interval, seconds between metrics exports
+static double metrics_interval = 60;
+static metrics_export * metrics = NULL;
+// --trace, file for a Chrome trace of the run
+static char* tracef = NULL;
+
 static bool overwrite_temp = true;
 
 // Note: to not trim, set trimq=0 and trim_t>read_length-k
@@ -73,22 +113,54 @@ static bool overwrite_temp = true;
 // constants
 #define TESTING false
 static char* nts = "ACGTN";
-//unsigned int chunks_per_thread = 200;
-
- // to collect stats
-struct stats {
-  stats() {
-    validated = 0;
-    corrected = 0;
-    removed = 0;
-    trimmed = 0;
-    trimmed_only = 0;
-  }
-  unsigned long long validated;
-  unsigned long long corrected;
-  unsigned long long removed;
-  unsigned long long trimmed;
-  unsigned long long trimmed_only;
+
+// error model learning
+static const unsigned int learn_chunk_stride = 16;
+static const unsigned int learn_check_samples = 10000;
+static const unsigned int learn_max_samples = 200000;
+static const double learn_tolerance = .01;
+static const unsigned int learn_min_row_samples = 200;
+
+// tasks screened, corrected and output per thread in each
+// round of correct_reads and correct_pairs
+static const unsigned int round_tasks_per_thread = 4;
+// nts below this quality count towards a read's correction
+// cost, as in nt99 in Read::correct_cc, which gives up
+// quickly with more than heavy_max_low_qual of them
+static const int heavy_low_qual = 20;
+static const int heavy_max_low_qual = 12;
+
+// to collect stats, one per thread (and mate)
+typedef thread_metrics stats;
+
+// a task's reads held in memory between screening,
+// correcting and output, with their corrected lengths and
+// corrections, and the seconds spent on them
+struct read_batch {
+  task t;
+  fastq_batch reads;
+  vector<int> corlens;
+  vector< vector<correction> > cors;
+  double seconds;
+};
+
+// a read needing correction, with its estimated cost
+struct heavy_read {
+  unsigned long long cost;
+  read_batch * batch;
+  unsigned int read;
+};
+
+static bool heavier(const heavy_read & a, const heavy_read & b) {
+  return a.cost > b.cost;
+}
+
+// paired end outputs
+enum pair_out_kind { pair_out, single_out, single_err_out, err_out, log_out, pair_out_kinds };
+
+// a chunk's paired end output, by kind and mate
+struct pair_buffers {
+  output_buffer * out[pair_out_kinds][2];
 };
 
 static void  Usage
@@ -112,13 +184,20 @@ static void  Usage
 	   " -f <file>\n"
 	   "    File containing fastq file names, one per line or\n"
 	   "    two per line for paired end reads.\n"
+	   " --interleaved\n"
+	   "    Fastq files hold paired end reads interleaved,\n"
+	   "    mate 1 then mate 2. Pairs are output interleaved.\n"
 	   " -z\n"
 	   "    Write output files as gzipped.\n"
+	   " --bgzf\n"
+	   "    Write output files as gzipped in BGZF blocks, with a\n"
+	   "    read index <file>.ridx for random access. Indexed\n"
+	   "    BGZF input is corrected without unzipping it.\n"
 	   " -k <num>\n"
 	   "    K-mer size to correct.\n"
 	   " -m <file>\n"
 	   "    File containing kmer counts in format `seq\tcount`.\n"
-	   "    Can be gzipped.\n"
+	   "    Can be gzipped, or binary from count-mers -o.\n"
 	   " -b <file>\n"
 	   "    File containing saved bithash.\n"
 	   " -c <num>\n"
@@ -145,6 +224,37 @@ static void  Usage
 	   " --log\n"
 	   "    Output a log of all corrections into *.log as\n"
 	   "    'quality position new_nt old_nt'\n"
+	   " --model <file>\n"
+	   "    Load the error model from <file>, saved by\n"
+	   "    --save-model, rather than learning it.\n"
+	   " --save-model <file>\n"
+	   "    Save the error model learned from the first fastq\n"
+	   "    file to <file>.\n"
+	   " --learn-once\n"
+	   "    Learn the error model from the first fastq file and\n"
+	   "    use it for all files.\n"
+	   " --dup-cache <num>\n"
+	   "    Cache the corrections of reads in <num> MB shared\n"
+	   "    by all threads, so exact duplicates of a read (by\n"
+	   "    sequence and quality values) aren't corrected again.\n"
+	   " --context-cache <num>\n"
+	   "    Cache the corrections of error contexts (the bases\n"
+	   "    around a read's untrusted kmers and their coarse\n"
+	   "    quality values) in <num> MB shared by all threads,\n"
+	   "    and try them first on other reads with the same\n"
+	   "    context, searching only if they don't make all the\n"
+	   "    kmers trusted.\n"
+	   " --metrics <prefix>\n"
+	   "    Periodically write throughput, time by stage, read\n"
+	   "    outcomes, cache hits and error region search\n"
+	   "    statistics to <prefix>.json and, in the Prometheus\n"
+	   "    text format, <prefix>.prom.\n"
+	   " --metrics-interval <num>=60\n"
+	   "    Write metrics every <num> seconds.\n"
+	   " --trace <file>\n"
+	   "    Write a timeline of each thread's stages and tasks to\n"
+	   "    <file> as Chrome trace events, to open in\n"
+	   "    chrome://tracing or Perfetto.\n"
            "\n");
 
    return;
@@ -252,6 +362,59 @@ static void parse_command_line(int argc, char **argv) {
       out_log = true;
       break;
 
+    case 1002:
+      zip_output = true;
+      bgzf_output = true;
+      break;
+
+    case 1003:
+      modelf = strdup(optarg);
+      break;
+
+    case 1004:
+      save_modelf = strdup(optarg);
+      break;
+
+    case 1005:
+      learn_once = true;
+      break;
+
+    case 1006:
+      interleaved = true;
+      break;
+
+    case 1007:
+      dup_cache_mb = int(strtol(optarg, &p, 10));
+      if(p == optarg || int(dup_cache_mb) <= 0) {
+	fprintf(stderr, "Bad duplicate read cache size \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 1008:
+      context_cache_mb = int(strtol(optarg, &p, 10));
+      if(p == optarg || int(context_cache_mb) <= 0) {
+	fprintf(stderr, "Bad error context cache size \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 1009:
+      metricsf = strdup(optarg);
+      break;
+
+    case 1010:
+      metrics_interval = strtod(optarg, &p);
+      if(p == optarg || metrics_interval <= 0) {
+	fprintf(stderr, "Bad metrics interval \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 1011:
+      tracef = strdup(optarg);
+      break;
+
     case 'h':
       Usage(argv[0]);
       exit(EXIT_FAILURE);
@@ -297,6 +460,25 @@ static void parse_command_line(int argc, char **argv) {
     cerr << "Must provide a file of kmer counts (-m) or a saved bithash (-b)" << endl;
     exit(EXIT_FAILURE);
   }
+
+  if(modelf != NULL && save_modelf != NULL) {
+    cerr << "Cannot both load (--model) and save (--save-model) an error model" << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// init_probs
+//
+// Set all nt->nt transitions equally likely.
+////////////////////////////////////////////////////////////
+static void init_probs(double ntnt_prob[Read::max_qual][4][4]) {
+  for(int q = 0; q < Read::max_qual; q++)
+    for(int i = 0; i < 4; i++)
+      for(int j = 0; j < 4; j++)
+	if(i != j)
+	  ntnt_prob[q][i][j] = 1.0/3.0;
 }
 
 
@@ -402,39 +584,146 @@ void output_model(double ntnt_prob[Read::max_qual][4][4], unsigned int ntnt_coun
 }
 
 
+////////////////////////////////////////////////////////////
+// save_model
+//
+// Save the error model to modelf in a format load_model
+// can read back: a header line, then one line per
+// substitution 'quality from_nt to_nt probability count'.
+////////////////////////////////////////////////////////////
+static void save_model(double ntnt_prob[Read::max_qual][4][4], unsigned int ntnt_counts[Read::max_qual][4][4], string modelf) {
+  ofstream mod_out(modelf.c_str());
+  if(!mod_out.good()) {
+    cerr << "Cannot open error model file " << modelf << " for writing" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  mod_out << "quake_error_model\t" << Read::max_qual << endl;
+  mod_out << setprecision(17);
+  for(int q = 0; q < Read::max_qual; q++)
+    for(int i = 0; i < 4; i++)
+      for(int j = 0; j < 4; j++)
+	if(i != j)
+	  mod_out << q << "\t" << nts[i] << "\t" << nts[j] << "\t" << ntnt_prob[q][i][j] << "\t" << ntnt_counts[q][i][j] << endl;
+  mod_out.close();
+}
+
+
+////////////////////////////////////////////////////////////
+// load_model
+//
+// Load an error model saved by save_model into ntnt_prob.
+////////////////////////////////////////////////////////////
+static void load_model(double ntnt_prob[Read::max_qual][4][4], string modelf) {
+  ifstream mod_in(modelf.c_str());
+  if(!mod_in.good()) {
+    cerr << "Cannot open error model file " << modelf << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  string magic;
+  int max_qual;
+  mod_in >> magic >> max_qual;
+  if(magic != "quake_error_model" || max_qual != Read::max_qual) {
+    cerr << modelf << " is not an error model saved by correct --save-model" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  int q;
+  char nti, ntj;
+  double prob;
+  unsigned int count;
+  unsigned int loaded = 0;
+  while(mod_in >> q >> nti >> ntj >> prob >> count) {
+    const char* pi = strchr(nts, nti);
+    const char* pj = strchr(nts, ntj);
+    int i = (pi == NULL) ? 4 : pi - nts;
+    int j = (pj == NULL) ? 4 : pj - nts;
+    if(q < 0 || q >= Read::max_qual || i > 3 || j > 3 || i == j) {
+      cerr << "Bad error model line in " << modelf << ": " << q << " " << nti << " " << ntj << endl;
+      exit(EXIT_FAILURE);
+    }
+    ntnt_prob[q][i][j] = prob;
+    loaded++;
+  }
+
+  if(!mod_in.eof() || loaded != Read::max_qual*12) {
+    cerr << "Incomplete error model in " << modelf << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// correction_index_less
+////////////////////////////////////////////////////////////////////////////////
+static bool correction_index_less(const correction & a, const correction & b) {
+  return a.index < b.index;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // output_read
 //
-// Output the given possibly corrected and/or trimmed
-// read according to the given options.
-////////////////////////////////////////////////////////////////////////////////
-static void output_read(ofstream & reads_out, ofstream & corlog_out, int pe_code, string header, string ntseq, string mid, string strqual, string corseq, stats & tstats) {
-  if(corseq.size() >= trim_t) {
-    // check for changes
-    bool corrected = false;
-    for(int i = 0; i < corseq.size(); i++) {
-      if(corseq[i] != ntseq[i]) {
-	// log it
-	if(corlog_out.good())
-	  corlog_out << (strqual[i]-Read::quality_scale) << "\t" << (i+1) << "\t" << corseq[i] << "\t" << ntseq[i] << endl;
-	// note it
-	corrected = true;
-	// set qual to crap
-	strqual[i] = (char)(Read::quality_scale+2);
+// Output the read 'rec' trimmed to 'corlen' nt with the
+// corrections 'cors' applied, according to the given
+// options.  Return true if the read survives correction
+// and trimming, and otherwise print it as is to
+// 'err_out', if enabled.  Records are formatted straight
+// into the output buffers, with corrected nts patched in.
+////////////////////////////////////////////////////////////////////////////////
+static bool output_read(output_buffer * reads_out, output_buffer * err_out, output_buffer * corlog_out, const fastq_record & rec, int corlen, vector<correction> & cors, stats & tstats) {
+  if(corlen >= trim_t) {
+    // find corrections that change the read, the last
+    // applying if an nt has several
+    vector<correction> changes;
+    for(int c = 0; c < cors.size(); c++) {
+      int i = cors[c].index;
+      if(i >= corlen)
+	continue;
+      bool overridden = false;
+      for(int c2 = c+1; c2 < cors.size(); c2++) {
+	if(cors[c2].index == i)
+	  overridden = true;
       }
+      if(!overridden && nts[cors[c].to] != rec.seq.s[i])
+	changes.push_back(cors[c]);
+    }
+    sort(changes.begin(), changes.end(), correction_index_less);
+    bool corrected = !changes.empty();
+
+    // log them
+    if(corlog_out != NULL) {
+      for(int c = 0; c < changes.size(); c++) {
+	int i = changes[c].index;
+	int q = rec.qual.s[i] - Read::quality_scale;
+	if(q < 0) {
+	  corlog_out->put('-');
+	  q = -q;
+	}
+	corlog_out->append_uint(q);
+	corlog_out->put('\t');
+	corlog_out->append_uint(i+1);
+	corlog_out->put('\t');
+	corlog_out->put(nts[changes[c].to]);
+	corlog_out->put('\t');
+	corlog_out->put(rec.seq.s[i]);
+	corlog_out->put('\n');
+      }
+      corlog_out->end_record();
     }
     if(corrected)
       tstats.corrected++;
 
-    // update header
+    // print header
+    reads_out->append(rec.header);
     if(!orig_headers) {
       if(corrected)
-	header += " correct";
-      unsigned int trimlen = ntseq.size()-corseq.size();
+	reads_out->append(" correct", 8);
+      unsigned int trimlen = rec.seq.len - corlen;
       if(trimlen > 0) {
-	stringstream trim_inter;
-	trim_inter << trimlen;
-	header += " trim=" + trim_inter.str();
+	reads_out->append(" trim=", 6);
+	reads_out->append_uint(trimlen);
 	tstats.trimmed++;
 	if(!corrected)
 	  tstats.trimmed_only++;
@@ -443,28 +732,308 @@ static void output_read(ofstream & reads_out, ofstream & corlog_out, int pe_code
 	  tstats.validated++;
       }
     }
-    // print
-    if(contrail_out)
-      reads_out << header << "\t" << corseq << endl;
-    else
-      reads_out << header << endl << corseq << endl << mid << endl << strqual.substr(0,corseq.size()) << endl;
-    if(TESTING)
-      cerr << header << "\t" << ntseq << "\t" << corseq << endl;
+    reads_out->put(contrail_out ? '\t' : '\n');
+
+    // print sequence
+    unsigned int seq_start = reads_out->size();
+    reads_out->append(rec.seq.s, corlen);
+    for(int c = 0; c < changes.size(); c++)
+      (*reads_out)[seq_start + changes[c].index] = nts[changes[c].to];
+    reads_out->put('\n');
+
+    // print quality values, set to crap at corrections
+    if(!contrail_out) {
+      reads_out->append(rec.mid);
+      reads_out->put('\n');
+      unsigned int qual_start = reads_out->size();
+      reads_out->append(rec.qual.s, corlen);
+      for(int c = 0; c < changes.size(); c++)
+	(*reads_out)[qual_start + changes[c].index] = (char)(Read::quality_scale+2);
+      reads_out->put('\n');
+    }
+    reads_out->end_record();
+    return true;
+
   } else {
     tstats.removed++;
-    if(uncorrected_out || pe_code > 0) {
-      // update header
-      header += " error";
-
+    if(err_out != NULL) {
       //print
-      if(contrail_out)
-	reads_out << header << "\t" << ntseq << endl;
-      else
-	reads_out << header << endl << ntseq << endl << mid << endl << strqual << endl;	  
+      err_out->append(rec.header);
+      err_out->put(contrail_out ? '\t' : '\n');
+      err_out->append(rec.seq);
+      err_out->put('\n');
+      if(!contrail_out) {
+	err_out->append(rec.mid);
+	err_out->put('\n');
+	err_out->append(rec.qual);
+	err_out->put('\n');
+      }
+      err_out->end_record();
+    }
+    return false;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// find_untrusted
+//
+// Convert the read 'seq' to 'iseq' and find its untrusted
+// kmers, rolling the kmer along the read rather than
+// rebuilding it at each position.  Kmers with nts other
+// than ACGT are untrusted.
+////////////////////////////////////////////////////////////////////////////////
+static void find_untrusted(bithash * trusted, const str_view & seq, vector<unsigned int> & iseq, vector<int> & untrusted) {
+  if(iseq.size() < seq.len)
+    iseq.resize(seq.len);
+  nts_to_codes(seq.s, seq.len, &iseq[0]);
+
+  untrusted.clear();
+  kmer_roller roller(k);
+  for(int i = 0; i < (int)seq.len; i++) {
+    roller.add(iseq[i]);
+    int start = i-k+1;
+    if(start >= 0 && (!roller.valid() || !trusted->check(roller.forward())))
+      untrusted.push_back(start);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// screen_read
+//
+// Find the untrusted kmers of the read 'rec' and trim it,
+// returning its trimmed length.  Reads with no untrusted
+// kmers left after trimming take the fast path and are
+// output as slices of the input, with 'cost' 0.  The
+// others need correction, and 'cost' estimates its
+// effort from the number of untrusted kmers and, since
+// Read::correct_cc searches combinations of them, the
+// low quality nts they cover.  'iseq' and 'untrusted' are
+// scratch space.
+////////////////////////////////////////////////////////////////////////////////
+static int screen_read(bithash * trusted, const fastq_record & rec, vector<unsigned int> & iseq, vector<int> & untrusted, stats & tstats, unsigned long long & cost) {
+  tstats.reads++;
+  tstats.bases += rec.seq.len;
+  cost = 0;
+
+  if(rec.seq.len < trim_t)
+    return 0;
+
+  find_untrusted(trusted, rec.seq, iseq, untrusted);
+  int trim_length = quick_trim(rec.qual.s, rec.qual.len, untrusted);
+
+  if(untrusted.empty()) {
+    // fast path: output read as trimmed
+    tstats.fast_path++;
+    return trim_length;
+  }
+
+  // estimate cost
+  int low_qual = 0;
+  for(int i = untrusted.front(); i < untrusted.back()+k && i < trim_length; i++) {
+    if(rec.qual.s[i] - Read::quality_scale < heavy_low_qual)
+      low_qual++;
+  }
+  if(low_qual > heavy_max_low_qual)
+    // Read gives up quickly
+    cost = untrusted.size();
+  else
+    cost = (unsigned long long)untrusted.size() << low_qual;
+  return trim_length;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// correct_heavy_read
+//
+// Correct the read 'rec', which screen_read found needs
+// correction, returning the length of the corrected read
+// and setting 'cors' to its corrections.  If 'memo' is
+// given, reuse the corrections of an earlier read with
+// the same sequence and quality values under error model
+// number 'model', or save this read's.  'context_memo'
+// is passed on to Read::correct.
+////////////////////////////////////////////////////////////////////////////////
+static int correct_heavy_read(bithash * trusted, const fastq_record & rec, double ntnt_prob[Read::max_qual][4][4], double prior_prob[4], vector<unsigned int> & iseq, vector<int> & untrusted, vector<correction> & cors, memo_table * memo, memo_table * context_memo, unsigned int model, stats & tstats) {
+  unsigned long long memo_key = 0, memo_value;
+  if(memo != NULL) {
+    memo_key = read_memo_key(rec, model);
+    tstats.memo_lookups++;
+    if(memo->lookup(memo_key, memo_value)) {
+      tstats.memo_hits++;
+      int corlen;
+      unpack_correction_result(memo_value, corlen, cors);
+      return corlen;
+    }
+  }
+
+  find_untrusted(trusted, rec.seq, iseq, untrusted);
+  int trim_length = quick_trim(rec.qual.s, rec.qual.len, untrusted);
+
+  Read *r = new Read(rec.header.str(), &iseq[0], rec.qual.str(), untrusted, trim_length);
+  r->metrics = &tstats;
+  int corlen = r->correct(trusted, ntnt_prob, prior_prob, cors, false, context_memo);
+  tstats.context_lookups += r->context_lookups;
+  tstats.context_hits += r->context_hits;
+  tstats.context_verified += r->context_verified;
+  delete r;
+
+  // Read prints uncorrected nts other than ACGT as N
+  for(int i = 0; i < corlen; i++) {
+    if(iseq[i] == 4 && rec.seq.s[i] != 'N') {
+      bool corrected = false;
+      for(int c = 0; c < cors.size(); c++) {
+	if(cors[c].index == i)
+	  corrected = true;
+      }
+      if(!corrected)
+	cors.push_back(correction(i, 4));
     }
-    if(TESTING)
-      cerr << header << "\t" << ntseq << "\t-" << endl; // or . if it's only trimmed?
   }
+
+  if(memo != NULL && pack_correction_result(corlen, cors, memo_value))
+    memo->insert(memo_key, memo_value);
+  return corlen;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// timed_barrier
+//
+// Wait for the other threads, adding the time spent
+// waiting to 'idle'.
+////////////////////////////////////////////////////////////////////////////////
+static void timed_barrier(double & idle) {
+  double start = omp_get_wtime();
+#pragma omp barrier
+  double end = omp_get_wtime();
+  idle += end - start;
+  if(tracer != NULL)
+    tracer->add("sync", "barrier", start, end);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// gather_heavy_reads
+//
+// Move the threads' heavy reads from a round's screening
+// into 'heavy', heaviest first.  Return false if no
+// thread screened a task, so all work is done.
+////////////////////////////////////////////////////////////////////////////////
+static bool gather_heavy_reads(vector< vector<heavy_read> > & thread_heavy, vector<unsigned int> & thread_tasks, vector<heavy_read> & heavy) {
+  bool screened = false;
+  heavy.clear();
+  for(unsigned int t = 0; t < thread_heavy.size(); t++) {
+    heavy.insert(heavy.end(), thread_heavy[t].begin(), thread_heavy[t].end());
+    thread_heavy[t].clear();
+    if(thread_tasks[t] > 0)
+      screened = true;
+  }
+  sort(heavy.begin(), heavy.end(), heavier);
+  return screened;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// correct_heavy_reads
+//
+// Correct the round's 'heavy' reads, heaviest first,
+// adding the time taken to their batches.  'ntnt_prob2'
+// and 'tstats[1]' are used for the odd reads of paired
+// end batches.
+////////////////////////////////////////////////////////////////////////////////
+static void correct_heavy_reads(bithash * trusted, vector<heavy_read> & heavy, double ntnt_prob1[Read::max_qual][4][4], double ntnt_prob2[Read::max_qual][4][4], double prior_prob[4], vector<unsigned int> & iseq, vector<int> & untrusted, memo_table * memo, memo_table * context_memo, stats * tstats[2]) {
+  trace_span span("round", "correct heavy reads");
+  fastq_record rec;
+#pragma omp for schedule(dynamic,1) nowait
+  for(int h = 0; h < (int)heavy.size(); h++) {
+    double start = omp_get_wtime();
+    read_batch * batch = heavy[h].batch;
+    unsigned int r = heavy[h].read;
+    batch->reads.get(r, rec);
+    unsigned int m = (r % 2 == 1 && ntnt_prob2 != ntnt_prob1) ? 1 : 0;
+    batch->corlens[r] = correct_heavy_read(trusted, rec, (m == 0) ? ntnt_prob1 : ntnt_prob2, prior_prob, iseq, untrusted, batch->cors[r], memo, context_memo, m, *tstats[r % 2]);
+    double seconds = omp_get_wtime() - start;
+    tstats[r % 2]->correct_seconds += seconds;
+#pragma omp atomic
+    batch->seconds += seconds;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// output_idle
+//
+// Print the time each thread spent waiting for others.
+////////////////////////////////////////////////////////////////////////////////
+static void output_idle(string fqf, vector<double> & idle) {
+  cerr << "Thread idle seconds for " << fqf << ":";
+  for(unsigned int t = 0; t < idle.size(); t++)
+    cerr << " " << fixed << setprecision(2) << idle[t];
+  cerr << endl;
+  cerr.unsetf(ios::floatfield);
+  cerr.precision(6);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// output_stats
+//
+// Combine the threads' stats and print them to
+// <fastq-prefix>.stats.txt.
+////////////////////////////////////////////////////////////////////////////////
+static void output_stats(string fqf, stats * thread_stats, int num_stats) {
+  stats total;
+  for(int i = 0; i < num_stats; i++)
+    total.merge(thread_stats[i]);
+
+  string fqf_name = strip_gz(fqf);
+  int suffix_index = fqf_name.rfind(".");
+  string outf;
+  if(suffix_index == -1) {
+    outf = fqf_name+".stats.txt";
+  } else {
+    outf = fqf_name.substr(0,suffix_index+1) + "stats.txt";
+  }
+  ofstream stats_out(outf.c_str());
+  stats_out << "Validated: " << total.validated << endl;
+  stats_out << "Corrected: " << total.corrected << endl;
+  stats_out << "Trimmed: " << total.trimmed << endl;
+  stats_out << "Trimmed only: " << total.trimmed_only << endl;
+  stats_out << "Removed: " << total.removed << endl;
+  unsigned long long reads = total.reads;
+  stats_out << "Fast path: " << total.fast_path << " (" << fixed << setprecision(1) << (reads > 0 ? 100.0*total.fast_path/reads : 0.0) << "%)" << endl;
+  if(dup_cache_mb > 0) {
+    unsigned long long lookups = total.memo_lookups;
+    stats_out << "Duplicate cache hits: " << total.memo_hits << " of " << lookups << " (" << (lookups > 0 ? 100.0*total.memo_hits/lookups : 0.0) << "%)" << endl;
+  }
+  if(context_cache_mb > 0) {
+    unsigned long long lookups = total.context_lookups;
+    unsigned long long hits = total.context_hits;
+    stats_out << "Context cache hits: " << hits << " of " << lookups << " (" << (lookups > 0 ? 100.0*hits/lookups : 0.0) << "%)" << endl;
+    stats_out << "Context cache verified: " << total.context_verified << " of " << hits << " (" << (hits > 0 ? 100.0*total.context_verified/hits : 0.0) << "%)" << endl;
+  }
+  stats_out.close();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// screen_into_batch
+//
+// Screen the read 'rec' and add it to 'batch', noting it
+// in 'theavy' if it needs correction.
+////////////////////////////////////////////////////////////////////////////////
+static void screen_into_batch(bithash * trusted, const fastq_record & rec, read_batch * batch, vector<unsigned int> & iseq, vector<int> & untrusted, stats & tstats, vector<heavy_read> & theavy) {
+  heavy_read h;
+  batch->corlens.push_back(screen_read(trusted, rec, iseq, untrusted, tstats, h.cost));
+  if(h.cost > 0) {
+    h.batch = batch;
+    h.read = batch->reads.size();
+    theavy.push_back(h);
+  }
+  batch->reads.add(rec);
+  batch->cors.push_back(vector<correction>());
 }
 
 
@@ -473,16 +1042,23 @@ static void output_read(ofstream & reads_out, ofstream & corlog_out, int pe_code
 //
 // Correct the reads in the file 'fqf' using the data structure of trusted
 // kmers 'trusted', matrix of nt->nt error rates 'ntnt_prob' and prior nt
-// probabilities 'prior_prob'.  'starts' and 'counts' help openMP parallelize
-// the read processing.  If 'pairedend_code' is 0, the reads are not paired;
-// if it's 1, this file is the first of a pair so print all reads and withold
-// combining; if it's 2, the file is the second of a pair so print all reads
-// and then combine both 1 and 2.
+// probabilities 'prior_prob'.  Tasks of read 'index' entries are handed out
+// to threads by 'scheduler'.  The reads are not paired; see correct_pairs.
+//
+// Since correcting a read can take anywhere from no time to a long search,
+// tasks are processed in rounds of a few per thread in three phases.  The
+// tasks' reads are loaded and screened, passing reads through the fast path
+// and estimating the cost of the rest.  Then the reads needing correction
+// are corrected by all threads, heaviest first, so no thread is left with a
+// slow read at the end.  Then each thread outputs its tasks to chunk files
+// named by their first index entry, which combine_output concatenates in
+// order.
 ////////////////////////////////////////////////////////////////////////////////
-static void correct_reads(string fqf, int pe_code, bithash * trusted, vector<streampos> & starts, vector<unsigned long long> & counts, double ntnt_prob[Read::max_qual][4][4], double prior_prob[4]) {
+static void correct_reads(string fqf, bithash * trusted, fastq_index & index, task_scheduler & scheduler, double ntnt_prob[Read::max_qual][4][4], double prior_prob[4]) {
+  trace_span span("stage", "correct reads");
   // output directory
   struct stat st_file_info;
-  string path_suffix = split(fqf,'/').back();
+  string path_suffix = split(strip_gz(fqf),'/').back();
   string out_dir("."+path_suffix);
   if(stat(out_dir.c_str(), &st_file_info) == 0) {
     cerr << "Hidden temporary directory " << out_dir << " already exists and will be used" << endl;
@@ -494,137 +1070,475 @@ static void correct_reads(string fqf, int pe_code, bithash * trusted, vector<str
   }
 
   // collect stats
-  stats * thread_stats = new stats[omp_get_max_threads()];
-
-  unsigned int chunk = 0;
-#pragma omp parallel //shared(trusted)
+  int num_threads = scheduler.num_threads();
+  stats * thread_stats = new stats[num_threads];
+  vector<double> idle(num_threads, 0);
+  if(metrics != NULL)
+    metrics->watch(fqf, thread_stats, num_threads);
+
+  vector< vector<heavy_read> > thread_heavy(num_threads);
+  vector<unsigned int> thread_tasks(num_threads, 0);
+  vector<heavy_read> heavy;
+  bool more_work = true;
+
+  // corrections of duplicate reads
+  memo_table * memo = NULL;
+  if(dup_cache_mb > 0)
+    memo = new memo_table((unsigned long long)dup_cache_mb << 20);
+  memo_table * context_memo = NULL;
+  if(context_cache_mb > 0)
+    context_memo = new memo_table((unsigned long long)context_cache_mb << 20);
+
+  scheduler.start(index.entries(), index.entry_bytes);
+#pragma omp parallel num_threads(num_threads) //shared(trusted)
   {
     int tid = omp_get_thread_num();
-    
-    // input
-    ifstream reads_in(fqf.c_str());
-    
-    unsigned int tchunk;
-    string header,ntseq,mid,strqual,corseq;
-    int trim_length;
-    char* nti;
-    Read *r;
 
-    #pragma omp critical
-    tchunk = chunk++;
+    // input
+    istream * reads_in = open_fastq(fqf);
+    fastq_reader reads(reads_in);
+    fastq_record rec;
+    stats * tstats[2] = {&thread_stats[tid], &thread_stats[tid]};
+
+    vector<unsigned int> iseq;
+    vector<int> untrusted;
+    vector<read_batch*> tbatches;
+
+    while(true) {
+      // screen
+      task t;
+      while(tbatches.size() < round_tasks_per_thread && scheduler.next(tid, t)) {
+	trace_span span("task", "screen", t.begin);
+	double start = omp_get_wtime();
+	read_batch * batch = new read_batch;
+	batch->t = t;
+	batch->seconds = 0;
+	double input_start = reads.fill_seconds();
+	reads.seek(index.start(t.begin));
+	unsigned long long count = index.count(t.begin, t.end);
+	for(unsigned long long tcount = 0; tcount < count && reads.next(rec); tcount++)
+	  screen_into_batch(trusted, rec, batch, iseq, untrusted, thread_stats[tid], thread_heavy[tid]);
+	double seconds = omp_get_wtime() - start;
+	double input_seconds = reads.fill_seconds() - input_start;
+	batch->seconds += seconds;
+	tstats[0]->input_seconds += input_seconds;
+	tstats[0]->screen_seconds += seconds - input_seconds;
+	tbatches.push_back(batch);
+      }
+      thread_tasks[tid] = tbatches.size();
+      timed_barrier(idle[tid]);
+#pragma omp master
+      {
+	more_work = gather_heavy_reads(thread_heavy, thread_tasks, heavy);
+	if(metrics != NULL)
+	  metrics->poll();
+      }
+      timed_barrier(idle[tid]);
+      if(!more_work)
+	break;
 
-    while(tchunk < starts.size()) {
-      reads_in.seekg(starts[tchunk]);
+      // correct, heaviest first
+      correct_heavy_reads(trusted, heavy, ntnt_prob, ntnt_prob, prior_prob, iseq, untrusted, memo, context_memo, tstats);
+      timed_barrier(idle[tid]);
 
       // output
-      string toutf(out_dir+"/");
-      stringstream tconvert;
-      tconvert << tchunk;
-      toutf += tconvert.str();
-
-      if(overwrite_temp || stat(toutf.c_str(), &st_file_info) == -1) {
-	ofstream reads_out(toutf.c_str());
-	//cout << toutf << endl;
-
-	// output log
-	string tlogf = toutf + ".log";
-	ofstream corlog_out;
-	if(out_log) {
-	  corlog_out.open(tlogf.c_str());
-	}
+      for(unsigned int b = 0; b < tbatches.size(); b++) {
+	trace_span span("task", "output", tbatches[b]->t.begin);
+	double start = omp_get_wtime();
+	read_batch * batch = tbatches[b];
+	string toutf(out_dir+"/");
+	stringstream tconvert;
+	tconvert << batch->t.begin;
+	toutf += tconvert.str();
+
+	if(overwrite_temp || stat(toutf.c_str(), &st_file_info) == -1) {
+	  // error reads to a separate chunk
+	  ostream * reads_out = open_output(toutf);
+	  output_buffer * reads_buf = new output_buffer(reads_out);
+	  ostream * err_out = NULL;
+	  output_buffer * err_buf = NULL;
+	  if(uncorrected_out) {
+	    err_out = open_output(toutf + ".err");
+	    err_buf = new output_buffer(err_out);
+	  }
 
-	unsigned long long tcount = 0;
-	while(getline(reads_in, header)) {
-	  //cout << tid << " " << header << endl;
-	
-	  // get sequence
-	  getline(reads_in, ntseq);
-	  //cout << ntseq << endl;
-	
-	  // convert ntseq to iseq
-	  vector<unsigned int> iseq;
-	  for(int i = 0; i < ntseq.size(); i++) {
-	    nti = strchr(nts, ntseq[i]);	
-	    iseq.push_back(nti - nts);
+	  // output log
+	  string tlogf = toutf + ".log";
+	  ofstream corlog_out;
+	  output_buffer * corlog_buf = NULL;
+	  if(out_log) {
+	    corlog_out.open(tlogf.c_str());
+	    corlog_buf = new output_buffer(&corlog_out);
 	  }
 
-	  // get quality values
-	  getline(reads_in,mid);
-	  //cout << mid << endl;
-	  getline(reads_in,strqual);
-	  //cout << strqual << endl;
+	  // output reads w/ trim and corrections
+	  for(unsigned int r = 0; r < batch->reads.size(); r++) {
+	    batch->reads.get(r, rec);
+	    output_read(reads_buf, err_buf, corlog_buf, rec, batch->corlens[r], batch->cors[r], thread_stats[tid]);
+	  }
 
-	  vector<int> untrusted;
+	  delete reads_buf;
+	  delete reads_out;
+	  if(uncorrected_out) {
+	    delete err_buf;
+	    delete err_out;
+	  }
+	  if(out_log)
+	    delete corlog_buf;
+	}
 
-	  if(iseq.size() < trim_t)
-	    trim_length = 0;
-	  else {
-	    for(int i = 0; i < iseq.size()-k+1; i++) {
-	      if(!trusted->check(&iseq[i])) {
-		untrusted.push_back(i);
-	      }
+	double seconds = omp_get_wtime() - start;
+	batch->seconds += seconds;
+	tstats[0]->output_seconds += seconds;
+	scheduler.done(tid, batch->t, batch->seconds);
+	delete batch;
+      }
+      tbatches.clear();
+    }
+    delete reads_in;
+  }
+
+  // print stats
+  if(metrics != NULL)
+    metrics->retire();
+  output_stats(fqf, thread_stats, num_threads);
+  output_idle(fqf, idle);
+  delete[] thread_stats;
+  if(memo != NULL)
+    delete memo;
+  if(context_memo != NULL)
+    delete context_memo;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// open_pair_outputs
+//
+// Open the output files for paired end reads in 'fqf1' and 'fqf2', indexed
+// by pair_out_kind and mate.  Interleaved reads, with an empty 'fqf2', are
+// output to the same files for both mates.  Disabled outputs are NULL.
+////////////////////////////////////////////////////////////////////////////////
+static void open_pair_outputs(string fqf1, string fqf2, ostream * outs[pair_out_kinds][2]) {
+  string fqfs[2] = {fqf1, fqf2};
+  for(int m = 0; m < 2; m++) {
+    if(fqfs[m].empty()) {
+      for(int o = 0; o < pair_out_kinds; o++)
+	outs[o][m] = outs[o][0];
+      continue;
+    }
+
+    string prefix, suffix;
+    int suffix_index = fqfs[m].rfind(".");
+    if(suffix_index == -1) {
+      prefix = fqfs[m]+".";
+      suffix = "";
+    } else {
+      prefix = fqfs[m].substr(0,suffix_index+1);
+      suffix = fqfs[m].substr(suffix_index, fqfs[m].size()-suffix_index);
+    }
+
+    outs[pair_out][m] = open_output(prefix + "cor" + suffix);
+    outs[single_out][m] = open_output(prefix + "cor_single" + suffix);
+    if(uncorrected_out) {
+      outs[single_err_out][m] = open_output(prefix + "err_single" + suffix);
+      outs[err_out][m] = open_output(prefix + "err" + suffix);
+    } else {
+      outs[single_err_out][m] = NULL;
+      outs[err_out][m] = NULL;
+    }
+    if(out_log)
+      outs[log_out][m] = new ofstream((fqfs[m] + ".log").c_str());
+    else
+      outs[log_out][m] = NULL;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// new_pair_buffers
+//
+// Make in memory buffers for a chunk's paired end output, mirroring which
+// of 'outs' are disabled or shared by both mates.
+////////////////////////////////////////////////////////////////////////////////
+static pair_buffers * new_pair_buffers(ostream * outs[pair_out_kinds][2]) {
+  pair_buffers * bufs = new pair_buffers;
+  for(int o = 0; o < pair_out_kinds; o++) {
+    for(int m = 0; m < 2; m++) {
+      if(outs[o][m] == NULL)
+	bufs->out[o][m] = NULL;
+      else if(m == 1 && outs[o][1] == outs[o][0])
+	bufs->out[o][m] = bufs->out[o][0];
+      else
+	bufs->out[o][m] = new output_buffer;
+    }
+  }
+  return bufs;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// commit_pair_buffers
+//
+// Write a chunk's buffered paired end output to 'outs' and free it.
+////////////////////////////////////////////////////////////////////////////////
+static void commit_pair_buffers(pair_buffers * bufs, ostream * outs[pair_out_kinds][2]) {
+  for(int o = 0; o < pair_out_kinds; o++) {
+    for(int m = 0; m < 2; m++) {
+      if(bufs->out[o][m] != NULL && (m == 0 || bufs->out[o][1] != bufs->out[o][0])) {
+	outs[o][m]->write(bufs->out[o][m]->data(), bufs->out[o][m]->size());
+	delete bufs->out[o][m];
+      }
+    }
+  }
+  delete bufs;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// correct_pairs
+//
+// Correct paired end reads from the files 'fqf1' and 'fqf2', or interleaved
+// in 'fqf1' if 'fqf2' is empty, as in correct_reads with each mate's error
+// model in 'ntnt_prob1' and 'ntnt_prob2', which are the same array if the
+// mates share one.  Both mates of a pair are corrected by the same thread,
+// which routes them to the pair, single or error outputs in memory.  Each
+// task's output is buffered and written to the final files
+// as soon as all tasks before it have been, so no temporary files are used.
+// The scheduler hands out tasks in order, so with each round's tasks ahead
+// of the next's, at most a round's output waits in memory.
+// The read indexes 'index1' and 'index2' must be aligned by
+// align_pair_indexes.
+////////////////////////////////////////////////////////////////////////////////
+static void correct_pairs(string fqf1, string fqf2, bithash * trusted, fastq_index & index1, fastq_index & index2, task_scheduler & scheduler, double ntnt_prob1[Read::max_qual][4][4], double ntnt_prob2[Read::max_qual][4][4], double prior_prob[4]) {
+  trace_span span("stage", "correct pairs");
+  bool interleaved_pairs = fqf2.empty();
+
+  // outputs
+  ostream * outs[pair_out_kinds][2];
+  open_pair_outputs(strip_gz(fqf1), interleaved_pairs ? fqf2 : strip_gz(fqf2), outs);
+  unsigned int units = index1.entries();
+  vector<pair_buffers*> task_bufs(units, (pair_buffers*)NULL);
+  vector<unsigned int> task_ends(units, 0);
+  unsigned int next_commit = 0;
+
+  // collect stats, by thread and mate
+  int num_threads = scheduler.num_threads();
+  stats * thread_stats = new stats[2*num_threads];
+  vector<double> idle(num_threads, 0);
+  if(metrics != NULL)
+    metrics->watch(fqf1, thread_stats, 2*num_threads);
+
+  vector< vector<heavy_read> > thread_heavy(num_threads);
+  vector<unsigned int> thread_tasks(num_threads, 0);
+  vector<heavy_read> heavy;
+  bool more_work = true;
+
+  // corrections of duplicate reads
+  memo_table * memo = NULL;
+  if(dup_cache_mb > 0)
+    memo = new memo_table((unsigned long long)dup_cache_mb << 20);
+  memo_table * context_memo = NULL;
+  if(context_cache_mb > 0)
+    context_memo = new memo_table((unsigned long long)context_cache_mb << 20);
+
+  scheduler.start(units, index1.entry_bytes, true);
+#pragma omp parallel num_threads(num_threads) //shared(trusted)
+  {
+    int tid = omp_get_thread_num();
+
+    // input
+    istream * reads_in[2];
+    fastq_reader * reads[2];
+    reads_in[0] = open_fastq(fqf1);
+    reads[0] = new fastq_reader(reads_in[0]);
+    if(interleaved_pairs) {
+      reads_in[1] = reads_in[0];
+      reads[1] = reads[0];
+    } else {
+      reads_in[1] = open_fastq(fqf2);
+      reads[1] = new fastq_reader(reads_in[1]);
+    }
+    fastq_record rec;
+    stats * tstats[2];
+    tstats[0] = &thread_stats[2*tid];
+    tstats[1] = interleaved_pairs ? tstats[0] : &thread_stats[2*tid+1];
+
+    vector<unsigned int> iseq;
+    vector<int> untrusted;
+    output_buffer read_out[2];
+    bool read_ok[2];
+    vector<read_batch*> tbatches;
+
+    while(true) {
+      // screen, with mate m of pair p as read 2p+m
+      task t;
+      while(tbatches.size() < round_tasks_per_thread && scheduler.next(tid, t)) {
+	trace_span span("task", "screen", t.begin);
+	double start = omp_get_wtime();
+	read_batch * batch = new read_batch;
+	batch->t = t;
+	batch->seconds = 0;
+	double input_start = reads[0]->fill_seconds() + (interleaved_pairs ? 0 : reads[1]->fill_seconds());
+	reads[0]->seek(index1.start(t.begin));
+	if(!interleaved_pairs)
+	  reads[1]->seek(index2.start(t.begin));
+	unsigned long long pairs = index1.count(t.begin, t.end);
+	if(interleaved_pairs)
+	  pairs /= 2;
+
+	for(unsigned long long p = 0; p < pairs; p++) {
+	  for(int m = 0; m < 2; m++) {
+	    if(!reads[m]->next(rec)) {
+	      cerr << "Uneven number of reads in paired end read files " << fqf1 << " and " << fqf2 << endl;
+	      exit(EXIT_FAILURE);
 	    }
+	    screen_into_batch(trusted, rec, batch, iseq, untrusted, *tstats[m], thread_heavy[tid]);
+	  }
+	}
+	double seconds = omp_get_wtime() - start;
+	double input_seconds = reads[0]->fill_seconds() + (interleaved_pairs ? 0 : reads[1]->fill_seconds()) - input_start;
+	batch->seconds += seconds;
+	tstats[0]->input_seconds += input_seconds;
+	tstats[0]->screen_seconds += seconds - input_seconds;
+	tbatches.push_back(batch);
+      }
+      thread_tasks[tid] = tbatches.size();
+      timed_barrier(idle[tid]);
+#pragma omp master
+      {
+	more_work = gather_heavy_reads(thread_heavy, thread_tasks, heavy);
+	if(metrics != NULL)
+	  metrics->poll();
+      }
+      timed_barrier(idle[tid]);
+      if(!more_work)
+	break;
 
-	    trim_length = quick_trim(strqual, untrusted);
-	    //trim_length = iseq.size();
+      // correct, heaviest first
+      correct_heavy_reads(trusted, heavy, ntnt_prob1, ntnt_prob2, prior_prob, iseq, untrusted, memo, context_memo, tstats);
+      timed_barrier(idle[tid]);
+
+      // output
+      for(unsigned int b = 0; b < tbatches.size(); b++) {
+	trace_span span("task", "output", tbatches[b]->t.begin);
+	double start = omp_get_wtime();
+	read_batch * batch = tbatches[b];
+	pair_buffers * bufs = new_pair_buffers(outs);
+
+	for(unsigned int r = 0; r < batch->reads.size(); r += 2) {
+	  for(int m = 0; m < 2; m++) {
+	    batch->reads.get(r+m, rec);
+	    read_out[m].clear();
+	    read_ok[m] = output_read(&read_out[m], &read_out[m], bufs->out[log_out][m], rec, batch->corlens[r+m], batch->cors[r+m], *tstats[m]);
 	  }
 
-	  // fix error reads
-	  if(untrusted.size() > 0) {
-	    r = new Read(header, &iseq[0], strqual, untrusted, trim_length);
-	    corseq = r->correct(trusted, ntnt_prob, prior_prob);
+	  // route pair
+	  if(read_ok[0] && read_ok[1]) {
+	    // no errors
+	    bufs->out[pair_out][0]->append(read_out[0]);
+	    bufs->out[pair_out][1]->append(read_out[1]);
+	  } else if(read_ok[0]) {
+	    // error in 2
+	    bufs->out[single_out][0]->append(read_out[0]);
+	    if(bufs->out[single_err_out][1] != NULL)
+	      bufs->out[single_err_out][1]->append(read_out[1]);
+	  } else if(read_ok[1]) {
+	    // error in 1
+	    if(bufs->out[single_err_out][0] != NULL)
+	      bufs->out[single_err_out][0]->append(read_out[0]);
+	    bufs->out[single_out][1]->append(read_out[1]);
+	  } else if(bufs->out[err_out][0] != NULL) {
+	    // error in 1,2
+	    bufs->out[err_out][0]->append(read_out[0]);
+	    bufs->out[err_out][1]->append(read_out[1]);
+	  }
+	}
 
-	    // output read w/ trim and corrections
-	    output_read(reads_out, corlog_out, pe_code, header, ntseq, mid, strqual, corseq, thread_stats[tid]);
-	  
-	    delete r;
-	  } else {
-	    output_read(reads_out, corlog_out, pe_code, header, ntseq, mid, strqual, ntseq.substr(0,trim_length), thread_stats[tid]);
-	    // output read as trimmed
-	    /*
-	      if(contrail_out)
-	      reads_out << header << "\t" << ntseq.substr(0,trim_length) << endl;
-	      else
-	      reads_out << header << endl << ntseq.substr(0,trim_length) << endl << mid << endl << strqual.substr(0,trim_length) << endl;
-	    */
+	// commit tasks in order
+#pragma omp critical(pair_commit)
+	{
+	  task_bufs[batch->t.begin] = bufs;
+	  task_ends[batch->t.begin] = batch->t.end;
+	  while(next_commit < units && task_bufs[next_commit] != NULL) {
+	    commit_pair_buffers(task_bufs[next_commit], outs);
+	    task_bufs[next_commit] = NULL;
+	    next_commit = task_ends[next_commit];
 	  }
-	
-	  if(++tcount == counts[tchunk])
-	    break;
 	}
-	reads_out.close();
-      }
 
-#pragma omp critical
-      tchunk = chunk++;
+	double seconds = omp_get_wtime() - start;
+	batch->seconds += seconds;
+	tstats[0]->output_seconds += seconds;
+	scheduler.done(tid, batch->t, batch->seconds);
+	delete batch;
+      }
+      tbatches.clear();
+    }
+    delete reads[0];
+    delete reads_in[0];
+    if(!interleaved_pairs) {
+      delete reads[1];
+      delete reads_in[1];
     }
-    reads_in.close();
   }
 
-  // combine stats
-  for(int i = 1; i < omp_get_max_threads(); i++) {
-    thread_stats[0].validated += thread_stats[i].validated;
-    thread_stats[0].corrected += thread_stats[i].corrected;
-    thread_stats[0].trimmed += thread_stats[i].trimmed;
-    thread_stats[0].trimmed_only += thread_stats[i].trimmed_only;
-    thread_stats[0].removed += thread_stats[i].removed;
+  // close outputs
+  for(int o = 0; o < pair_out_kinds; o++) {
+    for(int m = 0; m < 2; m++) {
+      if(outs[o][m] != NULL && (m == 0 || outs[o][1] != outs[o][0]))
+	delete outs[o][m];
+    }
   }
 
   // print stats
-  int suffix_index = fqf.rfind(".");
-  string outf;
-  if(suffix_index == -1) {
-    outf = fqf+".stats.txt";
+  if(metrics != NULL)
+    metrics->retire();
+  output_idle(fqf1, idle);
+  if(interleaved_pairs) {
+    for(int t = 0; t < num_threads; t++)
+      thread_stats[t] = thread_stats[2*t];
+    output_stats(fqf1, thread_stats, num_threads);
   } else {
-    outf = fqf.substr(0,suffix_index+1) + "stats.txt";
+    stats * mate_stats = new stats[num_threads];
+    for(int m = 0; m < 2; m++) {
+      for(int t = 0; t < num_threads; t++)
+	mate_stats[t] = thread_stats[2*t+m];
+      output_stats(m == 0 ? fqf1 : fqf2, mate_stats, num_threads);
+    }
+    delete[] mate_stats;
   }
-  ofstream stats_out(outf.c_str());
-  stats_out << "Validated: " << thread_stats[0].validated << endl;
-  stats_out << "Corrected: " << thread_stats[0].corrected << endl;
-  stats_out << "Trimmed: " << thread_stats[0].trimmed << endl;
-  stats_out << "Trimmed only: " << thread_stats[0].trimmed_only << endl;
-  stats_out << "Removed: " << thread_stats[0].removed << endl;
-  stats_out.close();
+  delete[] thread_stats;
+  if(memo != NULL)
+    delete memo;
+  if(context_memo != NULL)
+    delete context_memo;
+}
+
+
+////////////////////////////////////////////////////////////
+// probs_converged
+//
+// Return true if no nt->nt probability estimate differs
+// between the two models by more than learn_tolerance.
+// Estimates for (quality, actual nt) pairs with fewer than
+// learn_min_row_samples samples are mostly extrapolated
+// by the regression, so they are ignored.
+////////////////////////////////////////////////////////////
+static bool probs_converged(double ntnt_prob[Read::max_qual][4][4], double last_prob[Read::max_qual][4][4], unsigned int ntnt_counts[Read::max_qual][4][4]) {
+  for(int q = 1; q < Read::max_qual; q++) {
+    for(int i = 0; i < 4; i++) {
+      unsigned int row_samples = 0;
+      for(int j = 0; j < 4; j++)
+	row_samples += ntnt_counts[q][i][j];
+      if(row_samples < learn_min_row_samples)
+	continue;
+
+      for(int j = 0; j < 4; j++)
+	if(i != j && !(fabs(ntnt_prob[q][i][j] - last_prob[q][i][j]) <= learn_tolerance))
+	  return false;
+    }
+  }
+  return true;
 }
 
 
@@ -633,99 +1547,136 @@ static void correct_reads(string fqf, int pe_code, bithash * trusted, vector<str
 //
 // Correct reads using a much stricter filter in order
 // to count the nt->nt errors and learn the errors
-// probabilities
+// probabilities.
+//
+// Index entries are visited every learn_chunk_stride'th
+// entry first so samples are spread across the file, in
+// tasks handed out by 'scheduler'.  Each thread counts
+// into its own table and merges it after every entry.
+// Learning stops once the regressed
+// probabilities change by less than learn_tolerance over
+// learn_check_samples new samples, or after
+// learn_max_samples samples.
 ////////////////////////////////////////////////////////////
 //static void learn_errors(string fqf, bithash * trusted, vector<streampos> & starts, vector<unsigned long long> & counts, double (&ntnt_prob)[4][4], double prior_prob[4]) {
-static void learn_errors(string fqf, bithash * trusted, vector<streampos> & starts, vector<unsigned long long> & counts, double ntnt_prob[Read::max_qual][4][4], double prior_prob[4]) {
+static void learn_errors(string fqf, bithash * trusted, fastq_index & index, task_scheduler & scheduler, double ntnt_prob[Read::max_qual][4][4], double prior_prob[4], bool save) {
   unsigned int ntnt_counts[Read::max_qual][4][4] = {0};
   unsigned int samples = 0;
 
-  unsigned int chunk = 0;
-#pragma omp parallel //shared(trusted)
+  // convergence
+  double last_prob[Read::max_qual][4][4];
+  double check_prob[Read::max_qual][4][4];
+  unsigned int checked_samples = 0;
+  bool done = false;
+
+  // order entries by stride
+  vector<unsigned int> entry_order;
+  for(unsigned int o = 0; o < learn_chunk_stride; o++)
+    for(unsigned int e = o; e < index.entries(); e += learn_chunk_stride)
+      entry_order.push_back(e);
+
+  scheduler.start(entry_order.size(), index.entry_bytes);
+#pragma omp parallel num_threads(scheduler.num_threads()) //shared(trusted)
   {    
-    unsigned int tchunk;
-    string header,ntseq,strqual,corseq;
+    int tid = omp_get_thread_num();
+    task t;
+    bool tdone;
+    vector<unsigned int> iseq;
+    vector<correction> cors;
     int trim_length;
-    char* nti;
     Read *r;    
-    ifstream reads_in(fqf.c_str());
+    istream * reads_in = open_fastq(fqf);
+    fastq_reader reads(reads_in);
+    fastq_record rec;
+    unsigned int tntnt_counts[Read::max_qual][4][4];
+    unsigned int tsamples;
     
-    while(chunk < threads*chunks_per_thread) {
-#pragma omp critical
-      tchunk = chunk++;     
-      
-      reads_in.seekg(starts[tchunk]);
-      
-      unsigned long long tcount = 0;
-      while(getline(reads_in, header)) {
-	//cout << header << endl;
-	
-	// get sequence
-	getline(reads_in, ntseq);
-	//cout << ntseq << endl;
-	
-	// convert ntseq to iseq
-	vector<unsigned int> iseq;
-	for(int i = 0; i < ntseq.size(); i++) {
-	  nti = strchr(nts, ntseq[i]);
-	  iseq.push_back(nti - nts);
-	}
-		
-	// get quality values
-	getline(reads_in,strqual);
-	//cout << strqual << endl;
-	getline(reads_in,strqual);
-	//cout << strqual << endl;
-
-	vector<int> untrusted;
-
-	if(iseq.size() < trim_t)
-	  trim_length = 0;
-	else {
-	  for(int i = 0; i < iseq.size()-k+1; i++) {
-	    if(!trusted->check(&iseq[i])) {
-	      untrusted.push_back(i);
-	    }
+    while(true) {
+#pragma omp critical(learn_chunk)
+      tdone = done;
+      if(tdone || !scheduler.next(tid, t))
+	break;
+
+      trace_span span("task", "learn", t.begin);
+      double start = omp_get_wtime();
+      for(unsigned int pos = t.begin; pos < t.end && !tdone; pos++) {
+	unsigned int e = entry_order[pos];
+	memset(tntnt_counts, 0, sizeof(tntnt_counts));
+	tsamples = 0;
+
+	reads.seek(index.start(e));
+	unsigned long long count = index.count(e, e+1);
+	unsigned long long tcount = 0;
+	while(tcount < count && reads.next(rec)) {
+	  vector<int> untrusted;
+
+	  if(rec.seq.len < trim_t)
+	    trim_length = 0;
+	  else {
+	    find_untrusted(trusted, rec.seq, iseq, untrusted);
+	    trim_length = quick_trim(rec.qual.s, rec.qual.len, untrusted);
 	  }
-	  
-	  trim_length = quick_trim(strqual, untrusted);
-	}
 
-	// fix error reads
-	if(untrusted.size() > 0) {
-	  // correct
-	  r = new Read(header, &iseq[0], strqual, untrusted, trim_length);
-	  corseq = r->correct(trusted, ntnt_prob, prior_prob, true);
+	  // fix error reads
+	  if(untrusted.size() > 0) {
+	    // correct
+	    r = new Read(rec.header.str(), &iseq[0], rec.qual.str(), untrusted, trim_length);
+	    int corlen = r->correct(trusted, ntnt_prob, prior_prob, cors, true);
 	    
-	  // if trimmed to long enough
-	  if(corseq.size() >= trim_t) {
-	    if(r->trusted_read != 0) { // else no guarantee there was a correction
-	      for(int c = 0; c < r->trusted_read->corrections.size(); c++) {
-		correction cor = r->trusted_read->corrections[c];
-		if(iseq[cor.index] < 4) {
-		  // P(obs=o|actual=a,a!=o) for Bayes
-		  ntnt_counts[strqual[cor.index]-Read::quality_scale][cor.to][iseq[cor.index]]++;
+	    // if trimmed to long enough
+	    if(corlen >= trim_t) {
+	      if(r->trusted_read != 0) { // else no guarantee there was a correction
+		for(int c = 0; c < r->trusted_read->corrections.size(); c++) {
+		  correction cor = r->trusted_read->corrections[c];
+		  if(iseq[cor.index] < 4) {
+		    // P(obs=o|actual=a,a!=o) for Bayes
+		    tntnt_counts[rec.qual.s[cor.index]-Read::quality_scale][cor.to][iseq[cor.index]]++;
 		  
-		  // P(actual=a|obs=o,a!=o)
-		  //ntnt_counts[iseq[cor.index]][cor.to]++;
-		  samples++;
+		    // P(actual=a|obs=o)
+		    //ntnt_counts[iseq[cor.index]][cor.to]++;
+		    tsamples++;
+		  }
 		}
 	      }
 	    }
+	    delete r;
 	  }
-	  delete r;
-	}
 	
-	if(++tcount == counts[tchunk] || samples > 200000)
-	  break;
+	  if(++tcount == count || tsamples > learn_max_samples)
+	    break;
+	}
+
+	// merge and check convergence
+#pragma omp critical(learn_chunk)
+	{
+	  for(int q = 0; q < Read::max_qual; q++)
+	    for(int i = 0; i < 4; i++)
+	      for(int j = 0; j < 4; j++)
+		ntnt_counts[q][i][j] += tntnt_counts[q][i][j];
+	  samples += tsamples;
+
+	  if(samples >= learn_max_samples)
+	    done = true;
+	  else if(samples >= checked_samples + learn_check_samples) {
+	    regress_probs(check_prob, ntnt_counts);
+	    if(checked_samples > 0 && probs_converged(check_prob, last_prob, ntnt_counts))
+	      done = true;
+	    memcpy(last_prob, check_prob, sizeof(last_prob));
+	    checked_samples = samples;
+	  }
+	  tdone = done;
+	}
       }
+      scheduler.done(tid, t, omp_get_wtime() - start);
     }
-    reads_in.close();
+    delete reads_in;
   }
 
   regress_probs(ntnt_prob, ntnt_counts);
 
-  output_model(ntnt_prob, ntnt_counts, fqf);
+  output_model(ntnt_prob, ntnt_counts, strip_gz(fqf));
+  if(save)
+    save_model(ntnt_prob, ntnt_counts, save_modelf);
 }
 
 
@@ -756,11 +1707,69 @@ vector<double> load_AT_cutoffs() {
 }
 
 
+////////////////////////////////////////////////////////////
+// prepare_fastq
+//
+// Unzip the fastq file 'fqf' if necessary, determine its
+// quality value scale and load its read index.  Return
+// true if it was unzipped.
+////////////////////////////////////////////////////////////
+static bool prepare_fastq(string & fqf, fastq_index & index) {
+  trace_span span("stage", "prepare fastq");
+  // unzip, unless an indexed BGZF file can be read directly
+  bool zip = false;
+  if(fqf.substr(fqf.size()-3) == ".gz" && !bgzf_indexed(fqf)) {
+    zip = true;
+    unzip_fastq(fqf);
+  }
+
+  // determine quality value scale
+  if(Read::quality_scale == -1)
+    guess_quality_scale(fqf);
+
+  // index file
+  index_fastq_file(fqf, index, Read::quality_scale);
+
+  return zip;
+}
+
+
+////////////////////////////////////////////////////////////
+// learn_model
+//
+// Learn nt->nt transitions from 'fqf' into 'ntnt_prob',
+// unless the model was loaded or has been learned once.
+// 'learned' notes whether a model has been learned.
+////////////////////////////////////////////////////////////
+static void learn_model(string fqf, bithash * trusted, fastq_index & index, task_scheduler & scheduler, double ntnt_prob[Read::max_qual][4][4], double prior_prob[4], bool & learned) {
+  if(TESTING || modelf != NULL || (learned && learn_once))
+    return;
+
+  trace_span span("stage", "learn errors");
+  init_probs(ntnt_prob);
+  learn_errors(fqf, trusted, index, scheduler, ntnt_prob, prior_prob, !learned && save_modelf != NULL);
+  learned = true;
+}
+
+
 ////////////////////////////////////////////////////////////
 // main
 ////////////////////////////////////////////////////////////
 int main(int argc, char **argv) {
   parse_command_line(argc, argv);
+  omp_set_num_threads(threads);
+  if(metricsf != NULL)
+    metrics = new metrics_export(metricsf, metrics_interval);
+  if(tracef != NULL)
+    tracer = new trace_log(tracef, threads);
+
+  // error model
+  double ntnt_prob[Read::max_qual][4][4] = {0};
+  double ntnt_prob2[Read::max_qual][4][4] = {0};
+  init_probs(ntnt_prob);
+  init_probs(ntnt_prob2);
+  if(modelf != NULL)
+    load_model(ntnt_prob, modelf);
 
   // prepare AT and GC counts
   unsigned long long atgc[2] = {0};
@@ -769,9 +1778,15 @@ int main(int argc, char **argv) {
   bithash *trusted = new bithash(k);
 
   // get kmer counts
+  double load_start = omp_get_wtime();
   if(merf != NULL) {
     string merf_str(merf);
-    if(ATcutf != NULL) {
+    if(mer_file_reader::is_mer_file(merf_str)) {
+      if(ATcutf != NULL)
+	trusted->mer_file_load(merf, load_AT_cutoffs(), atgc);
+      else
+	trusted->mer_file_load(merf, cutoff, atgc);
+    } else if(ATcutf != NULL) {
       if(merf_str.substr(merf_str.size()-3) == ".gz") {
 	igzstream mer_in(merf);
 	trusted->tab_file_load(mer_in, load_AT_cutoffs(), atgc);
@@ -797,6 +1812,8 @@ int main(int argc, char **argv) {
     } else
       trusted->binary_file_input(bithashf, atgc);
   }  
+  if(tracer != NULL)
+    tracer->add("stage", "load trusted kmers", load_start, omp_get_wtime());
   cout << trusted->num_kmers() << " trusted kmers" << endl;
 
   double prior_prob[4];
@@ -813,59 +1830,75 @@ int main(int argc, char **argv) {
   vector<int> pairedend_codes;
   parse_fastq(fastqfs, pairedend_codes);
 
+  // one pool of threads works through every file
+  task_scheduler scheduler(threads);
+
   // process each file
-  string fqf;
-  bool zip;
+  string fqf, fqf2;
+  bool zip, zip2;
+  bool learned = false;
   for(int f = 0; f < fastqfs.size(); f++) {
     fqf = fastqfs[f];
     cout << fqf << endl;
 
-    // unzip
-    if(fqf.substr(fqf.size()-3) == ".gz") {
-      zip = true;
-      unzip_fastq(fqf);
-    } else
-      zip = false;
-
-    // determine quality value scale
-    if(Read::quality_scale == -1)
-     guess_quality_scale(fqf);
-
-    // split file
-    vector<streampos> starts;
-    vector<unsigned long long> counts;
-    chunkify_fastq(fqf, starts, counts);
+    // unzip, guess quality and index file
+    fastq_index index;
+    zip = prepare_fastq(fqf, index);
 
     // learn nt->nt transitions
-    double ntnt_prob[Read::max_qual][4][4] = {0};
-    for(int q = 0; q < Read::max_qual; q++)
-      for(int i = 0; i < 4; i++)
-	for(int j = 0; j < 4; j++)
-	  if(i != j)
-	    ntnt_prob[q][i][j] = 1.0/3.0;
-
-    if(!TESTING)
-      learn_errors(fqf, trusted, starts, counts, ntnt_prob, prior_prob);
-
-    // correct
-    correct_reads(fqf, pairedend_codes[f], trusted, starts, counts, ntnt_prob, prior_prob);
-    
-    // combine
-    if(pairedend_codes[f] == 0) {
-      combine_output(fqf, string("cor"), uncorrected_out);
-    }
+    learn_model(fqf, trusted, index, scheduler, ntnt_prob, prior_prob, learned);
+
+    if(pairedend_codes[f] == 1) {
+      // mate file
+      fqf2 = fastqfs[++f];
+      cout << fqf2 << endl;
+
+      fastq_index index2;
+      zip2 = prepare_fastq(fqf2, index2);
+      align_pair_indexes(fqf, index, fqf2, index2);
+
+      // mates sharing a model pass the same array, so they share memo
+      // entries too
+      double (*mate_prob)[4][4] = ntnt_prob2;
+      if(modelf != NULL || learn_once)
+	mate_prob = ntnt_prob;
+      else
+	learn_model(fqf2, trusted, index2, scheduler, ntnt_prob2, prior_prob, learned);
 
-    // combine paired end
-    if(pairedend_codes[f] == 2) {
-      if(!zip) {
-	combine_output_paired(fastqfs[f-1], fqf, string("cor"), uncorrected_out);
-      } else {
-	combine_output_paired(fastqfs[f-1].substr(0,fastqfs[f-1].size()-3), fqf, string("cor"), uncorrected_out);
+      // correct mates together
+      correct_pairs(fqf, fqf2, trusted, index, index2, scheduler, ntnt_prob, mate_prob, prior_prob);
+
+      if(zip2) {
+	trace_span span("stage", "zip");
+	zip_fastq(fqf2);
       }
+
+    } else if(interleaved) {
+      // correct interleaved mates together
+      correct_pairs(fqf, string(""), trusted, index, index, scheduler, ntnt_prob, ntnt_prob, prior_prob);
+
+    } else {
+      // correct
+      correct_reads(fqf, trusted, index, scheduler, ntnt_prob, prior_prob);
+
+      // combine
+      trace_span span("stage", "combine output");
+      combine_output(strip_gz(fqf), string("cor"), uncorrected_out);
     }
 
-    if(zip)
+    if(zip) {
+      trace_span span("stage", "zip");
       zip_fastq(fqf);
+    }
+  }
+
+  if(metrics != NULL) {
+    metrics->write();
+    delete metrics;
+  }
+  if(tracer != NULL) {
+    tracer->write();
+    delete tracer;
   }
 
   return 0;
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <stdio.h>
 #include "count.h"
+#include "fastq.h"
+#include "kmer.h"
 
 using namespace std;
 using namespace HASHMAP;
@@ -12,6 +14,9 @@ typedef hash_map<Mer_t, unsigned int, hash<unsigned long> > MerTable_t;
 
 static void CountMers (const string & s, MerTable_t & mer_table);
 static void PrintMers(const MerTable_t & mer_table, int min_count);
+static void WriteMers(const MerTable_t & mer_table, int min_count);
+
+static vector<string> runs;
 
 //////////////////////////////////////////////////////////////////////
 // Usage
@@ -30,7 +35,13 @@ static void Usage (char * command)
 	  "  -f <fastq> fastq file to count\n"
 	  "  -k <len>   Length of kmer \n"
 	  "  -m <min>   Minimum count to report (default: >0)\n"
+	  "  -o <file>  Write counts sorted to binary mer <file>, merged\n"
+	  "             without the redundancies of -l\n"
 	  "  -l <limit> Gigabyte limit on RAM. If limited, the output will contain redundancies\n"
+	  "  -s         Screen out kmers seen once, most of them errors,\n"
+	  "             before they reach the table, taking far less\n"
+	  "             memory. Kmers seen once aren't output, and a few,\n"
+	  "             estimated on stderr, may be counted once too many.\n"
 	  "\n");
   return;
 }
@@ -67,6 +78,14 @@ static void parse_command_line(int argc, char **argv) {
       gb_limit = strtod(optarg, &p);
       break;
 
+    case 'o':
+      outfile = strdup(optarg);
+      break;
+
+    case 's':
+      screen = true;
+      break;
+
     case 'm':
       min_count = strtol(optarg, &p, 10);
       if(p == optarg || min_count <= 0) {
@@ -126,20 +145,28 @@ int  main (int argc, char * argv [])
       }
   }
 
+  if(screen)
+    OpenScreen();
+
   cerr << "Processing sequences..." << endl;
 
-  string s, q, tag;
+  string s, q;
+  fastq_reader reads(fp);
+  fastq_record rec;
   unsigned long mb_limit = (unsigned long)(1024.0*gb_limit);
   unsigned long kmer_limit = mb_limit * 1048576UL / (unsigned long)bytes_per_kmer;
   
-  while(Fastq_Read(fp, s, tag, q)) {
+  while(reads.next(rec)) {
+    rec.seq.assign_to(s);
     CountMers(s, mer_table);
     if(gb_limit > 0 && mer_table.size() > kmer_limit) {
       // print table
       cerr << COUNT << " sequences processed, " << LEN << " bp scanned" << endl;
-      PrintMers(mer_table, min_count);
+      WriteMers(mer_table, min_count);
       // clear table
       mer_table.clear();
+      if(screen)
+        ScreenCleared();
     }
   }
 
@@ -150,7 +177,11 @@ int  main (int argc, char * argv [])
       cerr << "WARNING: Input had " << BAD_CHAR << " non-DNA (ACGT) characters whose kmers were not counted" << endl;
     }
 
-  PrintMers(mer_table, min_count);
+  WriteMers(mer_table, min_count);
+  if(outfile != NULL)
+    MergeMerRuns(runs, false);
+  if(screen)
+    ReportScreen();
 
   return 0;
 }
@@ -159,17 +190,13 @@ int  main (int argc, char * argv [])
 ////////////////////////////////////////////////////////////
 // CountMers
 //
-// I edited this function to detect non ACGT's and ignore
-// the Kmer_Len affected kmers.
+// Count the canonical kmers of s, ignoring those with
+// non ACGT's, and with -s, those seen for the first time.
 ////////////////////////////////////////////////////////////
 static void  CountMers (const string & s, MerTable_t & mer_table)
 {
-   Mer_t  fwd_mer, rev_mer;
-   int  i, j, n;
-   int non_acgt_buffer = 0;
-
-   InitMer(fwd_mer);
-   InitMer(rev_mer);
+   static vector<Mer_t> mers;
+   int  i, n;
 
    n = s . length ();
 
@@ -178,50 +205,20 @@ static void  CountMers (const string & s, MerTable_t & mer_table)
 
    if  (n < Kmer_Len) { return; }
 
-   for  (i = 0;  i < Kmer_Len - 1;  i ++)
-   {
-     Forward_Add_Ch (fwd_mer, s [i]);
-     Reverse_Add_Ch (rev_mer, s [i]);
-
-     if(strchr(bintoascii, s[i]) == NULL)
-       non_acgt_buffer = Kmer_Len;
-     else if(non_acgt_buffer > 0)
-       non_acgt_buffer--;
-   }
-
-   MerTable_t::iterator fi;
-
-   while (i < n)
-   {
-     Forward_Add_Ch (fwd_mer, s [i]);
-     Reverse_Add_Ch (rev_mer, s [i]);
-
-     if(strchr(bintoascii, s[i]) == NULL)
-       non_acgt_buffer = Kmer_Len;
-     else if(non_acgt_buffer > 0)
-       non_acgt_buffer--;
-
-     if(non_acgt_buffer == 0) {
-       string f,r;
-
-       MerToAscii(fwd_mer, f);
-       MerToAscii(rev_mer, r);
-       
-       if (f < r)
-       {
-	 fi = mer_table.find(fwd_mer);
-	 if (fi == mer_table.end()) { fi=mer_table.insert(make_pair(fwd_mer,0)).first; }
-       }
-       else
-       {
-	 fi = mer_table.find(rev_mer);
-	 if (fi == mer_table.end()) { fi=mer_table.insert(make_pair(rev_mer,0)).first; }
-       }
-
-       fi->second++;
-     }
-     
-     i++;
+   mers.resize(n - Kmer_Len + 1);
+   BAD_CHAR += canonical_kmers(s.data(), n, Kmer_Len, &mers[0]);
+
+   for  (i = 0;  i < mers.size();  i ++) {
+     if(mers[i] == kmer_invalid)
+       continue;
+     double count = 1;
+     unsigned int seen;
+     if(screen && !ScreenMer(mers[i], seen))
+       continue;
+     pair<MerTable_t::iterator, bool> ins = mer_table.insert(make_pair(mers[i], 0u));
+     if(screen && ins.second)
+       count = ScreenAddBack(count, seen);
+     ins.first->second += (unsigned int)count;
    }
 
    return;
@@ -254,3 +251,32 @@ static void PrintMers(const MerTable_t & mer_table, int min_count)
 
   cerr << printed << " mers occur at least " << min_count << " times" << endl;
 }
+
+
+////////////////////////////////////////////////////////////
+// WriteMers
+//
+// Print the table, or with -o, write it as the next sorted
+// run of the mer file.
+////////////////////////////////////////////////////////////
+static void WriteMers(const MerTable_t & mer_table, int min_count)
+{
+  if(outfile == NULL) {
+    PrintMers(mer_table, min_count);
+    return;
+  }
+
+  cerr << mer_table.size() << " total distinct mers" << endl;
+  vector<mer_count> mers;
+  MerTable_t::const_iterator fi;
+  for (fi = mer_table.begin(); fi != mer_table.end(); fi++)
+  {
+    if (fi->second > min_count)
+    {
+      mer_count mc = {fi->first, (double)fi->second};
+      mers.push_back(mc);
+    }
+  }
+  cerr << mers.size() << " mers occur at least " << min_count << " times" << endl;
+  WriteMerRun(mers, false, runs);
+}
@@ -0,0 +1,1438 @@
+#include "Read.h"
+#include "bithash.h"
+#include "edit.h"
+#include "fastq.h"
+#include "gzstream.h"
+#include "kmer.h"
+#include "mer_bins.h"
+#include "mer_estimate.h"
+#include "mer_file.h"
+#include "mer_sketch.h"
+#include "mer_stats.h"
+#include "mer_table.h"
+#include "quality.h"
+#include "scheduler.h"
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <string.h>
+#include <getopt.h>
+#include <omp.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <unistd.h>
+#include <sys/stat.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// count-mers
+//
+// Count the canonical k-mers of one or more fastq files in parallel, as
+// integers or weighted by the probability that they're correct according to
+// their quality values, printing the same "mer count" lines as count-kmers
+// and count-qmers, or writing them sorted to a binary mer file.
+//
+// All threads count into one lock free mer_table.  Plain and indexed BGZF
+// files are split by their read indexes into tasks handed out by the
+// task_scheduler, so a single file is read by all threads; gzip files and
+// stdin can only be read from the start, so the threads take batches of
+// their reads in turn from one shared sequential_reads.  Either way, the
+// table grows between tasks or batches when it needs to.
+//
+// With a memory limit, a first pass instead writes the k-mers to mer_bins on
+// disk, and then the threads count a bin each at a time, in tables sized to
+// their share of the limit, so the counts are still exact and each k-mer is
+// printed once.  For a mer file, each bin is written as a sorted run and the
+// runs are merged.
+//
+// Optionally, the coverage histograms and samples the coverage model needs
+// are gathered from the tables, per thread, as the counts are output.
+//
+// With --screen, a mer_sketch in front of each table keeps out the k-mers
+// seen once, most of them errors, so the tables hold about the k-mers seen
+// twice or more, and those counted with the first sighting added back.
+// The sketch is sized by distinct k-mers, which a first pass over the reads
+// estimates, or in bins, the binning pass.
+//
+// Given several k, one table per k counts from a single pass over the reads,
+// which codes each read's nts and sums its quality values' logs once for all
+// k, and each k's counts and statistics are output in turn.
+//
+// With --estimate, a pass over the reads instead only estimates their k-mers
+// for several k, with mer_estimate, to recommend k and table sizes.
+//
+// Given a cutoff, only trusted k-mers are output, and with --bithash they're
+// set straight from the tables in the bithash that correct loads with -b,
+// without writing the counts at all.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// options
+////////////////////////////////////////////////////////////
+const static char* myopts = "r:f:k:m:q:p:s:l:b:t:o:c:a:h";
+static struct option  long_options [] = {
+  {"int", 0, 0, 1000},
+  {"hist", 1, 0, 1001},
+  {"sample", 1, 0, 1002},
+  {"bithash", 1, 0, 1003},
+  {"screen", 0, 0, 1004},
+  {"estimate", 0, 0, 1005},
+  {0, 0, 0, 0}
+};
+// -r, fastq files of reads
+static vector<string> fastqfs;
+// -f, file of fastq files of reads
+//char* file_of_fastqf;
+// -k, a list to count or estimate several k
+static vector<int> ks;
+// the k being scanned or output
+static int k = 0;
+// -m
+static int min_count = 0;
+// -q
+//int Read::quality_scale;
+// -p, number of threads
+//int threads;
+// -s, initial k-mer table entries
+static unsigned long long table_entries = 1ULL << 22;
+// --int, count k-mers as integers
+static bool int_counts = false;
+// -l, gigabyte limit on RAM, counting through bins on disk if set
+static double gb_limit = 0;
+// -b, number of bins on disk
+static unsigned int num_bins = 0;
+// -t, directory for bins on disk
+static string bin_dir = ".";
+// -o, binary mer file output, rather than text to stdout
+static string outf;
+// --hist, prefix of coverage histogram and sample files
+static string hist_prefix;
+// --sample, k-mers sampled overall and per AT content
+static unsigned int sample_size = mer_sample_size;
+// -c, trusted k-mer cutoff
+static double cutoff = 0;
+// -a, file of trusted k-mer cutoffs by AT content
+static char* ATcutf = NULL;
+// cutoff by AT content from -c or -a, empty to output all
+static vector<double> cutoffs;
+// --bithash, bithash file of trusted k-mers
+static string bithashf;
+// --screen, keep k-mers seen once out of the tables
+static bool screen = false;
+// --estimate, estimate k-mers for each k rather than count them
+static bool estimating = false;
+static mer_estimate * estimates = NULL;
+
+////////////////////////////////////////////////////////////
+// Usage
+//
+//  Print to stderr description of options and command line for
+//  this program.   command  is the command that was used to
+//  invoke it.
+////////////////////////////////////////////////////////////
+static void  Usage(char * command)
+{
+  fprintf (stderr,
+           "USAGE:  count-mers [options]\n"
+           "\n"
+           "Count k-mers in fastq files, weighted by quality values\n"
+           "unless --int is given. Output is to stdout in simple\n"
+           "format: mer count, or to a binary mer file with -o\n"
+           "\n"
+	   "Options:\n"
+	   " -r <file>\n"
+	   "    Fastq file of reads, gzipped or - for stdin. May be\n"
+	   "    given more than once.\n"
+	   " -f <file>\n"
+	   "    File containing fastq file names, one or two per line.\n"
+	   " -k <num>\n"
+	   "    Length of k-mers, <= 31, or a comma separated list to\n"
+	   "    count each in one pass, printing the k-mers of each in\n"
+	   "    turn, and with -o or --hist, writing each k's to the\n"
+	   "    file or prefix with .k<num> appended. [Default with\n"
+	   "    --estimate: 11,13,15,17,19,21,23,25]\n"
+	   " -m <num>=0\n"
+	   "    Print only q-mers counted >= <num>, or k-mers counted\n"
+	   "    > <num>.\n"
+	   " -p <num>\n"
+	   "    Use <num> openMP threads\n"
+	   " -q <num>\n"
+	   "    Quality value ascii scale, generally 64 or 33. If not\n"
+	   "    specified, it will guess.\n"
+	   " -s <num>\n"
+	   "    Initial size of the k-mer table, which doubles as it\n"
+	   "    fills. [Default: 4194304]\n"
+	   " -l <num>\n"
+	   "    Gigabyte limit on RAM, within which k-mers are counted\n"
+	   "    by writing them to bins on disk and counting a bin at\n"
+	   "    a time per thread.\n"
+	   " -b <num>\n"
+	   "    Number of bins on disk with -l. [Default: chosen from\n"
+	   "    the size of the input and the limit]\n"
+	   " -t <dir>\n"
+	   "    Directory for bins on disk with -l. [Default: .]\n"
+	   " -o <file>\n"
+	   "    Write counts sorted to binary mer <file>, readable by\n"
+	   "    correct, build_bithash, the reducers and dump-mers\n"
+	   " --int\n"
+	   "    Count k-mers as integers w/o the use of quality values\n"
+	   " -c <num>\n"
+	   "    Output only trusted k-mers, counted >= <num>\n"
+	   " -a <file>\n"
+	   "    Output only trusted k-mers, counted >= the cutoff for\n"
+	   "    their AT content in <file>, one per line\n"
+	   " --bithash <file>\n"
+	   "    Write the trusted k-mers to bithash <file> for\n"
+	   "    correct -b, rather than printing counts\n"
+	   " --hist <prefix>\n"
+	   "    Write coverage histograms, overall and by AT content,\n"
+	   "    and samples of counts to <prefix>.hist, .at.hist,\n"
+	   "    .sample and .at.sample for the coverage model\n"
+	   " --sample <num>\n"
+	   "    Sample <num> k-mers overall and per AT content with\n"
+	   "    --hist. [Default: 50000]\n"
+	   " --screen\n"
+	   "    Screen out k-mers seen once, most of them errors,\n"
+	   "    before they reach the table, taking far less memory.\n"
+	   "    K-mers seen once aren't output, and a few, estimated\n"
+	   "    on stderr, may be counted once too many. Q-mers'\n"
+	   "    first sightings are weighted as their second.\n"
+	   "    Without -l, the reads are read twice, first to size\n"
+	   "    the screen, except from stdin, when -s sizes it.\n"
+	   " --estimate\n"
+	   "    Rather than count, estimate distinct and solid k-mers,\n"
+	   "    coverage and genome size for each k in one pass over\n"
+	   "    the reads with HyperLogLog and count-min sketches, and\n"
+	   "    print them with a recommended k and table sizes\n"
+           "\n");
+
+   return;
+  }
+
+
+////////////////////////////////////////////////////////////
+// parse_command_line
+////////////////////////////////////////////////////////////
+static void parse_command_line(int argc, char **argv) {
+  bool errflg = false;
+  int ch;
+  optarg = NULL;
+  int option_index = 0;
+  char* p;
+
+  // parse args
+  while(!errflg && ((ch = getopt_long(argc, argv, myopts, long_options, &option_index)) != EOF)) {
+    switch(ch) {
+    case 'r':
+      fastqfs.push_back(optarg);
+      break;
+
+    case 'f':
+      file_of_fastqf = strdup(optarg);
+      break;
+
+    case 'k': {
+      vector<string> kstrs = split(optarg, ',');
+      for(unsigned int i = 0; i < kstrs.size(); i++) {
+	int kl = int(strtol(kstrs[i].c_str(), &p, 10));
+	if(p == kstrs[i].c_str() || kl < 1 || kl > 31) {
+	  fprintf(stderr, "Bad k-mer length \"%s\"\n",optarg);
+	  errflg = true;
+	}
+	ks.push_back(kl);
+      }
+      break;
+    }
+
+    case 'm':
+      min_count = int(strtol(optarg, &p, 10));
+      if(p == optarg || min_count < 0) {
+	fprintf(stderr, "Bad min count value \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 'q':
+      Read::quality_scale = int(strtol(optarg, &p, 10));
+      if(p == optarg || Read::quality_scale < -1) {
+	fprintf(stderr, "Bad quality value scale \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 'p':
+      threads = int(strtol(optarg, &p, 10));
+      if(p == optarg || threads <= 0) {
+	fprintf(stderr, "Bad number of threads \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 's':
+      table_entries = strtoull(optarg, &p, 10);
+      if(p == optarg || table_entries == 0) {
+	fprintf(stderr, "Bad k-mer table size \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 'l':
+      gb_limit = strtod(optarg, &p);
+      if(p == optarg || gb_limit <= 0) {
+	fprintf(stderr, "Bad memory limit \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 'b':
+      num_bins = (unsigned int)strtoul(optarg, &p, 10);
+      if(p == optarg || num_bins == 0 || num_bins > max_mer_bins) {
+	fprintf(stderr, "Bad number of bins \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 't':
+      bin_dir = optarg;
+      break;
+
+    case 'o':
+      outf = optarg;
+      break;
+
+    case 1000:
+      int_counts = true;
+      break;
+
+    case 1001:
+      hist_prefix = optarg;
+      break;
+
+    case 1002:
+      sample_size = (unsigned int)strtoul(optarg, &p, 10);
+      if(p == optarg) {
+	fprintf(stderr, "Bad sample size \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 'c':
+      cutoff = strtod(optarg, &p);
+      if(p == optarg || cutoff <= 0) {
+	fprintf(stderr, "Bad trusted k-mer cutoff \"%s\"\n",optarg);
+	errflg = true;
+      }
+      break;
+
+    case 'a':
+      ATcutf = strdup(optarg);
+      break;
+
+    case 1003:
+      bithashf = optarg;
+      break;
+
+    case 1004:
+      screen = true;
+      break;
+
+    case 1005:
+      estimating = true;
+      break;
+
+    case 'h':
+      Usage(argv[0]);
+      exit(EXIT_FAILURE);
+
+    case  '?' :
+      fprintf (stderr, "Unrecognized option -%c\n", optopt);
+
+    default:
+      errflg = true;
+    }
+  }
+
+  // return errors
+  if(errflg || optind != argc) {
+    Usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  ////////////////////////////////////////
+  // correct user input errors
+  ////////////////////////////////////////
+  if(fastqfs.empty() && file_of_fastqf == NULL) {
+    cerr << "Must provide a fastq file of reads (-r) or a file containing a list of fastq files of reads (-f)" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(estimating) {
+    if(ks.empty())
+      for(int kl = 11; kl <= 25; kl += 2)
+	ks.push_back(kl);
+  } else if(ks.empty()) {
+    cerr << "Must provide k-mer length with -k" << endl;
+    exit(EXIT_FAILURE);
+  } else if(ks.size() > 1 && (gb_limit > 0 || screen || cutoff > 0 || ATcutf != NULL || !bithashf.empty())) {
+    cerr << "Several k-mer lengths can't be counted with -l, --screen, -c, -a or --bithash" << endl;
+    exit(EXIT_FAILURE);
+  }
+  k = ks[0];
+  if(!bithashf.empty() && cutoff == 0 && ATcutf == NULL) {
+    cerr << "Must provide a trusted k-mer cutoff (-c) or a file containing the cutoff as a function of the AT content (-a) for --bithash" << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// load_AT_cutoffs
+//
+// Load AT cutoffs from file
+////////////////////////////////////////////////////////////
+static vector<double> load_AT_cutoffs() {
+  vector<double> at_cutoffs;
+  ifstream cut_in(ATcutf);
+  double cut;
+  while(cut_in >> cut)
+    at_cutoffs.push_back(cut);
+
+  if(at_cutoffs.size() != (unsigned int)(k+1)) {
+    cerr << "Must specify " << (k+1) << " AT cutoffs in " << ATcutf << endl;
+    exit(EXIT_FAILURE);
+  }
+  return at_cutoffs;
+}
+
+
+////////////////////////////////////////////////////////////
+// count_unit
+//
+// A unit of counting work: an entry of a file's read index.
+////////////////////////////////////////////////////////////
+struct count_unit {
+  unsigned int file;
+  int entry;
+};
+
+// reads per batch taken from a sequential file
+static const unsigned int sequential_batch_reads = 1 << 12;
+
+////////////////////////////////////////////////////////////
+// sequential_reads
+//
+// A file that can only be read from the start, shared by
+// the threads, which take batches of its reads in turn.
+////////////////////////////////////////////////////////////
+struct sequential_reads {
+  sequential_reads(const string & fqf) : reads_in(NULL) {
+    omp_init_lock(&lock);
+    if(fqf == "-")
+      reads = new fastq_reader(stdin);
+    else {
+      reads_in = new igzstream(fqf.c_str());
+      reads = new fastq_reader(reads_in);
+    }
+  }
+  ~sequential_reads() {
+    delete reads;
+    delete reads_in;
+    omp_destroy_lock(&lock);
+  }
+  bool next(fastq_batch & batch) {
+    fastq_record rec;
+    batch.clear();
+    omp_set_lock(&lock);
+    while(batch.size() < sequential_batch_reads && reads->next(rec))
+      batch.add(rec);
+    omp_unset_lock(&lock);
+    return batch.size() > 0;
+  }
+
+  omp_lock_t lock;
+  istream * reads_in;
+  fastq_reader * reads;
+};
+
+////////////////////////////////////////////////////////////
+// mer_counter
+//
+// A thread's counting state: its open file, the current
+// read's nt codes and k-mers, and by k, its counts not yet
+// passed on and the k-mers that didn't fit in the table.
+////////////////////////////////////////////////////////////
+struct mer_counter {
+  mer_counter() : tid(0), file(-1), next_entry(-1), reads_in(NULL), reads(NULL), sketch(NULL), inserted(ks.size(), 0), overflow(ks.size()), first_seen(0), added_back(0), reads_counted(0), bases(0), bad_chars(0) {}
+  ~mer_counter() { close(); }
+  void close() {
+    delete reads;
+    delete reads_in;
+    reads = NULL;
+    reads_in = NULL;
+    file = -1;
+  }
+
+  int tid;
+  int file;
+  int next_entry;
+  istream * reads_in;
+  fastq_reader * reads;
+  mer_sketch * sketch;
+
+  vector<unsigned int> codes;
+  vector<long long> logs;
+  vector<unsigned long long> mers;
+  vector<double> weights;
+  vector<unsigned long long> inserted;
+  vector< vector<mer_count> > overflow;
+  unsigned long long first_seen;
+  unsigned long long added_back;
+  unsigned long long reads_counted;
+  unsigned long long bases;
+  unsigned long long bad_chars;
+};
+
+
+////////////////////////////////////////////////////////////
+// sequential_file
+//
+// Return true if 'fqf' can only be read from the start.
+////////////////////////////////////////////////////////////
+static bool sequential_file(const string & fqf) {
+  return fqf == "-" || (fqf != strip_gz(fqf) && !bgzf_indexed(fqf));
+}
+
+
+////////////////////////////////////////////////////////////
+// scan_read
+//
+// Set the counter's mers[i] to the canonical k-mer of the
+// ki'th k starting at nt i of 'rec', or kmer_invalid if it
+// has a non-ACGT or, counting q-mers, is too unlikely to be
+// correct, and its weights[i] to the product of the k-mer's
+// nucleotides' probabilities of being correct.  The first k
+// codes the nts, for several k, and sums the logs of the
+// quality values' probabilities for the rest to share.
+////////////////////////////////////////////////////////////
+static void scan_read(const fastq_record & rec, mer_counter & counter, unsigned int ki) {
+  int n = rec.seq.len;
+  int kl = ks[ki];
+  if(ki == 0) {
+    counter.reads_counted++;
+    counter.bases += n;
+    if(ks.size() > 1) {
+      counter.codes.resize(n);
+      for(int i = 0; i < n; i++) {
+	counter.codes[i] = nt_code(rec.seq.s[i]);
+	counter.bad_chars += counter.codes[i] >> 2;
+      }
+    }
+    if(!int_counts) {
+      counter.logs.resize(n+1);
+      qmer_logs(rec.qual.s, n, Read::quality_scale, &counter.logs[0]);
+    }
+  }
+  counter.mers.clear();
+  if(n < kl)
+    return;
+  counter.mers.resize(n-kl+1);
+
+  if(ks.size() == 1)
+    counter.bad_chars += canonical_kmers(rec.seq.s, n, kl, &counter.mers[0]);
+  else
+    canonical_code_kmers(&counter.codes[0], n, kl, &counter.mers[0]);
+  if(int_counts)
+    return;
+
+  // weigh by quality values, as count-qmers does
+  counter.weights.resize(n-kl+1);
+  qmer_window_weights(&counter.logs[0], n, kl, .0001, &counter.weights[0]);
+  for(int i = 0; i <= n-kl; i++)
+    if(counter.weights[i] == 0)
+      counter.mers[i] = kmer_invalid;
+}
+
+
+////////////////////////////////////////////////////////////
+// screen_mer
+//
+// Return false if 'mer' hasn't been seen before according to
+// 'sketch', and otherwise true.
+////////////////////////////////////////////////////////////
+static bool screen_mer(mer_sketch & sketch, unsigned long long mer, unsigned long long & first_seen) {
+  if(sketch.add(mer) == 0) {
+    first_seen++;
+    return false;
+  }
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////
+// add_back
+//
+// Add back the first sighting of 'mer', which the sketch
+// screened out, as 'count' once it's inserted in 'table'.
+// Adding it back on insertion rather than on the sketch's
+// second sighting keeps k-mers whose cells others filled in
+// between from losing it.
+////////////////////////////////////////////////////////////
+static void add_back(mer_table & table, unsigned long long mer, double count, unsigned long long & added_back) {
+  bool inserted;
+  table.add(mer, count, inserted);
+  added_back++;
+}
+
+
+////////////////////////////////////////////////////////////
+// count_read
+//
+// Add the k-mers of 'rec' for each k to its table of
+// 'tables', past the counter's sketch if screening, or with
+// a memory limit, write them to 'bins'.  Add them to the
+// estimates if there are any, and only that with neither.
+////////////////////////////////////////////////////////////
+static void count_read(const fastq_record & rec, vector<mer_table*> * tables, mer_bins * bins, mer_counter & counter) {
+  if(estimates != NULL) {
+    estimates->add_read(counter.tid, rec.seq.s, rec.seq.len);
+    if(tables == NULL && bins == NULL) {
+      counter.reads_counted++;
+      counter.bases += rec.seq.len;
+      return;
+    }
+  }
+
+  if(bins != NULL) {
+    scan_read(rec, counter, 0);
+    if(!counter.mers.empty())
+      bins->add_read(counter.tid, rec.seq.s, rec.seq.len, &counter.mers[0], int_counts ? NULL : &counter.weights[0]);
+    return;
+  }
+
+  bool inserted;
+  for(unsigned int ki = 0; ki < ks.size(); ki++) {
+    scan_read(rec, counter, ki);
+    mer_table & table = *(*tables)[ki];
+    for(unsigned int i = 0; i < counter.mers.size(); i++) {
+      unsigned long long mer = counter.mers[i];
+      if(mer == kmer_invalid)
+	continue;
+      double count = int_counts ? 1.0 : counter.weights[i];
+      if(counter.sketch != NULL && !screen_mer(*counter.sketch, mer, counter.first_seen))
+	continue;
+      if(table.add(mer, count, inserted)) {
+	if(inserted) {
+	  counter.inserted[ki]++;
+	  if(counter.sketch != NULL)
+	    add_back(table, mer, count, counter.added_back);
+	}
+      } else {
+	mer_count mc = {mer, count};
+	counter.overflow[ki].push_back(mc);
+      }
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// count_task
+//
+// Count the reads of units [t.begin, t.end), reusing the
+// thread's open file when the units follow on from its last.
+////////////////////////////////////////////////////////////
+static void count_task(const task & t, const vector<count_unit> & units, vector<string> & fqfs, vector<fastq_index> & indexes, vector<mer_table*> * tables, mer_bins * bins, mer_counter & counter) {
+  fastq_record rec;
+  for(unsigned int u = t.begin; u < t.end; u++) {
+    const count_unit & unit = units[u];
+    if(counter.file != (int)unit.file) {
+      counter.close();
+      counter.reads_in = open_fastq(fqfs[unit.file]);
+      counter.reads = new fastq_reader(counter.reads_in);
+      counter.file = unit.file;
+      counter.next_entry = -1;
+    }
+    const fastq_index & index = indexes[unit.file];
+    if(counter.next_entry != unit.entry)
+      counter.reads->seek(index.start(unit.entry));
+
+    unsigned long long entry_reads = index.count(unit.entry, unit.entry+1);
+    for(unsigned long long r = 0; r < entry_reads && counter.reads->next(rec); r++)
+      count_read(rec, tables, bins, counter);
+    counter.next_entry = unit.entry+1;
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// pass_inserted
+//
+// Pass the counter's inserted k-mers on to 'tables', and
+// return true if a table is loaded past mer_max_load or a
+// k-mer didn't fit, so it needs to grow.
+////////////////////////////////////////////////////////////
+static bool pass_inserted(vector<mer_table*> & tables, mer_counter & counter) {
+  bool full = false;
+  for(unsigned int ki = 0; ki < tables.size(); ki++) {
+    tables[ki]->inserted(counter.inserted[ki]);
+    counter.inserted[ki] = 0;
+    if(!counter.overflow[ki].empty() || tables[ki]->load() > mer_max_load)
+      full = true;
+  }
+  return full;
+}
+
+
+////////////////////////////////////////////////////////////
+// grow_tables
+//
+// Grow the tables that need it, then add the k-mers that
+// didn't fit, until they all have.
+////////////////////////////////////////////////////////////
+static void grow_tables(vector<mer_table*> & tables, vector<mer_counter> & counters) {
+  bool grow = true;
+  while(grow) {
+    grow = false;
+    for(unsigned int ki = 0; ki < tables.size(); ki++) {
+      mer_table & table = *tables[ki];
+      bool full = table.load() > mer_max_load;
+      for(unsigned int t = 0; t < counters.size(); t++)
+	if(!counters[t].overflow[ki].empty())
+	  full = true;
+      if(!full)
+	continue;
+
+      cerr << "Growing k-mer table from " << table.size() << " entries";
+      if(tables.size() > 1)
+	cerr << " for k=" << ks[ki];
+      cerr << endl;
+      table.grow();
+
+      unsigned long long inserted = 0;
+      bool added_inserted;
+      for(unsigned int t = 0; t < counters.size(); t++) {
+	vector<mer_count> & overflow = counters[t].overflow[ki];
+	vector<mer_count> unfit;
+	for(unsigned int i = 0; i < overflow.size(); i++) {
+	  if(table.add(overflow[i].mer, overflow[i].count, added_inserted)) {
+	    if(added_inserted) {
+	      inserted++;
+	      if(counters[t].sketch != NULL)
+		add_back(table, overflow[i].mer, overflow[i].count, counters[t].added_back);
+	    }
+	  } else
+	    unfit.push_back(overflow[i]);
+	}
+	overflow.swap(unfit);
+	if(!overflow.empty())
+	  grow = true;
+      }
+      table.inserted(inserted);
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// count_sequential
+//
+// Count the reads of 'seq' with all threads taking batches
+// of them in turn.  Counting into 'tables', threads stop
+// once one needs to grow, setting 'grow', so it can and the
+// rest of the file be counted by calling again.
+////////////////////////////////////////////////////////////
+static void count_sequential(sequential_reads & seq, vector<mer_table*> * tables, mer_bins * bins, vector<mer_counter> & counters, bool & grow) {
+#pragma omp parallel num_threads(counters.size())
+  {
+    mer_counter & counter = counters[omp_get_thread_num()];
+    fastq_batch batch;
+    fastq_record rec;
+    while(!grow && seq.next(batch)) {
+      for(unsigned int r = 0; r < batch.size(); r++) {
+	batch.get(r, rec);
+	count_read(rec, tables, bins, counter);
+      }
+      if(tables != NULL && pass_inserted(*tables, counter))
+	grow = true;
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// count_mers
+//
+// Count the k-mers of all units, and then the sequential
+// files 'seq_files', into 'tables', one per k.  Threads stop
+// taking tasks or batches once a table is loaded past
+// mer_max_load or a k-mer didn't fit, so it can grow, and
+// then carry on.
+////////////////////////////////////////////////////////////
+static void count_mers(vector<string> & fqfs, vector<fastq_index> & indexes, const vector<count_unit> & units, const vector<unsigned int> & seq_files, double unit_bytes, vector<mer_table*> & tables, task_scheduler & scheduler, vector<mer_counter> & counters) {
+  int num_threads = scheduler.num_threads();
+  scheduler.start(units.size(), unit_bytes);
+
+  bool grow = false;
+  while(true) {
+#pragma omp parallel num_threads(num_threads)
+    {
+      int tid = omp_get_thread_num();
+      mer_counter & counter = counters[tid];
+      task t;
+      while(!grow && scheduler.next(tid, t)) {
+	double start = omp_get_wtime();
+	count_task(t, units, fqfs, indexes, &tables, NULL, counter);
+	scheduler.done(tid, t, omp_get_wtime() - start);
+	if(pass_inserted(tables, counter))
+	  grow = true;
+      }
+      counter.close();
+    }
+
+    if(!grow)
+      break;
+    grow_tables(tables, counters);
+    grow = false;
+  }
+
+  for(unsigned int f = 0; f < seq_files.size(); f++) {
+    sequential_reads seq(fqfs[seq_files[f]]);
+    while(true) {
+      count_sequential(seq, &tables, NULL, counters, grow);
+      if(!grow)
+	break;
+      grow_tables(tables, counters);
+      grow = false;
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// bin_mers
+//
+// Write the k-mers of all units and sequential files to
+// 'bins', the first pass of counting within a memory limit.
+////////////////////////////////////////////////////////////
+static void bin_mers(vector<string> & fqfs, vector<fastq_index> & indexes, const vector<count_unit> & units, const vector<unsigned int> & seq_files, double unit_bytes, mer_bins & bins, task_scheduler & scheduler, vector<mer_counter> & counters) {
+  scheduler.start(units.size(), unit_bytes);
+
+#pragma omp parallel num_threads(scheduler.num_threads())
+  {
+    int tid = omp_get_thread_num();
+    mer_counter & counter = counters[tid];
+    task t;
+    while(scheduler.next(tid, t)) {
+      double start = omp_get_wtime();
+      count_task(t, units, fqfs, indexes, NULL, &bins, counter);
+      scheduler.done(tid, t, omp_get_wtime() - start);
+    }
+    counter.close();
+  }
+
+  bool grow = false;
+  for(unsigned int f = 0; f < seq_files.size(); f++) {
+    sequential_reads seq(fqfs[seq_files[f]]);
+    count_sequential(seq, NULL, &bins, counters, grow);
+  }
+  bins.close();
+}
+
+
+////////////////////////////////////////////////////////////
+// estimate_mers
+//
+// Add the k-mers of all units and sequential files to the
+// estimates.
+////////////////////////////////////////////////////////////
+static void estimate_mers(vector<string> & fqfs, vector<fastq_index> & indexes, const vector<count_unit> & units, const vector<unsigned int> & seq_files, double unit_bytes, task_scheduler & scheduler, vector<mer_counter> & counters) {
+  scheduler.start(units.size(), unit_bytes);
+
+#pragma omp parallel num_threads(scheduler.num_threads())
+  {
+    int tid = omp_get_thread_num();
+    mer_counter & counter = counters[tid];
+    task t;
+    while(scheduler.next(tid, t)) {
+      double start = omp_get_wtime();
+      count_task(t, units, fqfs, indexes, NULL, NULL, counter);
+      scheduler.done(tid, t, omp_get_wtime() - start);
+    }
+    counter.close();
+  }
+
+  bool grow = false;
+  for(unsigned int f = 0; f < seq_files.size(); f++) {
+    sequential_reads seq(fqfs[seq_files[f]]);
+    count_sequential(seq, NULL, NULL, counters, grow);
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// screen_mers
+//
+// Estimate the distinct k-mers of all units by a first pass
+// over them, to size the screen's sketch, or if reading from
+// stdin, which can't be read twice, take the table size.
+////////////////////////////////////////////////////////////
+static unsigned long long screen_mers(vector<string> & fqfs, vector<fastq_index> & indexes, const vector<count_unit> & units, const vector<unsigned int> & seq_files, double unit_bytes, double input_bytes, task_scheduler & scheduler, vector<mer_counter> & counters) {
+  for(unsigned int f = 0; f < fqfs.size(); f++)
+    if(fqfs[f] == "-") {
+      cerr << "Sizing the screen for -s distinct k-mers, as reads from stdin can't be estimated first" << endl;
+      return table_entries;
+    }
+
+  cerr << "Estimating distinct k-mers to size the screen..." << endl;
+  estimates = new mer_estimate(ks, scheduler.num_threads(), input_bytes);
+  estimate_mers(fqfs, indexes, units, seq_files, unit_bytes, scheduler, counters);
+  unsigned long long mers = (unsigned long long)estimates->distinct(0) + 1;
+  delete estimates;
+  estimates = NULL;
+  for(unsigned int t = 0; t < counters.size(); t++) {
+    counters[t].reads_counted = 0;
+    counters[t].bases = 0;
+  }
+  return mers;
+}
+
+
+////////////////////////////////////////////////////////////
+// keep_count
+//
+// Return true if 'count' is > min_count for k-mers, or
+// >= min_count for q-mers, and 'mer' is trusted, if there's
+// a cutoff.
+////////////////////////////////////////////////////////////
+static bool keep_count(unsigned long long mer, double count) {
+  if(int_counts ? (count <= min_count) : (count < min_count))
+    return false;
+  return cutoffs.empty() || count >= cutoffs[kmer_at(mer, k)];
+}
+
+
+////////////////////////////////////////////////////////////
+// append_mers
+//
+// Append the kept entries [begin, end) of 'table' to 'out'.
+////////////////////////////////////////////////////////////
+static void append_mers(const mer_table & table, unsigned long long begin, unsigned long long end, string & out, unsigned long long & printed) {
+  char line[64];
+  unsigned long long mer;
+  double count;
+  for(unsigned long long i = begin; i < end; i++) {
+    if(!table.get(i, mer, count) || !keep_count(mer, count))
+      continue;
+
+    decode_kmer(mer, k, line);
+    if(int_counts)
+      sprintf(line+k, "\t%llu\n", (unsigned long long)count);
+    else
+      sprintf(line+k, "\t%f\n", count);
+    out += line;
+    printed++;
+  }
+}
+
+
+////////////////////////////////////////////////////////////
+// collect_mers
+//
+// Append the kept entries [begin, end) of 'table' to 'mers'.
+////////////////////////////////////////////////////////////
+static void collect_mers(const mer_table & table, unsigned long long begin, unsigned long long end, vector<mer_count> & mers) {
+  mer_count mc;
+  for(unsigned long long i = begin; i < end; i++)
+    if(table.get(i, mc.mer, mc.count) && keep_count(mc.mer, mc.count))
+      mers.push_back(mc);
+}
+
+
+////////////////////////////////////////////////////////////
+// write_mers
+//
+// Write the kept k-mers of 'table' sorted to mer file
+// 'merf' in blocks of 'block_mers', returning how many.  The
+// table is sorted in place rather than copied, to stay within
+// a memory limit, and can't be added to afterward.
+////////////////////////////////////////////////////////////
+static unsigned long long write_mers(mer_table & table, const string & merf, unsigned int block_mers = mer_block_mers) {
+  unsigned long long entries = table.compact();
+  unsigned long long written = 0;
+  mer_file_writer writer(merf, k, !int_counts, block_mers);
+  mer_count mc;
+  for(unsigned long long i = 0; i < entries; i++)
+    if(table.get(i, mc.mer, mc.count) && keep_count(mc.mer, mc.count)) {
+      writer.add(mc.mer, mc.count);
+      written++;
+    }
+  writer.close();
+  return written;
+}
+
+
+////////////////////////////////////////////////////////////
+// add_trusted
+//
+// Set the kept k-mers of entries [begin, end) of 'table' and
+// their reverse complements in 'trusted', returning how
+// many.
+////////////////////////////////////////////////////////////
+static unsigned long long add_trusted(const mer_table & table, unsigned long long begin, unsigned long long end, bithash & trusted) {
+  vector<mer_count> mers;
+  collect_mers(table, begin, end, mers);
+
+  // bits share words, so set them one block at a time
+#pragma omp critical
+  for(unsigned int i = 0; i < mers.size(); i++) {
+    trusted.add(mers[i].mer);
+    trusted.add(reverse_complement_kmer(mers[i].mer, k));
+  }
+  return mers.size();
+}
+
+
+////////////////////////////////////////////////////////////
+// gather_stats
+//
+// Add entries [begin, end) of 'table' to 'stats'.
+////////////////////////////////////////////////////////////
+static void gather_stats(const mer_table & table, unsigned long long begin, unsigned long long end, mer_stats & stats) {
+  unsigned long long mer;
+  double count;
+  for(unsigned long long i = begin; i < end; i++)
+    if(table.get(i, mer, count))
+      stats.add(mer, count);
+}
+
+
+////////////////////////////////////////////////////////////
+// table_stats
+//
+// Gather the statistics of 'table' into 'stats', a mer_stats
+// per thread.
+////////////////////////////////////////////////////////////
+static void table_stats(const mer_table & table, vector<mer_stats> & stats) {
+  const long long block_entries = 1 << 16;
+  long long blocks = (table.size() + block_entries - 1) / block_entries;
+
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+  for(long long b = 0; b < blocks; b++)
+    gather_stats(table, b*block_entries, min((unsigned long long)(b+1)*block_entries, table.size()), stats[omp_get_thread_num()]);
+}
+
+
+////////////////////////////////////////////////////////////
+// k_file
+//
+// Return 'f', or counting several k, 'f' with .k<k> appended
+// for the k being output.
+////////////////////////////////////////////////////////////
+static string k_file(const string & f) {
+  if(ks.size() == 1)
+    return f;
+  stringstream kf;
+  kf << f << ".k" << k;
+  return kf.str();
+}
+
+
+////////////////////////////////////////////////////////////
+// write_stats
+//
+// Merge the threads' statistics and write them.
+////////////////////////////////////////////////////////////
+static void write_stats(vector<mer_stats> & stats) {
+  for(unsigned int t = 1; t < stats.size(); t++)
+    stats[0].merge(stats[t]);
+  stats[0].write(k_file(hist_prefix));
+}
+
+
+////////////////////////////////////////////////////////////
+// report_screen
+//
+// Report the k-mers screened out for being seen once, which
+// go in the coverage histogram at 1 if there is one, and at
+// most how many 'collisions', k-mers whose first sighting
+// looked like a later one, are counted once too many.
+////////////////////////////////////////////////////////////
+static void report_screen(unsigned long long first_seen, unsigned long long added_back, double collisions, vector<mer_stats> * stats) {
+  unsigned long long once = (first_seen > added_back) ? first_seen - added_back : 0;
+  cerr << once << " mers seen once were screened out and not counted" << endl;
+  cerr << "At most about " << (unsigned long long)(collisions + 0.5) << " mers may be counted once too many from screen collisions" << endl;
+  if(stats != NULL)
+    (*stats)[0].add_screened(once);
+}
+
+
+////////////////////////////////////////////////////////////
+// count_bins
+//
+// Count and print the k-mers of each bin in turn, with each
+// thread taking a bin into a table of up to 'max_entries',
+// the second pass of counting within a memory limit.  For a
+// mer file, write each bin as a sorted run and merge them.
+// Gather each bin's statistics into the thread's 'stats',
+// and its trusted k-mers into 'trusted'.  If screening, each
+// bin gets its own sketch, sized by its share of the about
+// 'distinct_mers' distinct k-mers up to 'max_sketch_mers',
+// and a table for k-mers seen at least twice.
+////////////////////////////////////////////////////////////
+static void count_bins(mer_bins & bins, unsigned long long max_entries, unsigned long long max_sketch_mers, double distinct_mers, vector<mer_stats> * stats, bithash * trusted) {
+  const unsigned long long block_entries = 1 << 16;
+  const unsigned int out_bytes = 1 << 20;
+  unsigned long long distinct = 0;
+  unsigned long long printed = 0;
+  unsigned long long first_seen = 0;
+  unsigned long long added_back = 0;
+  double collisions = 0;
+  bool over_limit = false;
+  double bin_kmers = 0;
+  for(unsigned int b = 0; b < bins.size(); b++)
+    bin_kmers += bins.kmers(b);
+  // merging decodes a block of every run at once, so keep them to a
+  // quarter of the limit
+  unsigned int run_block_mers = (unsigned int)max(64.0, min((double)mer_block_mers, gb_limit * 1073741824.0 / 4 / bins.size() / sizeof(mer_count)));
+
+#pragma omp parallel for schedule(dynamic) num_threads(threads) reduction(+:distinct,printed,first_seen,added_back,collisions)
+  for(int b = 0; b < (int)bins.size(); b++) {
+    unsigned long long entries = (unsigned long long)(bins.kmers(b) / (screen ? 2 : 1) / mer_max_load) + 1;
+    mer_table table(min(entries, max_entries), !int_counts);
+    mer_sketch * sketch = screen ? new mer_sketch(min((unsigned long long)(distinct_mers * bins.kmers(b) / bin_kmers) + 1, max_sketch_mers)) : NULL;
+    unsigned long long bin_first_seen = 0;
+
+    mer_bin_reader reader(bins.file(b), k, !int_counts);
+    vector<unsigned int> codes;
+    vector<double> weights;
+    kmer_roller roller(k);
+    bool inserted;
+    while(reader.next(codes, weights)) {
+      unsigned long long record_inserted = 0;
+      roller.reset();
+      for(unsigned int i = 0; i < codes.size(); i++) {
+	roller.add(codes[i]);
+	if(i+1 < (unsigned int)k)
+	  continue;
+	double count = int_counts ? 1.0 : weights[i+1-k];
+	if(sketch != NULL && !screen_mer(*sketch, roller.canonical(), bin_first_seen))
+	  continue;
+	while(!table.add(roller.canonical(), count, inserted)) {
+	  table.inserted(record_inserted);
+	  record_inserted = 0;
+	  table.grow();
+	}
+	if(inserted) {
+	  record_inserted++;
+	  if(sketch != NULL)
+	    add_back(table, roller.canonical(), count, added_back);
+	}
+      }
+      table.inserted(record_inserted);
+      if(table.load() > mer_max_load)
+	table.grow();
+    }
+    bins.remove(b);
+    if(table.size() > max_entries)
+      over_limit = true;
+    if(sketch != NULL) {
+      first_seen += bin_first_seen;
+      collisions += sketch->collision_rate() * bin_first_seen;
+      delete sketch;
+    }
+
+    distinct += table.distinct();
+    if(stats != NULL)
+      gather_stats(table, 0, table.size(), (*stats)[omp_get_thread_num()]);
+    if(trusted != NULL) {
+      unsigned long long trusted_mers = add_trusted(table, 0, table.size(), *trusted);
+      if(outf.empty()) {
+	printed += trusted_mers;
+	continue;
+      }
+    }
+    if(!outf.empty()) {
+      printed += write_mers(table, bins.file(b) + ".mers", run_block_mers);
+      continue;
+    }
+
+    // print
+    string out;
+    for(unsigned long long i = 0; i < table.size(); i += block_entries) {
+      unsigned long long end = min(i + block_entries, table.size());
+      append_mers(table, i, end, out, printed);
+      if(out.size() >= out_bytes || end == table.size()) {
+#pragma omp critical
+	fwrite(out.data(), 1, out.size(), stdout);
+	out.clear();
+      }
+    }
+  }
+
+  if(!outf.empty()) {
+    vector<string> runs;
+    for(unsigned int b = 0; b < bins.size(); b++)
+      runs.push_back(bins.file(b) + ".mers");
+    {
+      mer_file_merger merger(runs);
+      mer_file_writer writer(outf, k, !int_counts);
+      mer_count mc;
+      while(merger.next(mc))
+	writer.add(mc.mer, mc.count);
+    }
+    for(unsigned int b = 0; b < runs.size(); b++)
+      unlink(runs[b].c_str());
+  }
+
+  if(over_limit)
+    cerr << "WARNING: Some bins had more distinct k-mers than fit in the memory limit. Use more bins (-b)." << endl;
+  cerr << distinct << " total distinct mers" << endl;
+  cerr << printed << " mers occur at least " << min_count << " times" << endl;
+  if(screen)
+    report_screen(first_seen, added_back, collisions, stats);
+}
+
+
+////////////////////////////////////////////////////////////
+// print_mers
+//
+// Print the k-mers of 'table', formatting blocks of it in
+// parallel and writing them in order, or write them to the
+// mer file.  Set its trusted k-mers in 'trusted', and then
+// print them only for a mer file.
+////////////////////////////////////////////////////////////
+static void print_mers(mer_table & table, bithash * trusted) {
+  const long long block_entries = 1 << 16;
+  long long blocks = (table.size() + block_entries - 1) / block_entries;
+  unsigned long long printed = 0;
+
+  if(trusted != NULL) {
+#pragma omp parallel for schedule(dynamic) num_threads(threads) reduction(+:printed)
+    for(long long b = 0; b < blocks; b++)
+      printed += add_trusted(table, b*block_entries, min((unsigned long long)(b+1)*block_entries, table.size()), *trusted);
+  }
+
+  if(!outf.empty()) {
+    printed = write_mers(table, k_file(outf));
+  } else if(trusted == NULL) {
+#pragma omp parallel for ordered schedule(dynamic) num_threads(threads) reduction(+:printed)
+    for(long long b = 0; b < blocks; b++) {
+      string out;
+      append_mers(table, b*block_entries, min((unsigned long long)(b+1)*block_entries, table.size()), out, printed);
+#pragma omp ordered
+      fwrite(out.data(), 1, out.size(), stdout);
+    }
+  }
+
+  cerr << table.distinct() << " total distinct mers" << endl;
+  cerr << printed << " mers occur at least " << min_count << " times" << endl;
+}
+
+
+////////////////////////////////////////////////////////////
+// choose_bins
+//
+// Choose enough bins that, if all k-mers of 'input_bytes' of
+// fastq were distinct, a bin would fit in 'max_entries', or
+// if screening, if all were seen twice, and its sketch in
+// 'max_sketch_mers'.
+////////////////////////////////////////////////////////////
+static unsigned int choose_bins(double input_bytes, unsigned long long max_entries, unsigned long long max_sketch_mers) {
+  // about half of fastq is sequence
+  double entries = input_bytes / 2 / (screen ? 2 : 1) / mer_max_load;
+  double bins = ceil(entries / max_entries);
+  if(screen)
+    bins = max(bins, ceil(input_bytes / 2 / 2 / max_sketch_mers));
+  bins = max(bins, (double)threads);
+  return (unsigned int)min(bins, (double)max_mer_bins);
+}
+
+
+////////////////////////////////////////////////////////////
+// main
+////////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
+  parse_command_line(argc, argv);
+  if(ATcutf != NULL)
+    cutoffs = load_AT_cutoffs();
+  else if(cutoff > 0)
+    cutoffs.assign(k+1, cutoff);
+
+  // gather files
+  if(file_of_fastqf != NULL) {
+    ifstream ff(file_of_fastqf);
+    string line;
+    while(getline(ff, line) && line.size() > 0) {
+      vector<string> line_fqfs = split(line);
+      fastqfs.insert(fastqfs.end(), line_fqfs.begin(), line_fqfs.end());
+    }
+  }
+
+  // quality scale
+  if(!int_counts && !estimating && Read::quality_scale == -1) {
+    for(unsigned int f = 0; f < fastqfs.size() && Read::quality_scale == -1; f++)
+      if(!sequential_file(fastqfs[f]))
+	guess_quality_scale(fastqfs[f]);
+    if(Read::quality_scale == -1) {
+      cerr << "Cannot guess at quality scale on zipped reads or reads from stdin- assuming 64." << endl;
+      Read::quality_scale = 64;
+    }
+  }
+
+  // split files into units, or if sequential, batches
+  vector<fastq_index> indexes(fastqfs.size());
+  vector<count_unit> units;
+  vector<unsigned int> seq_files;
+  double total_bytes = 0;
+  double input_bytes = 0;
+  for(unsigned int f = 0; f < fastqfs.size(); f++) {
+    count_unit unit = {f, 0};
+    if(sequential_file(fastqfs[f])) {
+      seq_files.push_back(f);
+      // guess gzip compresses fastq 4 fold
+      struct stat st_file_info;
+      if(fastqfs[f] != "-" && stat(fastqfs[f].c_str(), &st_file_info) == 0)
+	input_bytes += 4.0 * st_file_info.st_size;
+    } else {
+      index_fastq_file(fastqfs[f], indexes[f], Read::quality_scale);
+      for(unit.entry = 0; unit.entry < (int)indexes[f].entries(); unit.entry++)
+	units.push_back(unit);
+      total_bytes += indexes[f].entry_bytes * indexes[f].entries();
+    }
+  }
+  input_bytes += total_bytes;
+  double unit_bytes = (units.empty() || total_bytes == 0) ? task_scheduler::task_bytes : total_bytes / units.size();
+
+  // count
+  omp_set_num_threads(threads);
+  task_scheduler scheduler(threads);
+  vector<mer_counter> counters(threads);
+  for(int t = 0; t < threads; t++)
+    counters[t].tid = t;
+  vector<mer_table*> tables;
+  mer_bins * bins = NULL;
+  mer_sketch * sketch = NULL;
+  unsigned long long max_entries = 0;
+  unsigned long long max_sketch_mers = 0;
+  cerr << "Processing sequences..." << endl;
+  if(estimating) {
+    estimates = new mer_estimate(ks, threads, input_bytes);
+    estimate_mers(fastqfs, indexes, units, seq_files, unit_bytes, scheduler, counters);
+  } else if(gb_limit > 0) {
+    // split the limit among the threads' tables, and if screening, half
+    // of it among their bins' sketches, rounding down to powers of 2
+    double thread_bytes = gb_limit * 1073741824.0 / threads;
+    if(screen) {
+      thread_bytes /= 2;
+      max_sketch_mers = 1;
+      while(2 * max_sketch_mers * mer_sketch_cells_per_mer / 4 <= thread_bytes)
+	max_sketch_mers *= 2;
+    }
+    max_entries = 1;
+    while(2 * max_entries * mer_entry_bytes <= thread_bytes)
+      max_entries *= 2;
+    if(num_bins == 0)
+      num_bins = choose_bins(input_bytes, max_entries, max_sketch_mers);
+    unsigned int buffer_bytes = (unsigned int)max(4096.0, min(65536.0, gb_limit * 1073741824.0 / 4 / num_bins / threads));
+
+    stringstream dirs;
+    dirs << bin_dir << "/.count-mers." << getpid();
+    bins = new mer_bins(dirs.str(), num_bins, threads, buffer_bytes, k, !int_counts);
+    // estimate distinct k-mers for the bins' sketches on the way
+    if(screen)
+      estimates = new mer_estimate(ks, threads, input_bytes);
+    bin_mers(fastqfs, indexes, units, seq_files, unit_bytes, *bins, scheduler, counters);
+  } else {
+    for(unsigned int ki = 0; ki < ks.size(); ki++)
+      tables.push_back(new mer_table(table_entries, !int_counts));
+    if(screen) {
+      sketch = new mer_sketch(screen_mers(fastqfs, indexes, units, seq_files, unit_bytes, input_bytes, scheduler, counters));
+      cerr << "Screening k-mers seen once with a " << sketch->bytes() << " byte sketch" << endl;
+      for(int t = 0; t < threads; t++)
+	counters[t].sketch = sketch;
+    }
+    count_mers(fastqfs, indexes, units, seq_files, unit_bytes, tables, scheduler, counters);
+  }
+
+  unsigned long long reads_counted = 0, bases = 0, bad_chars = 0;
+  for(int t = 0; t < threads; t++) {
+    reads_counted += counters[t].reads_counted;
+    bases += counters[t].bases;
+    bad_chars += counters[t].bad_chars;
+  }
+  cerr << reads_counted << " sequences processed, " << bases << " bp scanned" << endl;
+  if(bad_chars > 0)
+    cerr << "WARNING: Input had " << bad_chars << " non-DNA (ACGT) characters whose kmers were not counted" << endl;
+
+  if(estimating) {
+    estimates->write(stdout);
+    delete estimates;
+    return 0;
+  }
+
+  bithash * trusted = NULL;
+  if(!bithashf.empty())
+    trusted = new bithash(k);
+
+  if(bins != NULL) {
+    vector<mer_stats> * stats = NULL;
+    if(!hist_prefix.empty())
+      stats = new vector<mer_stats>(threads, mer_stats(k, !int_counts, sample_size));
+
+    double distinct = 0;
+    if(estimates != NULL) {
+      distinct = estimates->distinct(0);
+      delete estimates;
+      estimates = NULL;
+    }
+    cerr << "Counting " << bins->size() << " bins" << endl;
+    count_bins(*bins, max_entries, max_sketch_mers, distinct, stats, trusted);
+    delete bins;
+
+    if(stats != NULL) {
+      write_stats(*stats);
+      delete stats;
+    }
+  }
+
+  // output each k's table in turn
+  for(unsigned int ki = 0; ki < tables.size(); ki++) {
+    k = ks[ki];
+    if(tables.size() > 1)
+      cerr << "k=" << k << ":" << endl;
+    vector<mer_stats> * stats = NULL;
+    if(!hist_prefix.empty())
+      stats = new vector<mer_stats>(threads, mer_stats(k, !int_counts, sample_size));
+
+    // gather the statistics before writing a mer file sorts the table
+    if(stats != NULL)
+      table_stats(*tables[ki], *stats);
+    print_mers(*tables[ki], trusted);
+    delete tables[ki];
+
+    if(sketch != NULL) {
+      unsigned long long first_seen = 0, added_back = 0;
+      for(int t = 0; t < threads; t++) {
+	first_seen += counters[t].first_seen;
+	added_back += counters[t].added_back;
+      }
+      report_screen(first_seen, added_back, sketch->collision_rate() * first_seen, stats);
+      delete sketch;
+    }
+
+    if(stats != NULL) {
+      write_stats(*stats);
+      delete stats;
+    }
+  }
+
+  if(trusted != NULL) {
+    cerr << trusted->num_kmers() << " trusted kmers" << endl;
+    trusted->binary_file_output((char*)bithashf.c_str());
+    delete trusted;
+  }
+
+  return 0;
+}
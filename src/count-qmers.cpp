@@ -5,6 +5,9 @@
 #include  <fstream>
 #include  <math.h>
 #include  "count.h"
+#include "fastq.h"
+#include "kmer.h"
+#include "quality.h"
 
 using namespace std;
 using namespace HASHMAP;
@@ -13,6 +16,9 @@ typedef hash_map<Mer_t, double, hash<unsigned long> > MerTable_t;
 
 static void CountMers (const string & s, const string & q, MerTable_t & mer_table);
 static void PrintMers(const MerTable_t & mer_table, int min_count);
+static void WriteMers(const MerTable_t & mer_table, int min_count);
+
+static vector<string> runs;
 
 ////////////////////////////////////////////////////////////
 // Additional options
@@ -36,10 +42,17 @@ static void Usage (char * command)
 	  "  -f <fastq> fastq file to count\n"
 	  "  -k <len>   Length of kmer \n"
 	  "  -m <min>   Minimum count to report (default: >0)\n"
+	  "  -o <file>  Write counts sorted to binary mer <file>, merged\n"
+	  "             without the redundancies of -l\n"
 	  "  -l <limit> Gigabyte limit on RAM. If limited, the output will\n"
 	  "             contain redundancies\n"
 	  "  -q <num>   Quality value ascii scale, generally 64 or 33.  If\n"
 	  "             not specified, it will guess.\n"
+	  "  -s         Screen out kmers seen once, most of them errors,\n"
+	  "             before they reach the table, taking far less\n"
+	  "             memory. Kmers seen once aren't output, a few,\n"
+	  "             estimated on stderr, may be counted once too many,\n"
+	  "             and first sightings are weighted as the second.\n"
 	  "\n");
   return;
 }
@@ -76,6 +89,14 @@ static void parse_command_line(int argc, char **argv) {
       gb_limit = strtod(optarg, &p);
       break;
 
+    case 'o':
+      outfile = strdup(optarg);
+      break;
+
+    case 's':
+      screen = true;
+      break;
+
     case 'm':
       min_count = strtol(optarg, &p, 10);
       if(p == optarg || min_count <= 0) {
@@ -129,17 +150,14 @@ static void parse_command_line(int argc, char **argv) {
 // in which case we set it to 33.
 ////////////////////////////////////////////////////////////
 static void guess_quality_scale(char* fqf) {
-  string header, seq, mid, strqual;
   int reads_to_check = 1000;
   int reads_checked = 0;
   ifstream reads_in(fqf);
-  while(getline(reads_in, header)) {
-    getline(reads_in, seq);
-    getline(reads_in, mid);
-    getline(reads_in, strqual);
-    
-    for(int i = 0; i < strqual.size(); i++) {
-      if(strqual[i] < 64) {
+  fastq_reader reads(&reads_in);
+  fastq_record rec;
+  while(reads.next(rec)) {
+    for(int i = 0; i < rec.qual.len; i++) {
+      if(rec.qual.s[i] < 64) {
 	cerr << "Guessing quality values are on ascii 33 scale" << endl;
 	quality_scale = 33;
 	reads_in.close();
@@ -183,21 +201,30 @@ int  main (int argc, char * argv [])
       guess_quality_scale(fastqfile);
   }
 
+  if(screen)
+    OpenScreen();
+
   cerr << "Processing sequences..." << endl;
 
-  string s, q, tag;
+  string s, q;
+  fastq_reader reads(fp);
+  fastq_record rec;
   unsigned long mb_limit = (unsigned long)(1024.0*gb_limit);
   unsigned long kmer_limit = mb_limit * 1048576UL / (unsigned long)bytes_per_kmer;
   unsigned int proc_seq = 0;
   
-  while(Fastq_Read(fp, s, tag, q)) {
+  while(reads.next(rec)) {
+    rec.seq.assign_to(s);
+    rec.qual.assign_to(q);
     CountMers(s, q, mer_table);
     if(gb_limit > 0 && mer_table.size() > kmer_limit) {
       // print table
       cerr << COUNT << " sequences processed, " << LEN << " bp scanned" << endl;
-      PrintMers(mer_table, min_count);
+      WriteMers(mer_table, min_count);
       // clear table
       mer_table.clear();
+      if(screen)
+        ScreenCleared();
     }
     if(++proc_seq == 1000000) {
       cerr << ".";
@@ -212,7 +239,11 @@ int  main (int argc, char * argv [])
       cerr << "WARNING: Input had " << BAD_CHAR << " non-DNA (ACGT) characters whose kmers were not counted" << endl;
     }
 
-  PrintMers(mer_table, min_count);
+  WriteMers(mer_table, min_count);
+  if(outfile != NULL)
+    MergeMerRuns(runs, true);
+  if(screen)
+    ReportScreen();
 
   return 0;
 }
@@ -221,24 +252,17 @@ int  main (int argc, char * argv [])
 ////////////////////////////////////////////////////////////
 // CountMers
 //
-// I edited this function to detect non ACGT's and ignore
-// the Kmer_Len affected kmers.
+// Count the canonical kmers of s, weighted by the product
+// of their nts' probabilities of being correct, ignoring
+// those with non ACGT's, and with -s, those seen for the
+// first time.
 ////////////////////////////////////////////////////////////
 static void  CountMers (const string & s, const string & q, MerTable_t & mer_table)
 {
-   Mer_t  fwd_mer, rev_mer;
-   int  i, j, n;
-   int non_acgt_buffer = 0;
-
-   // convert quality values
-   vector<double> quals;
-   double quality = 1.0;
-   for(i = 0; i < q.size(); i++) {
-      quals.push_back(max(.25, 1.0-pow(10.0,-(q[i]-quality_scale)/10.0)));
-   }
-
-   InitMer(fwd_mer);
-   InitMer(rev_mer);
+   static vector<Mer_t> mers;
+   static vector<long long> logs;
+   static vector<double> weights;
+   int  i, n;
 
    n = s . length ();
 
@@ -247,57 +271,25 @@ static void  CountMers (const string & s, const string & q, MerTable_t & mer_tab
 
    if  (n < Kmer_Len) { return; }
 
-   for  (i = 0;  i < Kmer_Len - 1;  i ++)
-   {
-     Forward_Add_Ch (fwd_mer, s [i]);
-     Reverse_Add_Ch (rev_mer, s [i]);
-
-     quality *= quals[i];
-
-     if(strchr(bintoascii, s[i]) == NULL)
-       non_acgt_buffer = Kmer_Len;
-     else if(non_acgt_buffer > 0)
-       non_acgt_buffer--;
-   }
-
-   MerTable_t::iterator fi;
-
-   while (i < n)
-   {
-     Forward_Add_Ch (fwd_mer, s [i]);
-     Reverse_Add_Ch (rev_mer, s [i]);
-
-     if(i == Kmer_Len-1)
-       quality *= quals[i];
-     else
-       quality *= (quals[i] / quals[i - Kmer_Len]);
-
-     if(strchr(bintoascii, s[i]) == NULL)
-       non_acgt_buffer = Kmer_Len;
-     else if(non_acgt_buffer > 0)
-       non_acgt_buffer--;
-
-     if(non_acgt_buffer == 0 && quality > .0001) {
-       string f,r;
-
-       MerToAscii(fwd_mer, f);
-       MerToAscii(rev_mer, r);
-       
-       if (f < r)
-       {
-	 fi = mer_table.find(fwd_mer);
-	 if (fi == mer_table.end()) { fi=mer_table.insert(make_pair(fwd_mer,0)).first; }
-       }
-       else
-       {
-	 fi = mer_table.find(rev_mer);
-	 if (fi == mer_table.end()) { fi=mer_table.insert(make_pair(rev_mer,0)).first; }
-       }
-
-       fi->second += quality;
-     }
-     
-     i++;
+   mers.resize(n - Kmer_Len + 1);
+   BAD_CHAR += canonical_kmers(s.data(), n, Kmer_Len, &mers[0]);
+
+   // weigh by quality values
+   logs.resize(n + 1);
+   weights.resize(n - Kmer_Len + 1);
+   qmer_weights(q.data(), n, quality_scale, Kmer_Len, .0001, &logs[0], &weights[0]);
+
+   for  (i = 0;  i < mers.size();  i ++) {
+     if(mers[i] == kmer_invalid || weights[i] == 0)
+       continue;
+     double count = weights[i];
+     unsigned int seen;
+     if(screen && !ScreenMer(mers[i], seen))
+       continue;
+     pair<MerTable_t::iterator, bool> ins = mer_table.insert(make_pair(mers[i], 0.0));
+     if(screen && ins.second)
+       count = ScreenAddBack(count, seen);
+     ins.first->second += count;
    }
 
    return;
@@ -330,3 +322,32 @@ static void PrintMers(const MerTable_t & mer_table, int min_count)
 
   cerr << printed << " mers occur at least " << min_count << " times" << endl;
 }
+
+
+////////////////////////////////////////////////////////////
+// WriteMers
+//
+// Print the table, or with -o, write it as the next sorted
+// run of the mer file.
+////////////////////////////////////////////////////////////
+static void WriteMers(const MerTable_t & mer_table, int min_count)
+{
+  if(outfile == NULL) {
+    PrintMers(mer_table, min_count);
+    return;
+  }
+
+  cerr << mer_table.size() << " total distinct mers" << endl;
+  vector<mer_count> mers;
+  MerTable_t::const_iterator fi;
+  for (fi = mer_table.begin(); fi != mer_table.end(); fi++)
+  {
+    if (fi->second >= min_count)
+    {
+      mer_count mc = {fi->first, (double)fi->second};
+      mers.push_back(mc);
+    }
+  }
+  cerr << mers.size() << " mers occur at least " << min_count << " times" << endl;
+  WriteMerRun(mers, true, runs);
+}
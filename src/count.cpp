@@ -1,10 +1,20 @@
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
 #include "count.h"
+#include "fastq.h"
+#include "kmer.h"
+#include "memo.h"
+#include "mer_sketch.h"
 
 //////////////////////////////////////////////////////////////////////
 // options
 //////////////////////////////////////////////////////////////////////
-const char* myopts = "f:k:m:l:q:";
+const char* myopts = "f:k:m:l:q:o:s";
 // -f
 char* fastqfile = "-";
 // -k
@@ -13,6 +23,10 @@ int Kmer_Len = 15;
 int min_count = 0;
 // -l
 float gb_limit = 0;
+// -o
+char* outfile = NULL;
+// -s
+bool screen = false;
 
 
 //////////////////////////////////////////////////////////////////////
@@ -22,26 +36,19 @@ int COUNT = 0;
 int LEN = 0;
 int BAD_CHAR = 0;
 int PRINT_SIMPLE = 1;
+unsigned long long SCREEN_FIRST = 0;
+unsigned long long SCREEN_ADDED = 0;
+
+// sketch screening out kmers seen once, with -s
+static mer_sketch * screen_sketch = NULL;
+// kmers first seen before the kmer table was first cleared
+// for a memory limit, or all if it hasn't been
+static unsigned long long screen_first_uncleared = 0;
+static bool screen_cleared = false;
 const char* bintoascii = "ACGT";
 int bytes_per_kmer = 44; // limit size
 Mer_t Forward_Mask = 0;
 
-//  Return the binary equivalent of  ch .
-unsigned  Char_To_Binary (char ch)
-{
-  switch  (tolower (ch))
-  {
-    case  'a' : return  0;
-    case  'c' : return  1;
-    case  'g' : return  2;
-    case  't' : return  3;
-    default: BAD_CHAR++; return 0;
-  };
-
-  return  0;
-}
-
-
 char RC(char ch)
 {
   switch(toupper(ch))
@@ -71,89 +78,168 @@ char NORM(char ch)
   return 0;
 }
 
-void InitMer(Mer_t & mer)
-{
-  mer = 0;
-}
-
 void MerToAscii(Mer_t mer, string & s)
 {
-  s.erase();
   s.resize(Kmer_Len);
-
-  for (int i = 0; i < Kmer_Len; i++)
-  {
-    s[Kmer_Len-i-1] = bintoascii[mer & 0x3];
-    mer >>= 2;
-  }
+  decode_kmer(mer, Kmer_Len, &s[0]);
 }
 
-//  Add  ch  to  mer  on the right, sliding one character
-//  off the left end of  mer .
-void  Forward_Add_Ch(Mer_t & mer, char ch)
+
+////////////////////////////////////////////////////////////
+// WriteMerRun
+//
+// Sort mers and write them to the next run of the mer file
+// outfile, adding its name to runs.
+////////////////////////////////////////////////////////////
+void WriteMerRun(vector<mer_count> & mers, bool quality, vector<string> & runs)
 {
-  mer <<= 2;
-  mer &= Forward_Mask;
-  mer |= Char_To_Binary (ch);
+  sort(mers.begin(), mers.end(), mer_count_less);
+
+  stringstream runf;
+  runf << outfile << ".run" << runs.size();
+  runs.push_back(runf.str());
+
+  mer_file_writer writer(runs.back(), Kmer_Len, quality);
+  for(unsigned long long i = 0; i < mers.size(); i++)
+    writer.add(mers[i].mer, mers[i].count);
+  writer.close();
 }
 
-//  Add the Watson-Crick complement of  ch  to  mer  on the left,
-//  sliding one character off the right end of  mer .
-void  Reverse_Add_Ch(Mer_t & mer, char ch)
+
+////////////////////////////////////////////////////////////
+// MergeMerRuns
+//
+// Merge the runs into outfile, summing the counts of kmers
+// in several, which a memory limit leaves redundant in text.
+////////////////////////////////////////////////////////////
+void MergeMerRuns(const vector<string> & runs, bool quality)
 {
-  mer >>= 2;
-  mer |= ((long long unsigned) (3 ^ Char_To_Binary (ch)) << (2 * Kmer_Len - 2));
+  if(runs.size() == 1) {
+    rename(runs[0].c_str(), outfile);
+    return;
+  }
+
+  {
+    mer_file_merger merger(runs);
+    mer_file_writer writer(outfile, Kmer_Len, quality);
+    mer_count mc;
+    while(merger.next(mc))
+      writer.add(mc.mer, mc.count);
+  }
+  for(unsigned int r = 0; r < runs.size(); r++)
+    unlink(runs[r].c_str());
 }
 
 
-bool Fastq_Read(FILE * fp, string & s, string & hdr, string & q)
+////////////////////////////////////////////////////////////
+// OpenScreen
+//
+// Make the sketch for -s, sized for the fastq file's
+// distinct kmers, estimated by a first pass over it, or for
+// 2^24 from stdin, which can't be read twice.
+////////////////////////////////////////////////////////////
+void OpenScreen()
 {
-  int ch;
-
-  s.erase();
-  hdr.erase();
-  q.erase();
+  unsigned long long mers = 1ULL << 24;
+  FILE * fp = NULL;
+  if(strcmp(fastqfile, "-") != 0)
+    fp = fopen(fastqfile, "r");
+  if(fp != NULL) {
+    cerr << "Estimating distinct kmers to size the screen..." << endl;
+    mer_hll hll;
+    fastq_reader reads(fp);
+    fastq_record rec;
+    vector<Mer_t> read_mers;
+    while(reads.next(rec)) {
+      int n = rec.seq.len;
+      if(n < Kmer_Len)
+	continue;
+      read_mers.resize(n - Kmer_Len + 1);
+      canonical_kmers(rec.seq.s, n, Kmer_Len, &read_mers[0]);
+      for(unsigned int i = 0; i < read_mers.size(); i++)
+	if(read_mers[i] != kmer_invalid)
+	  hll.add(mix_hash(read_mers[i]));
+    }
+    fclose(fp);
+    mers = (unsigned long long)hll.estimate() + 1;
+  }
+  screen_sketch = new mer_sketch(mers);
+  cerr << "Screening kmers seen once with a " << screen_sketch->bytes() << " byte sketch" << endl;
+}
 
-  // skip till next '@' if necessary
-  while  ((ch = fgetc (fp)) != EOF && ch != '@')
-    ;
 
-  if(ch == EOF)
+////////////////////////////////////////////////////////////
+// ScreenMer
+//
+// Return false if mer is seen for the first time, and
+// otherwise true, setting seen to how many times it was
+// seen before.
+////////////////////////////////////////////////////////////
+bool ScreenMer(Mer_t mer, unsigned int & seen)
+{
+  seen = screen_sketch->add(mer);
+  if(seen == 0) {
+    SCREEN_FIRST++;
     return false;
+  }
+  return true;
+}
+
 
-  // skip spaces if any
-  while  ((ch = fgetc (fp)) != EOF && ch == ' ')
-    ;
-  if  (ch == EOF)
-    return  false;
-  ungetc (ch, fp);
+////////////////////////////////////////////////////////////
+// ScreenAddBack
+//
+// Return count doubled to add back the first sighting of a
+// kmer just inserted in the table, which ScreenMer screened
+// out, seen times before.  Adding it back on insertion
+// rather than on the sketch's second sighting keeps kmers
+// whose cells others filled in between from losing it.
+// Once the table has been cleared for a memory limit, a
+// kmer inserted again was added back before, and was seen
+// at least twice, so then only kmers seen once before are,
+// and new kmers whose cells others filled between their
+// sightings are counted once too few.
+////////////////////////////////////////////////////////////
+double ScreenAddBack(double count, unsigned int seen)
+{
+  if(screen_cleared && seen != 1)
+    return count;
+  SCREEN_ADDED++;
+  return 2 * count;
+}
 
-  // put rest of line into  hdr
-  while  ((ch = fgetc (fp)) != EOF && ch != '\n')
-    hdr . push_back (char (ch));
 
-  // put everything up till next '\n' into  s
-  while  ((ch = fgetc (fp)) != EOF && ch != '\n')
-  {
-    if  (! isspace (ch))
-      s . push_back (char (ch));
-  }
+////////////////////////////////////////////////////////////
+// ScreenCleared
+//
+// Note that the kmer table was cleared for a memory limit.
+////////////////////////////////////////////////////////////
+void ScreenCleared()
+{
+  if(!screen_cleared)
+    screen_first_uncleared = SCREEN_FIRST;
+  screen_cleared = true;
+}
 
-  // skep next line
-  while  ((ch = fgetc (fp)) != EOF && ch != '\n')
-    ;
 
-  // put everything up till next '\n' into  q
-  while  ((ch = fgetc (fp)) != EOF && ch != '\n')
-  {
-    if  (! isspace (ch))
-      q . push_back (char (ch));
+////////////////////////////////////////////////////////////
+// ReportScreen
+//
+// Report the kmers screened out for being seen once, and
+// at most about how many kmers collisions in the sketch
+// counted once too many, or once the table was cleared,
+// once too few.
+////////////////////////////////////////////////////////////
+void ReportScreen()
+{
+  unsigned long long once = (SCREEN_FIRST > SCREEN_ADDED) ? SCREEN_FIRST - SCREEN_ADDED : 0;
+  double collisions = screen_sketch->collision_rate() * SCREEN_FIRST;
+  cerr << once << " mers seen once were screened out and not counted" << endl;
+  cerr << "At most about " << (unsigned long long)(collisions + 0.5) << " mers may be counted once too many from screen collisions" << endl;
+  if(screen_cleared) {
+    double lost = screen_sketch->collision_rate(2) * (SCREEN_FIRST - screen_first_uncleared);
+    cerr << "At most about " << (unsigned long long)(lost + 0.5) << " mers first seen after the table was cleared may be counted once too few from screen collisions" << endl;
   }
-  
-  if(ch == EOF)
-    return false;
-  else if(ch == '@')
-    ungetc (ch, fp);
-  
-  return  true;
+  delete screen_sketch;
+  screen_sketch = NULL;
 }
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <getopt.h>
+#include "mer_file.h"
 
 //-- Include hash_map
 #ifdef __GNUC__
@@ -48,6 +49,10 @@ extern int   Kmer_Len;
 extern int min_count;
 // -l
 extern float gb_limit;
+// -o
+extern char * outfile;
+// -s
+extern bool screen;
 
 
 //////////////////////////////////////////////////////////////////////
@@ -57,17 +62,21 @@ extern int COUNT;
 extern int LEN;
 extern int BAD_CHAR;
 extern int PRINT_SIMPLE;
+extern unsigned long long SCREEN_FIRST;
+extern unsigned long long SCREEN_ADDED;
 extern const char * bintoascii;
 extern int bytes_per_kmer; // limit size
 
 //////////////////////////////////////////////////////////////////////
 // methods
 //////////////////////////////////////////////////////////////////////
-void InitMer(Mer_t & mer);
-unsigned Char_To_Binary (char ch);
-void Forward_Add_Ch (Mer_t & mer, char ch);
-void Reverse_Add_Ch (Mer_t & mer, char ch);
 void MerToAscii(Mer_t mer, string & s);
-bool Fastq_Read(FILE * fp, string & s, string & hdr, string & q);
+void WriteMerRun(vector<mer_count> & mers, bool quality, vector<string> & runs);
+void MergeMerRuns(const vector<string> & runs, bool quality);
+void OpenScreen();
+bool ScreenMer(Mer_t mer, unsigned int & seen);
+double ScreenAddBack(double count, unsigned int seen);
+void ScreenCleared();
+void ReportScreen();
 
 #endif
@@ -5,6 +5,9 @@
 #include  <fstream>
 #include  <math.h>
 #include  "count.h"
+#include "fastq.h"
+#include "kmer.h"
+#include "quality.h"
 #include "qmer_hash.h"
 
 using namespace std;
@@ -48,6 +51,8 @@ static void Usage (char * command)
 	  "  -l <limit> Gigabyte limit on RAM. If limited, the output will\n"
 	  "             contain redundancies\n"
 	  "  -t <size>  Define hash table size explicitly. [Default: chosen via k]\n"
+	  "             count-mers --estimate prints a size for the reads as\n"
+	  "             count_qmers_size.\n"
 	  "  -m <max>   Maximum k-mer count. [Default: 500]\n"
 	  "  -q <num>   Quality value ascii scale, generally 64 or 33.  If\n"
 	  "             not specified, it will guess.\n"
@@ -83,7 +88,7 @@ static void parse_command_line(int argc, char **argv) {
       break;
 
     case 't':
-      table_size = strtol(optarg, &p, 15);
+      table_size = strtoull(optarg, &p, 10);
       if(p == optarg || table_size <= 0) {
 	fprintf(stderr, "Bad table size \%s\"\n", optarg);
 	errflg = true;
@@ -147,17 +152,14 @@ static void parse_command_line(int argc, char **argv) {
 // in which case we set it to 33.
 ////////////////////////////////////////////////////////////////////////////////
 static void guess_quality_scale(char* fqf) {
-  string header, seq, mid, strqual;
   int reads_to_check = 1000;
   int reads_checked = 0;
   ifstream reads_in(fqf);
-  while(getline(reads_in, header)) {
-    getline(reads_in, seq);
-    getline(reads_in, mid);
-    getline(reads_in, strqual);
-    
-    for(int i = 0; i < strqual.size(); i++) {
-      if(strqual[i] < 64) {
+  fastq_reader reads(&reads_in);
+  fastq_record rec;
+  while(reads.next(rec)) {
+    for(int i = 0; i < rec.qual.len; i++) {
+      if(rec.qual.s[i] < 64) {
 	cerr << "Guessing quality values are on ascii 33 scale" << endl;
 	quality_scale = 33;
 	reads_in.close();
@@ -224,10 +226,14 @@ int  main (int argc, char * argv [])
 
   cerr << "Processing sequences..." << endl;
 
-  string s, q, tag;
+  string s, q;
+  fastq_reader reads(fp);
+  fastq_record rec;
   unsigned int proc_seq = 0;
   
-  while(Fastq_Read(fp, s, tag, q)) {
+  while(reads.next(rec)) {
+    rec.seq.assign_to(s);
+    rec.qual.assign_to(q);
     CountMers(s, q, mer_table);
     if(mer_table.load() > 0.9) {
       // print table
@@ -254,51 +260,19 @@ int  main (int argc, char * argv [])
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
-// compare_mers
-//
-// Return true if the first mer is lexicographically before the second
-////////////////////////////////////////////////////////////////////////////////
-bool compare_mers(Mer_t mer1, Mer_t mer2) {
-     unsigned long long nt_mask = Forward_Mask - ((1ULL << (2*Kmer_Len-2)) - 1);
-     unsigned long long nt1, nt2;
-     for(int i = 0; i < Kmer_Len; i++) {
-	  nt1 = nt_mask & mer1;
-	  nt2 = nt_mask & mer2;
-
-	  if(nt1 < nt2)
-	       return true;
-	  else if(nt2 < nt1)
-	       return false;
-
-	  mer1 <<= 2;
-	  mer2 <<= 2;
-     }     
-     return false;
-}
-
-
 ////////////////////////////////////////////////////////////////////////////////
 // CountMers
 //
-// I edited this function to detect non ACGT's and ignore
-// the Kmer_Len affected kmers.
+// Count the canonical kmers of s, weighted by the product
+// of their nts' probabilities of being correct, ignoring
+// those with non ACGT's.
 ////////////////////////////////////////////////////////////////////////////////
 static void  CountMers (const string & s, const string & q, qmer_hash & mer_table)
 {
-   Mer_t  fwd_mer, rev_mer;
-   int  i, j, n;
-   int non_acgt_buffer = 0;
-
-   // convert quality values
-   vector<double> quals;
-   double quality = 1.0;
-   for(i = 0; i < q.size(); i++) {
-      quals.push_back(max(.25, 1.0-pow(10.0,-(q[i]-quality_scale)/10.0)));
-   }
-
-   InitMer(fwd_mer);
-   InitMer(rev_mer);
+   static vector<Mer_t> mers;
+   static vector<long long> logs;
+   static vector<double> weights;
+   int  i, n;
 
    n = s . length ();
 
@@ -307,45 +281,17 @@ static void  CountMers (const string & s, const string & q, qmer_hash & mer_tabl
 
    if  (n < Kmer_Len) { return; }
 
-   for  (i = 0;  i < Kmer_Len - 1;  i ++)
-   {
-     Forward_Add_Ch (fwd_mer, s [i]);
-     Reverse_Add_Ch (rev_mer, s [i]);
-
-     quality *= quals[i];
-
-     if(strchr(bintoascii, s[i]) == NULL)
-       non_acgt_buffer = Kmer_Len;
-     else if(non_acgt_buffer > 0)
-       non_acgt_buffer--;
-   }
-
-   while (i < n)
-   {
-     Forward_Add_Ch (fwd_mer, s [i]);
-     Reverse_Add_Ch (rev_mer, s [i]);
-
-     if(i == Kmer_Len-1)
-       quality *= quals[i];
-     else
-       quality *= (quals[i] / quals[i - Kmer_Len]);
-
-     if(strchr(bintoascii, s[i]) == NULL)
-       non_acgt_buffer = Kmer_Len;
-     else if(non_acgt_buffer > 0)
-       non_acgt_buffer--;
-
-     if(non_acgt_buffer == 0 && quality > .005) {
-       string f,r;
-
-       if(compare_mers(fwd_mer, rev_mer))
-	    mer_table.add(fwd_mer, quality);
-       else
-	    mer_table.add(rev_mer, quality);
-     }
-     
-     i++;
-   }
+   mers.resize(n - Kmer_Len + 1);
+   BAD_CHAR += canonical_kmers(s.data(), n, Kmer_Len, &mers[0]);
+
+   // weigh by quality values
+   logs.resize(n + 1);
+   weights.resize(n - Kmer_Len + 1);
+   qmer_weights(q.data(), n, quality_scale, Kmer_Len, .005, &logs[0], &weights[0]);
+
+   for  (i = 0;  i < mers.size();  i ++)
+     if(mers[i] != kmer_invalid && weights[i] > 0)
+       mer_table.add(mers[i], weights[i]);
 
    return;
 }
@@ -0,0 +1,92 @@
+#include "mer_file.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <omp.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// dump-mers
+//
+// Export a binary mer file written by count-mers -o, count-kmers -o,
+// count-qmers -o or the reducers as the "mer count" text lines the counters
+// print, decoding blocks in parallel and writing them in order.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// options
+////////////////////////////////////////////////////////////
+const static char* myopts = "m:p:h";
+// -m, only print k-mers counted >= this
+static double min_count = 0;
+// -p, number of threads
+static int threads = 4;
+
+static void Usage(char * command)
+{
+  fprintf(stderr,
+	  "USAGE:  dump-mers [options] <mer file>\n"
+	  "\n"
+	  "Print the counts of a binary mer file to stdout in simple\n"
+	  "format: mer count\n"
+	  "\n"
+	  "Options:\n"
+	  " -m <num>=0\n"
+	  "    Print only k-mers counted >= <num>\n"
+	  " -p <num>\n"
+	  "    Use <num> openMP threads\n"
+	  "\n");
+}
+
+int main(int argc, char **argv) {
+  int ch;
+  char* p;
+  while((ch = getopt(argc, argv, myopts)) != EOF) {
+    switch(ch) {
+    case 'm':
+      min_count = strtod(optarg, &p);
+      if(p == optarg) {
+	fprintf(stderr, "Bad min count value \"%s\"\n", optarg);
+	exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'p':
+      threads = int(strtol(optarg, &p, 10));
+      if(p == optarg || threads <= 0) {
+	fprintf(stderr, "Bad number of threads \"%s\"\n", optarg);
+	exit(EXIT_FAILURE);
+      }
+      break;
+
+    default:
+      Usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(optind+1 != argc) {
+    Usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  mer_file_reader mer_in(argv[optind]);
+  int k = mer_in.k();
+  bool quality = mer_in.quality();
+
+#pragma omp parallel for ordered schedule(dynamic) num_threads(threads)
+  for(long long b = 0; b < (long long)mer_in.blocks(); b++) {
+    vector<mer_count> mers;
+    mer_in.read_block(b, mers);
+
+    string out;
+    for(unsigned int i = 0; i < mers.size(); i++)
+      if(mers[i].count >= min_count)
+	append_mer_text(out, mers[i], k, quality);
+#pragma omp ordered
+    fwrite(out.data(), 1, out.size(), stdout);
+  }
+
+  return 0;
+}
@@ -1,11 +1,23 @@
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <fstream>
 #include <omp.h>
 #include <iostream>
 #include <sstream>
 #include <cstring>
+#include <dirent.h>
+#include <algorithm>
 #include <gzstream.h>
+#include "edit.h"
 #include "Read.h"
+#include "bgzf.h"
+#include "fastq.h"
+
+// copy_file_range is in glibc 2.27 and later
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // options
@@ -17,6 +29,10 @@ char* file_of_fastqf = NULL;
 
 // -z, zip output files
 bool zip_output = false;
+// --bgzf, zip output files as BGZF with read indexes
+bool bgzf_output = false;
+// --interleaved, paired end reads interleaved in one file
+bool interleaved = false;
 
 // -q
 int Read::quality_scale = -1;
@@ -26,8 +42,6 @@ int threads = 4;
 // -t
 int trimq = 3;
 
-unsigned int chunks_per_thread = 200;
-
 
 ////////////////////////////////////////////////////////////////////////////////
 // split
@@ -117,6 +131,7 @@ void zip_fastq(string fqf) {
 
   // remove unzipped fqf, leaving only zipped
   remove(fqf.c_str());  
+  remove((fqf + ".cidx").c_str());
 
   // determine output file
   /*
@@ -144,73 +159,277 @@ void zip_fastq(string fqf) {
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// combine_logs
+// strip_gz
 //
-// Combine log files that may be in out_dir into a single log file named
-// using fqf.
+// Remove a ".gz" suffix from the file name, if present.
 ////////////////////////////////////////////////////////////////////////////////
-void combine_logs(string fqf, string out_dir) {
+string strip_gz(string fqf) {
+  if(fqf.size() > 3 && fqf.substr(fqf.size()-3) == ".gz")
+    return fqf.substr(0, fqf.size()-3);
+  else
+    return fqf;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// bgzf_indexed
+//
+// Return true if 'fqf' is a BGZF file with a read index, which can be split
+// into chunks and read in parallel without unzipping it first.
+////////////////////////////////////////////////////////////////////////////////
+bool bgzf_indexed(string fqf) {
   struct stat st_file_info;
-  string log1 = out_dir+"/0.log";
-  if(stat(log1.c_str(), &st_file_info) == 0) {
-    // format log output
-    string logf = fqf + ".log";
-    ofstream corlog_out(logf.c_str());
+  string indexf = fqf + ".ridx";
+  return (fqf != strip_gz(fqf) && stat(indexf.c_str(), &st_file_info) == 0);
+}
 
-    // combine
-    string line;
-    for(int t = 0; t < threads*chunks_per_thread; t++) {    
-      string tc_file(out_dir+"/");
-      stringstream tc_convert;
-      tc_convert << t;
-      tc_file += tc_convert.str();
-      tc_file += ".log";
-      
-      if(stat(tc_file.c_str(), &st_file_info) == 0) {
-	ifstream tc_out(tc_file.c_str());
-	while(getline(tc_out, line)) {
-	  corlog_out << line << endl;
-	}
-	tc_out.close();
-	remove(tc_file.c_str());
+
+////////////////////////////////////////////////////////////////////////////////
+// open_fastq
+//
+// Open a fastq file for reading, which may be an indexed BGZF file.
+////////////////////////////////////////////////////////////////////////////////
+istream * open_fastq(string fqf) {
+  if(fqf != strip_gz(fqf))
+    return new ibgzfstream(fqf.c_str());
+  else
+    return new ifstream(fqf.c_str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// open_output
+//
+// Open an output file as plain text, gzip or indexed BGZF according to the
+// zip options, adding the ".gz" suffix for zipped output.
+////////////////////////////////////////////////////////////////////////////////
+ostream * open_output(string outf) {
+  if(zip_output) {
+    outf += ".gz";
+    if(bgzf_output) {
+      obgzfstream * bgzf_out = new obgzfstream(outf.c_str());
+      bgzf_out->index_reads();
+      return bgzf_out;
+    } else
+      return new ogzstream(outf.c_str());
+  } else
+    return new ofstream(outf.c_str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// append_file
+//
+// Append the first 'length' bytes of the file 'inf' to the file open as
+// 'out_fd', copying in the kernel with copy_file_range where available.
+////////////////////////////////////////////////////////////////////////////////
+static void append_file(int out_fd, string inf, unsigned long long length) {
+  int in_fd = open(inf.c_str(), O_RDONLY);
+  if(in_fd == -1) {
+    cerr << "Cannot open " << inf << " to combine output" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned long long copied = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+  while(copied < length) {
+    ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, length - copied, 0);
+    if(n <= 0)
+      break;
+    copied += n;
+  }
+#endif
+
+  // fall back to read and write
+  if(copied < length) {
+    char* buf = new char[fastq_block_size];
+    lseek(in_fd, copied, SEEK_SET);
+    while(copied < length) {
+      ssize_t n = read(in_fd, buf, (size_t)((length - copied < fastq_block_size) ? length - copied : fastq_block_size));
+      if(n <= 0 || write(out_fd, buf, n) != n) {
+	cerr << "Failed to combine " << inf << " into output" << endl;
+	exit(EXIT_FAILURE);
       }
+      copied += n;
     }
-    corlog_out.close();
+    delete[] buf;
   }
+  close(in_fd);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// combine_output_stream
+// concatenate_output
 //
-// Combine output files in 'out_dir' into a single file defined by the given
-// stream, and remove those files along the way.
+// Concatenate the chunk output files 'chunkfs', written by open_output, into
+// the single output file 'outf' as open_output would name it, and remove
+// them.  gzip members can simply be concatenated.  BGZF chunks drop their
+// EOF blocks, except the last, and their read indexes are merged with reads
+// and virtual offsets rebased.
 ////////////////////////////////////////////////////////////////////////////////
-void combine_output_stream(ostream & combine_out, ostream & err_out, string out_dir) {
-  string header, seq, mid, qual;
+static void concatenate_output(vector<string> & chunkfs, string outf) {
+  if(chunkfs.empty()) {
+    // empty output
+    delete open_output(outf);
+    return;
+  }
+
+  if(zip_output)
+    outf += ".gz";
+
+  // a single chunk is simply moved
+  if(chunkfs.size() == 1) {
+    if(rename(chunkfs[0].c_str(), outf.c_str()) == 0) {
+      if(bgzf_output)
+	rename((chunkfs[0] + ".ridx").c_str(), (outf + ".ridx").c_str());
+      return;
+    }
+  }
+
+  int out_fd = open(outf.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(out_fd == -1) {
+    cerr << "Cannot open output file " << outf << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  vector<unsigned long long> index_reads;
+  vector<unsigned long long> index_offsets;
+  unsigned long long read_base = 0;
+  unsigned long long byte_base = 0;
   struct stat st_file_info;
-  for(int t = 0; t < threads*chunks_per_thread; t++) {
-    string tc_file(out_dir+"/");
-    stringstream tc_convert;
-    tc_convert << t;
-    tc_file += tc_convert.str();
-
-    // if file exists, add to single output
-    if(stat(tc_file.c_str(), &st_file_info) == 0) {
-      ifstream tc_out(tc_file.c_str());
-      while(getline(tc_out, header)) {
-	getline(tc_out, seq);
-	getline(tc_out, mid);
-	getline(tc_out, qual);
-
-	if(!err_out.good() || header.find("error") == -1)
-	  combine_out << header << endl << seq << endl << mid << endl << qual << endl;
-	else
-	  err_out << header.substr(0,header.find("error")) << endl << seq << endl << mid << endl << qual << endl;
+  for(unsigned int c = 0; c < chunkfs.size(); c++) {
+    if(stat(chunkfs[c].c_str(), &st_file_info) != 0) {
+      cerr << "Missing output chunk " << chunkfs[c] << endl;
+      exit(EXIT_FAILURE);
+    }
+    unsigned long long length = st_file_info.st_size;
+
+    if(bgzf_output) {
+      // rebase the chunk's read index
+      vector<unsigned long long> chunk_reads;
+      vector<unsigned long long> chunk_offsets;
+      if(!load_read_index(chunkfs[c], chunk_reads, chunk_offsets)) {
+	cerr << "Missing read index for output chunk " << chunkfs[c] << endl;
+	exit(EXIT_FAILURE);
+      }
+      for(unsigned int e = 0; e+1 < chunk_reads.size(); e++) {
+	index_reads.push_back(read_base + chunk_reads[e]);
+	index_offsets.push_back(((byte_base + (chunk_offsets[e] >> 16)) << 16) | (chunk_offsets[e] & 0xffff));
       }
-      tc_out.close();
-      remove(tc_file.c_str());
+      read_base += chunk_reads.back();
+      remove((chunkfs[c] + ".ridx").c_str());
+
+      // drop the EOF block
+      if(c+1 < chunkfs.size())
+	length -= bgzf_eof_size;
     }
+
+    append_file(out_fd, chunkfs[c], length);
+    byte_base += length;
+    remove(chunkfs[c].c_str());
+  }
+  close(out_fd);
+
+  if(bgzf_output) {
+    string indexf = outf + ".ridx";
+    ofstream index_out(indexf.c_str());
+    for(unsigned int e = 0; e < index_reads.size(); e++)
+      index_out << index_reads[e] << "\t" << index_offsets[e] << "\n";
+    index_out << read_base << "\t" << ((byte_base - bgzf_eof_size) << 16) << "\n";
+    index_out.close();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// chunk_files
+//
+// Return the chunk files in 'out_dir', named by the number of the first read
+// index entry they hold plus the extension 'ext', in order.
+////////////////////////////////////////////////////////////////////////////////
+static vector<string> chunk_files(string out_dir, string ext) {
+  vector< pair<unsigned long, string> > chunks;
+  DIR * dir = opendir(out_dir.c_str());
+  if(dir != NULL) {
+    struct dirent * entry;
+    while((entry = readdir(dir)) != NULL) {
+      string name(entry->d_name);
+      size_t digits = name.find_first_not_of("0123456789");
+      if(digits == 0)
+	continue;
+      string name_ext = (digits == string::npos) ? string("") : name.substr(digits);
+      if(name_ext != ext)
+	continue;
+      chunks.push_back(make_pair(strtoul(name.c_str(), NULL, 10), out_dir + "/" + name));
+    }
+    closedir(dir);
+  }
+  sort(chunks.begin(), chunks.end());
+
+  vector<string> chunkfs;
+  for(unsigned int c = 0; c < chunks.size(); c++)
+    chunkfs.push_back(chunks[c].second);
+  return chunkfs;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// chunk_line_reader
+//
+// Read lines from a list of chunk files in turn, removing each once read.
+////////////////////////////////////////////////////////////////////////////////
+class chunk_line_reader {
+public:
+  chunk_line_reader(vector<string> & _chunkfs)
+    :chunkfs(_chunkfs) {
+    c = 0;
+    if(!chunkfs.empty())
+      in.open(chunkfs[0].c_str());
+  }
+
+  bool getline(string & line) {
+    while(c < chunkfs.size()) {
+      if(std::getline(in, line))
+	return true;
+      in.close();
+      in.clear();
+      remove(chunkfs[c].c_str());
+      if(++c < chunkfs.size())
+	in.open(chunkfs[c].c_str());
+    }
+    return false;
+  }
+
+private:
+  vector<string> chunkfs;
+  unsigned int c;
+  ifstream in;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// combine_logs
+//
+// Combine log files that may be in out_dir into a single log file named
+// using fqf.
+////////////////////////////////////////////////////////////////////////////////
+void combine_logs(string fqf, string out_dir) {
+  vector<string> logfs = chunk_files(out_dir, ".log");
+  if(!logfs.empty()) {
+    string logf = fqf + ".log";
+    int log_fd = open(logf.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(log_fd == -1) {
+      cerr << "Cannot open log file " << logf << endl;
+      exit(EXIT_FAILURE);
+    }
+
+    struct stat st_file_info;
+    for(unsigned int c = 0; c < logfs.size(); c++) {
+      stat(logfs[c].c_str(), &st_file_info);
+      append_file(log_fd, logfs[c], st_file_info.st_size);
+      remove(logfs[c].c_str());
+    }
+    close(log_fd);
   }
 }
 
@@ -218,7 +437,9 @@ void combine_output_stream(ostream & combine_out, ostream & err_out, string out_
 ////////////////////////////////////////////////////////////////////////////////
 // combine_output
 //
-// Combine output files in 'out_dir' into a single file and remove 'out_dir'
+// Combine output files in 'out_dir' into a single file and remove 'out_dir'.
+// Chunk <t> holds the reads to output and chunk <t>.err the error reads, so
+// the files are concatenated as they are.
 ////////////////////////////////////////////////////////////////////////////////
 void combine_output(string fqf, string mid_ext, bool uncorrected_out) {
   // format output directory
@@ -236,37 +457,17 @@ void combine_output(string fqf, string mid_ext, bool uncorrected_out) {
     suffix = fqf.substr(suffix_index, fqf.size()-suffix_index);
   }
 
-  string outf;
-  string errf;
-  if(zip_output) {
-    // zipped
-    outf = prefix + mid_ext + suffix + ".gz";
-    ogzstream combine_out(outf.c_str());    
-    ogzstream err_out;
-    if(uncorrected_out) {
-      errf = prefix + "err" + suffix + ".gz";
-      err_out.open(errf.c_str());
-    }
-    combine_output_stream(combine_out, err_out, out_dir);
-    combine_out.close();
-    err_out.close();
-  } else {
-    // normal
-    outf = prefix + mid_ext + suffix;
-    ofstream combine_out(outf.c_str());
-    ofstream err_out;
-    if(uncorrected_out) {
-      errf = prefix + "err" + suffix;
-      err_out.open(errf.c_str());
-    }
-    combine_output_stream(combine_out, err_out, out_dir);
-    combine_out.close();
-    err_out.close();
+  string zip_ext = zip_output ? ".gz" : "";
+  vector<string> chunkfs = chunk_files(out_dir, zip_ext);
+  concatenate_output(chunkfs, prefix + mid_ext + suffix);
+  if(uncorrected_out) {
+    vector<string> err_chunkfs = chunk_files(out_dir, ".err" + zip_ext);
+    concatenate_output(err_chunkfs, prefix + "err" + suffix);
   }
 
   // log
   combine_logs(fqf, out_dir);
-    
+
   // remove output directory
   rmdir(out_dir.c_str());
 }
@@ -282,72 +483,59 @@ void combine_output_paired_stream(string fqf1, string fqf2, ostream & pair_out1,
   string path_suffix2 = split(fqf2, '/').back();
   string out_dir2("."+path_suffix2);
 
+  // chunks may be split differently for each mate, so
+  // read through them all in turn
+  vector<string> chunkfs1 = chunk_files(out_dir1, "");
+  vector<string> chunkfs2 = chunk_files(out_dir2, "");
+  chunk_line_reader tc_out1(chunkfs1);
+  chunk_line_reader tc_out2(chunkfs2);
+
   string header1, seq1, mid1, qual1, header2, seq2, mid2, qual2;
-  struct stat st_file_info;
-  for(int t = 0; t < threads*chunks_per_thread; t++) {
-    // format thread-chunk output files
-    string tc_file1(out_dir1+"/");
-    stringstream tc_convert1;
-    tc_convert1 << t;
-    tc_file1 += tc_convert1.str();
-
-    string tc_file2(out_dir2+"/");
-    stringstream tc_convert2;
-    tc_convert2 << t;
-    tc_file2 += tc_convert2.str();
-
-    // if file exists, both must
-    if(stat(tc_file1.c_str(), &st_file_info) == 0) {
-      ifstream tc_out1(tc_file1.c_str());
-      ifstream tc_out2(tc_file2.c_str());
-     
-      while(getline(tc_out1, header1)) {
-	// get read1
-	getline(tc_out1, seq1);
-	getline(tc_out1, mid1);
-	getline(tc_out1, qual1);
-
-	// get read2
-	if(!getline(tc_out2, header2)) {
-	  cerr << "Uneven number of reads in paired end read files " << tc_file1.c_str() << " and " << tc_file2.c_str() << endl;
-	  exit(EXIT_FAILURE);
-	}	
-	getline(tc_out2, seq2);
-	getline(tc_out2, mid2);
-	getline(tc_out2, qual2);
-
-	if(header1.find("error") == -1) {
-	  if(header2.find("error") == -1) {
-	    // no errors
-	    pair_out1 << header1 << endl << seq1 << endl << mid1 << endl << qual1 << endl;
-	    pair_out2 << header2 << endl << seq2 << endl << mid2 << endl << qual2 << endl;
-	  } else {
-	    // error in 2	    
-	    single_out1 << header1 << endl << seq1 << endl << mid1 << endl << qual1 << endl;
-	    if(single_err_out2.good())
-	      single_err_out2 << header2.substr(0,header2.find("error")) << endl << seq2 << endl << mid2 << endl << qual2 << endl;
-	  }
-	} else {
-	  if(header2.find("error") == -1) {
-	    // error in 1
-	    if(single_err_out1.good())
-	      single_err_out1 << header1.substr(0,header1.find("error")) << endl << seq1 << endl << mid1 << endl << qual1 << endl;
-	    single_out2 << header2 << endl << seq2 << endl << mid2 << endl << qual2 << endl;
-	  } else {
-	    // error in 1,2
-	    if(err_out1.good()) {
-	      err_out1 << header1.substr(0,header1.find("error")) << endl << seq1 << endl << mid1 << endl << qual1 << endl;
-	      err_out2 << header2.substr(0,header2.find("error")) << endl << seq2 << endl << mid2 << endl << qual2 << endl;
-	    }
-	  }
+  while(tc_out1.getline(header1)) {
+    // get read1
+    tc_out1.getline(seq1);
+    tc_out1.getline(mid1);
+    tc_out1.getline(qual1);
+
+    // get read2
+    if(!tc_out2.getline(header2)) {
+      cerr << "Uneven number of reads in paired end read files " << fqf1 << " and " << fqf2 << endl;
+      exit(EXIT_FAILURE);
+    }
+    tc_out2.getline(seq2);
+    tc_out2.getline(mid2);
+    tc_out2.getline(qual2);
+
+    if(header1.find("error") == -1) {
+      if(header2.find("error") == -1) {
+	// no errors
+	pair_out1 << header1 << endl << seq1 << endl << mid1 << endl << qual1 << endl;
+	pair_out2 << header2 << endl << seq2 << endl << mid2 << endl << qual2 << endl;
+      } else {
+	// error in 2
+	single_out1 << header1 << endl << seq1 << endl << mid1 << endl << qual1 << endl;
+	if(single_err_out2.good())
+	  single_err_out2 << header2.substr(0,header2.find("error")) << endl << seq2 << endl << mid2 << endl << qual2 << endl;
+      }
+    } else {
+      if(header2.find("error") == -1) {
+	// error in 1
+	if(single_err_out1.good())
+	  single_err_out1 << header1.substr(0,header1.find("error")) << endl << seq1 << endl << mid1 << endl << qual1 << endl;
+	single_out2 << header2 << endl << seq2 << endl << mid2 << endl << qual2 << endl;
+      } else {
+	// error in 1,2
+	if(err_out1.good()) {
+	  err_out1 << header1.substr(0,header1.find("error")) << endl << seq1 << endl << mid1 << endl << qual1 << endl;
+	  err_out2 << header2.substr(0,header2.find("error")) << endl << seq2 << endl << mid2 << endl << qual2 << endl;
 	}
       }
-      tc_out1.close();
-      tc_out2.close();
-      remove(tc_file1.c_str());
-      remove(tc_file2.c_str());
     }
   }
+  if(tc_out2.getline(header2)) {
+    cerr << "Uneven number of reads in paired end read files " << fqf1 << " and " << fqf2 << endl;
+    exit(EXIT_FAILURE);
+  }
 
   // logs
   combine_logs(fqf1, out_dir1);
@@ -367,220 +555,403 @@ void combine_output_paired_stream(string fqf1, string fqf2, ostream & pair_out1,
 void combine_output_paired(string fqf1, string fqf2, string mid_ext, bool uncorrected_out) {
   string prefix, suffix;
 
-  if(zip_output) {
-    // format output pair file1
-    int suffix_index = fqf1.rfind(".");
-    if(suffix_index == -1) {
-      prefix = fqf1+".";
-      suffix = "";
-    } else {
-      prefix = fqf1.substr(0,suffix_index+1);
-      suffix = fqf1.substr(suffix_index, fqf1.size()-suffix_index);
-    }
-    string outf = prefix + mid_ext + suffix + ".gz";
-    ogzstream pair_out1(outf.c_str());
-	      
-    // and single file1
-    outf = prefix + mid_ext + "_single" + suffix + ".gz";
-    ogzstream single_out1(outf.c_str());
-
-    // and error file1
-    ogzstream single_err_out1;
-    ogzstream err_out1;
-    if(uncorrected_out) {
-      outf = prefix + "err_single" + suffix + ".gz";
-      single_err_out1.open(outf.c_str());
-      outf = prefix + "err" + suffix + ".gz";
-      err_out1.open(outf.c_str());
-    }
-    
-    // format output pair file2
-    suffix_index = fqf2.rfind(".");
-    if(suffix_index == -1) {
-      prefix = fqf2+".";
-      suffix = "";
-    } else {
-      prefix = fqf2.substr(0,suffix_index+1);
-      suffix = fqf2.substr(suffix_index, fqf2.size()-suffix_index);
-    }
-    outf = prefix + mid_ext + suffix + ".gz";
-    ogzstream pair_out2(outf.c_str());
-
-    // and single file2
-    outf = prefix + mid_ext + "_single" + suffix + ".gz";
-    ogzstream single_out2(outf.c_str());    
-
-    // and error file1
-    ogzstream single_err_out2;
-    ogzstream err_out2;
-    if(uncorrected_out) {
-      outf = prefix + "err_single" + suffix + ".gz";
-      single_err_out2.open(outf.c_str());
-      outf = prefix + "err" + suffix + ".gz";
-      err_out2.open(outf.c_str());
-    }
+  // format output pair file1
+  int suffix_index = fqf1.rfind(".");
+  if(suffix_index == -1) {
+    prefix = fqf1+".";
+    suffix = "";
+  } else {
+    prefix = fqf1.substr(0,suffix_index+1);
+    suffix = fqf1.substr(suffix_index, fqf1.size()-suffix_index);
+  }
+  ostream * pair_out1 = open_output(prefix + mid_ext + suffix);
 
-    combine_output_paired_stream(fqf1, fqf2, pair_out1, single_out1, single_err_out1, err_out1, pair_out2, single_out2, single_err_out2, err_out2);
+  // and single file1
+  ostream * single_out1 = open_output(prefix + mid_ext + "_single" + suffix);
 
-    pair_out1.close();
-    pair_out2.close();
-    single_out1.close();
-    single_out2.close();
-  
+  // and error file1
+  ostream * single_err_out1;
+  ostream * err_out1;
+  if(uncorrected_out) {
+    single_err_out1 = open_output(prefix + "err_single" + suffix);
+    err_out1 = open_output(prefix + "err" + suffix);
   } else {
-    // format output pair file1
-    int suffix_index = fqf1.rfind(".");
-    if(suffix_index == -1) {
-      prefix = fqf1+".";
-      suffix = "";
-    } else {
-      prefix = fqf1.substr(0,suffix_index+1);
-      suffix = fqf1.substr(suffix_index, fqf1.size()-suffix_index);
-    }
-    string outf = prefix + mid_ext + suffix;
-    ofstream pair_out1(outf.c_str());
-    
-    // and single file1
-    outf = prefix + mid_ext + "_single" + suffix;
-    ofstream single_out1(outf.c_str());
-
-    // and error file1
-    ofstream single_err_out1;
-    ofstream err_out1;
-    if(uncorrected_out) {
-      outf = prefix + "err_single" + suffix;
-      single_err_out1.open(outf.c_str());
-      outf = prefix + "err" + suffix;
-      err_out1.open(outf.c_str());
-    }
-    
-    // format output pair file2
-    suffix_index = fqf2.rfind(".");
-    if(suffix_index == -1) {
-      prefix = fqf1+".";
-      suffix = "";
-    } else {
-      prefix = fqf2.substr(0,suffix_index+1);
-      suffix = fqf2.substr(suffix_index, fqf2.size()-suffix_index);
-    }
-    outf = prefix + mid_ext + suffix;
-    ofstream pair_out2(outf.c_str());
-
-    // and single file2
-    outf = prefix + mid_ext + "_single" + suffix;
-    ofstream single_out2(outf.c_str());
-
-    // and error file2
-    ofstream single_err_out2;
-    ofstream err_out2;    
-    if(uncorrected_out) {
-      outf = prefix + "err_single" + suffix;
-      single_err_out2.open(outf.c_str());
-      outf = prefix + "err" + suffix;
-      err_out2.open(outf.c_str());
-    }
+    single_err_out1 = new ofstream();
+    err_out1 = new ofstream();
+  }
 
-    combine_output_paired_stream(fqf1, fqf2, pair_out1, single_out1, single_err_out1, err_out1, pair_out2, single_out2, single_err_out2, err_out2);
-    
-    pair_out1.close();
-    pair_out2.close();
-    single_out1.close();
-    single_out2.close();
+  // format output pair file2
+  suffix_index = fqf2.rfind(".");
+  if(suffix_index == -1) {
+    prefix = fqf2+".";
+    suffix = "";
+  } else {
+    prefix = fqf2.substr(0,suffix_index+1);
+    suffix = fqf2.substr(suffix_index, fqf2.size()-suffix_index);
   }
+  ostream * pair_out2 = open_output(prefix + mid_ext + suffix);
+
+  // and single file2
+  ostream * single_out2 = open_output(prefix + mid_ext + "_single" + suffix);
+
+  // and error file2
+  ostream * single_err_out2;
+  ostream * err_out2;
+  if(uncorrected_out) {
+    single_err_out2 = open_output(prefix + "err_single" + suffix);
+    err_out2 = open_output(prefix + "err" + suffix);
+  } else {
+    single_err_out2 = new ofstream();
+    err_out2 = new ofstream();
+  }
+
+  combine_output_paired_stream(fqf1, fqf2, *pair_out1, *single_out1, *single_err_out1, *err_out1, *pair_out2, *single_out2, *single_err_out2, *err_out2);
+
+  delete pair_out1;
+  delete single_out1;
+  delete single_err_out1;
+  delete err_out1;
+  delete pair_out2;
+  delete single_out2;
+  delete single_err_out2;
+  delete err_out2;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// chunkify_fastq
+// keep_pairs_whole
 //
-// Determine start points and sequence counts for all
-// chunks to be processed in parallel.
+// Drop the entries of the read index of the interleaved paired end read file
+// 'fqf' that would split a pair.
 ////////////////////////////////////////////////////////////////////////////////
-void chunkify_fastq(string fqf, vector<streampos> & starts, vector<unsigned long long> & counts) {
-  // count number of sequences
-  unsigned long long N = 0;
-  ifstream reads_in(fqf.c_str());
-  string toss;
-  while(getline(reads_in, toss))
-    N++;
-  reads_in.close();
-  N /= 4ULL;
-
-  if(threads*chunks_per_thread > N) {
-    // use 1 thread for everything
-    counts.push_back(N);
-    starts.push_back(0);   
-    omp_set_num_threads(1);
+static void keep_pairs_whole(string fqf, fastq_index & index) {
+  if(index.reads.back() % 2 != 0) {
+    cerr << "Odd number of reads in interleaved paired end read file " << fqf << endl;
+    exit(EXIT_FAILURE);
+  }
 
-  } else {
-    // determine counts per thread
-    unsigned long long sum = 0;
-    for(int i = 0; i < threads*chunks_per_thread-1; i++) {
-      counts.push_back(N / (threads*chunks_per_thread));
-      sum += counts.back();
+  unsigned int kept = 0;
+  for(unsigned int e = 0; e < index.reads.size(); e++) {
+    if(index.reads[e] % 2 == 0) {
+      index.reads[kept] = index.reads[e];
+      index.offsets[kept] = index.offsets[e];
+      kept++;
     }
-    counts.push_back(N - sum);
-
-    // find start points
-    reads_in.open(fqf.c_str());
-    starts.push_back(reads_in.tellg());
-    unsigned long long s = 0;
-    unsigned int t = 0;
-    while(getline(reads_in,toss)) {
-      // sequence
-      getline(reads_in, toss);
-      // +
-      getline(reads_in, toss);
-      // quality
-      getline(reads_in, toss);
-      
-      if(++s == counts[t] && t < counts.size()-1) {
-	starts.push_back(reads_in.tellg());
-	s = 0;
-	t++;
+  }
+  index.reads.resize(kept);
+  index.offsets.resize(kept);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// load_chunk_index
+//
+// Load the read index and detected quality value scale of 'fqf' from its
+// chunk index <fqf>.cidx, if it exists and the file's size and modification
+// time still match it.
+////////////////////////////////////////////////////////////////////////////////
+static bool load_chunk_index(string fqf, vector<unsigned long long> & index_reads, vector<unsigned long long> & index_offsets, int & quality_scale) {
+  struct stat st_file_info;
+  if(stat(fqf.c_str(), &st_file_info) != 0)
+    return false;
+
+  string indexf = fqf + ".cidx";
+  ifstream index_in(indexf.c_str());
+  if(!index_in.good())
+    return false;
+
+  string magic, size_tag, mtime_tag, scale_tag;
+  unsigned long long size, mtime;
+  index_in >> magic >> size_tag >> size >> mtime_tag >> mtime >> scale_tag >> quality_scale;
+  if(!index_in.good() || magic != "quake_chunk_index" || size != (unsigned long long)st_file_info.st_size || mtime != (unsigned long long)st_file_info.st_mtime)
+    return false;
+
+  index_reads.clear();
+  index_offsets.clear();
+  unsigned long long r, o;
+  while(index_in >> r >> o) {
+    index_reads.push_back(r);
+    index_offsets.push_back(o);
+  }
+
+  // last entry marks the end of the file
+  return (!index_reads.empty() && index_offsets.back() == size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// save_chunk_index
+//
+// Save the read index and detected quality value scale of 'fqf' with its
+// size and modification time to <fqf>.cidx.
+////////////////////////////////////////////////////////////////////////////////
+static void save_chunk_index(string fqf, vector<unsigned long long> & index_reads, vector<unsigned long long> & index_offsets, int quality_scale) {
+  struct stat st_file_info;
+  if(stat(fqf.c_str(), &st_file_info) != 0)
+    return;
+
+  string indexf = fqf + ".cidx";
+  ofstream index_out(indexf.c_str());
+  if(!index_out.good()) {
+    cerr << "Cannot write chunk index " << indexf << endl;
+    return;
+  }
+
+  index_out << "quake_chunk_index" << endl;
+  index_out << "size\t" << (unsigned long long)st_file_info.st_size << endl;
+  index_out << "mtime\t" << (unsigned long long)st_file_info.st_mtime << endl;
+  index_out << "quality_scale\t" << quality_scale << endl;
+  for(unsigned int e = 0; e < index_reads.size(); e++)
+    index_out << index_reads[e] << "\t" << index_offsets[e] << endl;
+  index_out.close();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// sync_fastq
+//
+// Return the offset of the first record starting at or after byte 'pos', or
+// 'size' if there is none.  A record starts on a line beginning with '@'
+// whose line after next begins with '+'; a quality line beginning with '@'
+// is followed two lines later by a sequence, so it is never mistaken.
+////////////////////////////////////////////////////////////////////////////////
+static unsigned long long sync_fastq(fastq_reader & reads, unsigned long long pos, unsigned long long size) {
+  str_view line;
+  if(pos > 0) {
+    // skip to the start of the next line
+    reads.seek(streampos(streamoff(pos-1)));
+    if(!reads.next_line(line))
+      return size;
+  } else
+    reads.seek(0);
+
+  // slide a window of three lines
+  unsigned long long line_pos[3];
+  char line_start[3];
+  for(int l = 0; l < 3; l++) {
+    line_pos[l] = (unsigned long long)(streamoff)reads.tell();
+    if(line_pos[l] >= size || !reads.next_line(line))
+      return size;
+    line_start[l] = (line.len > 0) ? line.s[0] : 0;
+  }
+
+  while(line_start[0] != '@' || line_start[2] != '+') {
+    line_pos[0] = line_pos[1];
+    line_pos[1] = line_pos[2];
+    line_start[0] = line_start[1];
+    line_start[1] = line_start[2];
+    line_pos[2] = (unsigned long long)(streamoff)reads.tell();
+    if(line_pos[2] >= size || !reads.next_line(line))
+      return size;
+    line_start[2] = (line.len > 0) ? line.s[0] : 0;
+  }
+  return line_pos[0];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// index_fastq
+//
+// Index the offset of every read_index_interval'th read in the uncompressed
+// fastq file 'fqf' in parallel.  The file is split into a byte range per
+// thread, each range is synchronized to its first record, and the threads
+// count their range's reads and then, knowing the reads before their range,
+// record the indexed offsets in it.
+////////////////////////////////////////////////////////////////////////////////
+static void index_fastq(string fqf, vector<unsigned long long> & index_reads, vector<unsigned long long> & index_offsets) {
+  struct stat st_file_info;
+  if(stat(fqf.c_str(), &st_file_info) != 0) {
+    cerr << "Cannot open fastq file " << fqf << endl;
+    exit(EXIT_FAILURE);
+  }
+  unsigned long long size = st_file_info.st_size;
+
+  int ranges = threads;
+  vector<unsigned long long> range_starts(threads+1, size);
+  vector<unsigned long long> range_reads(threads+1, 0);
+  vector< vector<unsigned long long> > range_index_reads(threads);
+  vector< vector<unsigned long long> > range_index_offsets(threads);
+
+#pragma omp parallel num_threads(threads)
+  {
+#pragma omp single
+    ranges = omp_get_num_threads();
+
+    int r = omp_get_thread_num();
+    ifstream reads_in(fqf.c_str());
+    fastq_reader reads(&reads_in);
+    fastq_record rec;
+
+    // synchronize
+    if(r == 0)
+      range_starts[r] = 0;
+    else
+      range_starts[r] = sync_fastq(reads, size * r / ranges, size);
+#pragma omp barrier
+
+    // count
+    unsigned long long range_end = range_starts[r+1];
+    reads.seek(streampos(streamoff(range_starts[r])));
+    unsigned long long n = 0;
+    while((unsigned long long)(streamoff)reads.tell() < range_end && reads.next(rec))
+      n++;
+    range_reads[r+1] = n;
+#pragma omp barrier
+
+    // index
+    unsigned long long read = 0;
+    for(int rr = 0; rr <= r; rr++)
+      read += range_reads[rr];
+    reads.seek(streampos(streamoff(range_starts[r])));
+    unsigned long long pos = range_starts[r];
+    while(pos < range_end) {
+      if(read % read_index_interval == 0) {
+	range_index_reads[r].push_back(read);
+	range_index_offsets[r].push_back(pos);
       }
-      
-      // set up parallelism
-      omp_set_num_threads(threads);
+      if(!reads.next(rec))
+	break;
+      read++;
+      pos = (unsigned long long)(streamoff)reads.tell();
     }
   }
+
+  index_reads.clear();
+  index_offsets.clear();
+  unsigned long long N = 0;
+  for(int r = 0; r < ranges; r++) {
+    index_reads.insert(index_reads.end(), range_index_reads[r].begin(), range_index_reads[r].end());
+    index_offsets.insert(index_offsets.end(), range_index_offsets[r].begin(), range_index_offsets[r].end());
+    N += range_reads[r+1];
+  }
+  if(index_reads.empty() || index_reads[0] != 0) {
+    // no reads
+    index_reads.insert(index_reads.begin(), 0);
+    index_offsets.insert(index_offsets.begin(), 0);
+  }
+
+  // mark the end
+  index_reads.push_back(N);
+  index_offsets.push_back(size);
 }
 
 
 ////////////////////////////////////////////////////////////
-// guess_quality_scale
+// guess_scale
 //
 // Guess at ascii scale of quality values by examining
 // a bunch of reads and looking for quality values < 64,
-// in which case we set it to 33.
+// in which case it's 33.
 //
-// Assuming the file is unzipped.
+// Assuming the file is unzipped or an indexed BGZF file.
 ////////////////////////////////////////////////////////////
-void guess_quality_scale(string fqf) {
-  string header, seq, mid, strqual;
+static int guess_scale(string fqf) {
   int reads_to_check = 10000;
   int reads_checked = 0;
-  ifstream reads_in(fqf.c_str());
-  while(getline(reads_in, header)) {
-    getline(reads_in, seq);
-    getline(reads_in, mid);
-    getline(reads_in, strqual);
-    
-    for(int i = 0; i < strqual.size(); i++) {
-      if(strqual[i] < 64) {
-	cerr << "Guessing quality values are on ascii 33 scale" << endl;
-	Read::quality_scale = 33;
-	reads_in.close();
-	return;
+  istream * reads_in = open_fastq(fqf);
+  fastq_reader reads(reads_in);
+  fastq_record rec;
+  while(reads.next(rec)) {
+    for(int i = 0; i < rec.qual.len; i++) {
+      if(rec.qual.s[i] < 64) {
+	delete reads_in;
+	return 33;
       }
     }
 
     if(++reads_checked >= reads_to_check)
       break;
   }
-  reads_in.close();
-  cerr << "Guessing quality values are on ascii 64 scale" << endl;
-  Read::quality_scale = 64;
+  delete reads_in;
+  return 64;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// index_fastq_file
+//
+// Load the read index of 'fqf', whose entries are split among threads to
+// process it in parallel.  BGZF files have their read index, and other files
+// their chunk index, which is made and saved if it's missing or stale, with
+// the ascii scale of quality values 'quality_scale', or if it's -1, a guess.
+////////////////////////////////////////////////////////////////////////////////
+void index_fastq_file(string fqf, fastq_index & index, int quality_scale) {
+  unsigned long long bytes;
+  if(bgzf_indexed(fqf)) {
+    if(!load_read_index(fqf, index.reads, index.offsets)) {
+      cerr << "Failed to load read index for " << fqf << endl;
+      exit(EXIT_FAILURE);
+    }
+    bytes = index.offsets.back() >> 16;
+
+  } else {
+    int saved_scale;
+    if(!load_chunk_index(fqf, index.reads, index.offsets, saved_scale)) {
+      index_fastq(fqf, index.reads, index.offsets);
+      if(quality_scale == -1)
+	quality_scale = guess_scale(fqf);
+      save_chunk_index(fqf, index.reads, index.offsets, quality_scale);
+    }
+    bytes = index.offsets.back();
+  }
+
+  // keep interleaved pairs in the same task
+  if(interleaved)
+    keep_pairs_whole(fqf, index);
+
+  index.entry_bytes = (double)bytes / index.entries();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// align_pair_indexes
+//
+// Keep only the entries of the read indexes of the paired end read files
+// 'fqf1' and 'fqf2' that start at the same read in both, so the mates of a
+// task match.
+////////////////////////////////////////////////////////////////////////////////
+void align_pair_indexes(string fqf1, fastq_index & index1, string fqf2, fastq_index & index2) {
+  if(index1.reads.back() != index2.reads.back()) {
+    cerr << "Uneven number of reads in paired end read files " << fqf1 << " and " << fqf2 << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  fastq_index aligned1, aligned2;
+  unsigned int e2 = 0;
+  for(unsigned int e1 = 0; e1 < index1.reads.size(); e1++) {
+    while(e2 < index2.reads.size() && index2.reads[e2] < index1.reads[e1])
+      e2++;
+    if(e2 < index2.reads.size() && index2.reads[e2] == index1.reads[e1]) {
+      aligned1.reads.push_back(index1.reads[e1]);
+      aligned1.offsets.push_back(index1.offsets[e1]);
+      aligned2.reads.push_back(index2.reads[e2]);
+      aligned2.offsets.push_back(index2.offsets[e2]);
+    }
+  }
+  aligned1.entry_bytes = index1.entry_bytes * index1.entries() / aligned1.entries();
+  aligned2.entry_bytes = index2.entry_bytes * index2.entries() / aligned2.entries();
+  index1 = aligned1;
+  index2 = aligned2;
+}
+
+
+////////////////////////////////////////////////////////////
+// guess_quality_scale
+//
+// Set the ascii scale of quality values to the one saved
+// in the file's chunk index, or else guess it.
+////////////////////////////////////////////////////////////
+void guess_quality_scale(string fqf) {
+  vector<unsigned long long> index_reads;
+  vector<unsigned long long> index_offsets;
+  int quality_scale;
+  if(!bgzf_indexed(fqf) && load_chunk_index(fqf, index_reads, index_offsets, quality_scale))
+    cerr << "Quality values are on ascii " << quality_scale << " scale, loaded from chunk index" << endl;
+  else {
+    quality_scale = guess_scale(fqf);
+    cerr << "Guessing quality values are on ascii " << quality_scale << " scale" << endl;
+  }
+  Read::quality_scale = quality_scale;
 }
 
 
@@ -631,13 +1002,13 @@ vector<string> parse_fastq(vector<string> & fastqfs, vector<int> & pairedend_cod
 // Removes affected untrusted k-mers.
 // Returns the trimmed length.
 ////////////////////////////////////////////////////////////////////////////////
-int quick_trim(string strqual, vector<int> & untrusted) {
+int quick_trim(const char * strqual, int len, vector<int> & untrusted) {
   // find trim index
   int phredq;
   int current_trimfunc = 0;
   int max_trimfunc = 0;
-  int trim_length = strqual.size();
-  for(int i = strqual.size()-1; i >= 0; i--) {
+  int trim_length = len;
+  for(int i = len-1; i >= 0; i--) {
     //phredq = floor(.5-10*log(1.0 - prob[i])/log(10));
     phredq = strqual[i] - Read::quality_scale;
     current_trimfunc += (trimq - phredq);
@@ -13,21 +13,44 @@ using namespace::std;
 extern char* fastqf;
 extern char* file_of_fastqf;
 extern bool zip_output;
+extern bool bgzf_output;
+extern bool interleaved;
 extern int threads;
-extern unsigned int chunks_per_thread;
 extern int trimq;
 
+////////////////////////////////////////////////////////////////////////////////
+// fastq_index
+//
+// Read index of a fastq file: the number of reads before, and the offset of,
+// every so many reads, ending with the total at the end of the file.  The
+// entries are the units of work handed out by the task_scheduler.
+////////////////////////////////////////////////////////////////////////////////
+struct fastq_index {
+  vector<unsigned long long> reads;
+  vector<unsigned long long> offsets;
+  double entry_bytes;  // average input bytes per entry
+
+  unsigned int entries() const { return reads.size() - 1; }
+  streampos start(unsigned int e) const { return streampos(streamoff(offsets[e])); }
+  unsigned long long count(unsigned int b, unsigned int e) const { return reads[e] - reads[b]; }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // methods
 ////////////////////////////////////////////////////////////////////////////////
 void combine_output(string fqf, string mid_ext, bool uncorrected_out);
 void combine_output_paired(string fqf1, string fqf2, string mid_ext, bool uncorrected_out);
-void chunkify_fastq(string fqf, vector<streampos> & starts, vector<unsigned long long> & counts);
+void index_fastq_file(string fqf, fastq_index & index, int quality_scale);
+void align_pair_indexes(string fqf1, fastq_index & index1, string fqf2, fastq_index & index2);
 void guess_quality_scale(string fqf);
 vector<string> parse_fastq(vector<string> & fastqfs, vector<int> & pairedend_codes);
 void unzip_fastq(string & fqf);
+string strip_gz(string fqf);
+bool bgzf_indexed(string fqf);
+istream * open_fastq(string fqf);
+ostream * open_output(string outf);
 void zip_fastq(string fqf);
 vector<string> split(string s, char c);
 vector<string> split(string);
-int quick_trim(string strqual, vector<int> & untrusted);
+int quick_trim(const char * strqual, int len, vector<int> & untrusted);
 #endif
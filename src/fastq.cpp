@@ -0,0 +1,273 @@
+#include "fastq.h"
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// fastq_reader (constructors)
+////////////////////////////////////////////////////////////////////////////////
+fastq_reader::fastq_reader(istream * _in, unsigned int block_size) {
+  in = _in;
+  fp = NULL;
+  init(block_size);
+}
+
+fastq_reader::fastq_reader(FILE * _fp, unsigned int block_size) {
+  in = NULL;
+  fp = _fp;
+  init(block_size);
+}
+
+void fastq_reader::init(unsigned int block_size) {
+  buf_size = block_size;
+  buf = (char*)malloc(buf_size);
+  if(buf == NULL) {
+    cerr << "Failed to allocate fastq read buffer" << endl;
+    exit(EXIT_FAILURE);
+  }
+  begin = 0;
+  end = 0;
+  buf_offset = 0;
+  at_eof = false;
+  seconds = 0;
+}
+
+fastq_reader::~fastq_reader() {
+  free(buf);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// seek
+//
+// Position the input at 'pos' and drop the buffer.
+////////////////////////////////////////////////////////////////////////////////
+void fastq_reader::seek(streampos pos) {
+  if(in != NULL) {
+    in->clear();
+    in->seekg(pos);
+  } else
+    fseeko(fp, (off_t)(streamoff)pos, SEEK_SET);
+
+  begin = 0;
+  end = 0;
+  buf_offset = (streamoff)pos;
+  at_eof = false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// fill
+//
+// Move the unread data to the front of the buffer, growing it if the unread
+// data fills it, and read another block after it.
+////////////////////////////////////////////////////////////////////////////////
+void fastq_reader::fill() {
+  if(begin > 0) {
+    memmove(buf, buf+begin, end-begin);
+    buf_offset += begin;
+    end -= begin;
+    begin = 0;
+  }
+
+  if(end == buf_size) {
+    buf_size *= 2;
+    buf = (char*)realloc(buf, buf_size);
+    if(buf == NULL) {
+      cerr << "Failed to allocate fastq read buffer" << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  double start = omp_get_wtime();
+  size_t n;
+  if(in != NULL) {
+    in->read(buf+end, buf_size-end);
+    n = in->gcount();
+  } else
+    n = fread(buf+end, 1, buf_size-end, fp);
+  seconds += omp_get_wtime() - start;
+
+  if(n == 0)
+    at_eof = true;
+  end += n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// scan_line
+//
+// Find the line starting at 'pos' in the buffer and advance 'pos' past it.
+// Return false if the line may continue past the data read so far.  At the
+// end of the input, lines past the data are empty as with getline.
+////////////////////////////////////////////////////////////////////////////////
+bool fastq_reader::scan_line(unsigned int & pos, str_view & line) {
+  const char* nl = (const char*)memchr(buf+pos, '\n', end-pos);
+  if(nl != NULL) {
+    line.s = buf+pos;
+    line.len = nl - (buf+pos);
+    pos += line.len + 1;
+    return true;
+  } else if(at_eof) {
+    line.s = buf+pos;
+    line.len = end-pos;
+    pos = end;
+    return true;
+  } else
+    return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// next
+//
+// Read the next four lines into 'rec', returning false at the end of the
+// input.
+////////////////////////////////////////////////////////////////////////////////
+bool fastq_reader::next(fastq_record & rec) {
+  while(true) {
+    if(begin < end) {
+      unsigned int pos = begin;
+      if(scan_line(pos, rec.header) && scan_line(pos, rec.seq) && scan_line(pos, rec.mid) && scan_line(pos, rec.qual)) {
+	begin = pos;
+	return true;
+      }
+    } else if(at_eof)
+      return false;
+
+    fill();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// next_line
+//
+// Read the next line, returning false at the end of the input.
+////////////////////////////////////////////////////////////////////////////////
+bool fastq_reader::next_line(str_view & line) {
+  while(true) {
+    if(begin < end) {
+      unsigned int pos = begin;
+      if(scan_line(pos, line)) {
+	begin = pos;
+	return true;
+      }
+    } else if(at_eof)
+      return false;
+
+    fill();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// fastq_batch
+////////////////////////////////////////////////////////////////////////////////
+void fastq_batch::add(const fastq_record & rec) {
+  add_line(rec.header);
+  add_line(rec.seq);
+  add_line(rec.mid);
+  add_line(rec.qual);
+}
+
+void fastq_batch::add_line(const str_view & v) {
+  starts.push_back(data.size());
+  lens.push_back(v.len);
+  data.append(v.s, v.len);
+}
+
+void fastq_batch::get(unsigned int i, fastq_record & rec) const {
+  get_line(4*i, rec.header);
+  get_line(4*i+1, rec.seq);
+  get_line(4*i+2, rec.mid);
+  get_line(4*i+3, rec.qual);
+}
+
+void fastq_batch::get_line(unsigned int l, str_view & v) const {
+  v.s = data.data() + starts[l];
+  v.len = lens[l];
+}
+
+void fastq_batch::clear() {
+  data.clear();
+  starts.clear();
+  lens.clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// output_buffer (constructor)
+////////////////////////////////////////////////////////////////////////////////
+output_buffer::output_buffer(ostream * _out, unsigned int _flush_size) {
+  out = _out;
+  flush_size = _flush_size;
+  if(out != NULL)
+    buf.reserve(flush_size + (flush_size >> 4));
+}
+
+output_buffer::~output_buffer() {
+  flush();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// append_uint
+//
+// Append the decimal digits of 'x'.
+////////////////////////////////////////////////////////////////////////////////
+void output_buffer::append_uint(unsigned long long x) {
+  char digits[20];
+  int d = 20;
+  do {
+    digits[--d] = '0' + x % 10;
+    x /= 10;
+  } while(x > 0);
+  buf.append(digits+d, 20-d);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// flush
+//
+// Write the buffer to the ostream, if there is one, and empty it.
+////////////////////////////////////////////////////////////////////////////////
+void output_buffer::flush() {
+  if(out != NULL && !buf.empty()) {
+    out->write(buf.data(), buf.size());
+    buf.clear();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// nts_to_codes
+//
+// Convert nucleotides to 0-3 for A, C, G and T, and 4 for anything else, i.e.
+// their index in "ACGTN".  Bits 1 and 2 of the ASCII codes distinguish
+// A (0x41), C (0x43), G (0x47) and T (0x54) once XOR'ed together, and other
+// characters are caught by rebuilding the nucleotide from its code
+// arithmetically, which unlike a comparison with each nucleotide, the
+// compiler vectorizes.  Bytes keep the vectors wide.
+////////////////////////////////////////////////////////////////////////////////
+void nts_to_codes(const char * nts, unsigned int len, unsigned int * codes) {
+  const unsigned char * u = (const unsigned char *)nts;
+  for(unsigned int i = 0; i < len; i++) {
+    unsigned char c = u[i];
+    unsigned char code = ((c >> 1) ^ (c >> 2)) & 3;
+    unsigned char hi = code >> 1;
+    unsigned char nt = 'A' + 2*code + 2*hi + 11*(hi & code);
+    codes[i] = (c == nt) ? code : 4;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// quals_to_ints
+//
+// Convert ASCII quality values to integers.
+////////////////////////////////////////////////////////////////////////////////
+void quals_to_ints(const char * q, unsigned int len, int quality_scale, unsigned int * quals) {
+  for(unsigned int i = 0; i < len; i++)
+    quals[i] = (unsigned int)(q[i] - quality_scale);
+}
@@ -0,0 +1,141 @@
+#ifndef FASTQ_H
+#define FASTQ_H
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace::std;
+
+// bytes read from the input at a time
+const unsigned int fastq_block_size = 1 << 20;
+
+////////////////////////////////////////////////////////////////////////////////
+// str_view
+//
+// A line within a fastq_reader's buffer, without its newline.
+////////////////////////////////////////////////////////////////////////////////
+struct str_view {
+  const char* s;
+  unsigned int len;
+
+  string str() const { return string(s, len); }
+  void assign_to(string & dest) const { dest.assign(s, len); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// fastq_record
+////////////////////////////////////////////////////////////////////////////////
+struct fastq_record {
+  str_view header;
+  str_view seq;
+  str_view mid;
+  str_view qual;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// fastq_reader
+//
+// Buffered fastq reader that reads large blocks from an istream (e.g. an
+// ifstream or ibgzfstream) or a FILE, finds line boundaries with memchr and
+// returns records as views into its buffer rather than copying them.  Views
+// are only valid until the next call to next, next_line or seek.
+//
+// Lines are split exactly as getline would split them, so a record is the
+// next four lines wherever the reader is positioned.  tell returns the
+// stream position of the next line, which for a BGZF stream is meaningless,
+// so only use it on uncompressed files.  fill_seconds returns the time spent
+// reading (and for a compressed stream, inflating) blocks into the buffer.
+////////////////////////////////////////////////////////////////////////////////
+class fastq_reader {
+ public:
+  fastq_reader(istream * _in, unsigned int block_size = fastq_block_size);
+  fastq_reader(FILE * _fp, unsigned int block_size = fastq_block_size);
+  ~fastq_reader();
+  bool next(fastq_record & rec);
+  bool next_line(str_view & line);
+  void seek(streampos pos);
+  streampos tell() const { return streampos(buf_offset + (streamoff)begin); }
+  double fill_seconds() const { return seconds; }
+
+ private:
+  void init(unsigned int block_size);
+  bool scan_line(unsigned int & pos, str_view & line);
+  void fill();
+
+  istream * in;
+  FILE * fp;
+  char * buf;
+  unsigned int buf_size;
+  unsigned int begin;  // start of the next line
+  unsigned int end;    // end of the data read
+  streamoff buf_offset;  // stream position of buf[0]
+  bool at_eof;
+  double seconds;  // spent filling the buffer from the stream
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// fastq_batch
+//
+// Copies of a batch of records, e.g. a chunk held in memory between passes
+// over it.  get returns views into the batch, valid until the next add.
+////////////////////////////////////////////////////////////////////////////////
+class fastq_batch {
+ public:
+  void add(const fastq_record & rec);
+  void get(unsigned int i, fastq_record & rec) const;
+  unsigned int size() const { return lens.size() / 4; }
+  void clear();
+  void swap(fastq_batch & b) { data.swap(b.data); starts.swap(b.starts); lens.swap(b.lens); }
+
+ private:
+  void add_line(const str_view & v);
+  void get_line(unsigned int l, str_view & v) const;
+
+  string data;
+  vector<unsigned int> starts;  // each record's four lines in data
+  vector<unsigned int> lens;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// output_buffer
+//
+// Buffer that records are formatted into by appending bytes, written to an
+// ostream 'out' in large blocks once at least 'flush_size' bytes are held.
+// Without an ostream it simply accumulates, e.g. for a chunk of output to be
+// written later in order.  Nothing is flushed mid-record as long as records
+// are ended with end_record.
+////////////////////////////////////////////////////////////////////////////////
+class output_buffer {
+ public:
+  output_buffer(ostream * _out = NULL, unsigned int _flush_size = fastq_block_size);
+  ~output_buffer();
+  void append(const char * s, unsigned int len) { buf.append(s, len); }
+  void append(const string & s) { buf.append(s); }
+  void append(const str_view & v) { buf.append(v.s, v.len); }
+  void append(const output_buffer & b) { buf.append(b.buf); }
+  void put(char c) { buf.push_back(c); }
+  void append_uint(unsigned long long x);
+  void end_record() { if(out != NULL && buf.size() >= flush_size) flush(); }
+  void flush();
+  void clear() { buf.clear(); }
+  unsigned int size() const { return buf.size(); }
+  const char * data() const { return buf.data(); }
+  char & operator[](unsigned int i) { return buf[i]; }
+
+ private:
+  ostream * out;
+  unsigned int flush_size;
+  string buf;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// conversions
+//
+// Written as simple branch-free loops so the compiler vectorizes them.
+////////////////////////////////////////////////////////////////////////////////
+void nts_to_codes(const char * nts, unsigned int len, unsigned int * codes);
+void quals_to_ints(const char * q, unsigned int len, int quality_scale, unsigned int * quals);
+
+#endif
@@ -0,0 +1,91 @@
+#include "fastq.h"
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <omp.h>
+
+////////////////////////////////////////////////////////////
+// fastq_bench
+//
+// Microbenchmark of fastq parsing.  Reads the given fastq
+// file a number of times with getline, with fastq_reader,
+// and with fastq_reader plus nucleotide and quality value
+// conversion, and reports the throughput of each in GB/s.
+// Run it on a file in the page cache to measure parsing
+// rather than the disk.
+////////////////////////////////////////////////////////////
+
+static unsigned long long checksum = 0;
+
+static void parse_getline(const char* fqf) {
+  ifstream reads_in(fqf);
+  string header, seq, mid, qual;
+  while(getline(reads_in, header)) {
+    getline(reads_in, seq);
+    getline(reads_in, mid);
+    getline(reads_in, qual);
+    checksum += seq.size();
+  }
+}
+
+static void parse_reader(const char* fqf) {
+  ifstream reads_in(fqf);
+  fastq_reader reads(&reads_in);
+  fastq_record rec;
+  while(reads.next(rec))
+    checksum += rec.seq.len;
+}
+
+static void parse_convert(const char* fqf) {
+  ifstream reads_in(fqf);
+  fastq_reader reads(&reads_in);
+  fastq_record rec;
+  vector<unsigned int> codes;
+  vector<unsigned int> quals;
+  while(reads.next(rec)) {
+    if(codes.size() < rec.seq.len)
+      codes.resize(rec.seq.len);
+    if(quals.size() < rec.qual.len)
+      quals.resize(rec.qual.len);
+    nts_to_codes(rec.seq.s, rec.seq.len, &codes[0]);
+    quals_to_ints(rec.qual.s, rec.qual.len, 33, &quals[0]);
+    checksum += codes[0] + quals[0];
+  }
+}
+
+static void time_parse(const char* name, void (*parse)(const char*), const char* fqf, double gb, int passes) {
+  double start = omp_get_wtime();
+  for(int p = 0; p < passes; p++)
+    parse(fqf);
+  double secs = omp_get_wtime() - start;
+  cout << name << "\t" << (gb * passes / secs) << " GB/s" << endl;
+}
+
+int main(int argc, char **argv) {
+  if(argc < 2) {
+    cerr << "USAGE: fastq_bench <fastq file> [passes=5]" << endl;
+    exit(EXIT_FAILURE);
+  }
+  int passes = (argc > 2) ? atoi(argv[2]) : 5;
+
+  struct stat st_file_info;
+  if(stat(argv[1], &st_file_info) != 0) {
+    cerr << "Cannot stat " << argv[1] << endl;
+    exit(EXIT_FAILURE);
+  }
+  double gb = (double)st_file_info.st_size / 1e9;
+
+  // warm the page cache
+  parse_reader(argv[1]);
+
+  time_parse("getline", parse_getline, argv[1], gb, passes);
+  time_parse("fastq_reader", parse_reader, argv[1], gb, passes);
+  time_parse("fastq_reader+convert", parse_convert, argv[1], gb, passes);
+
+  if(checksum == 0)
+    cerr << "No reads parsed" << endl;
+  return 0;
+}
@@ -0,0 +1,165 @@
+#ifndef KMER_H
+#define KMER_H
+
+////////////////////////////////////////////////////////////////////////////////
+// k-mer kernel
+//
+// k-mers of up to 31 nts packed 2 bits per nt, A=0, C=1, G=2 and T=3, with
+// the first nt in the highest bits, so comparing two packed k-mers compares
+// them lexicographically and the canonical k-mer is simply the smaller of the
+// forward and reverse complement codes.  Anything but upper case ACGT is
+// code 4, as in nts_to_codes.
+////////////////////////////////////////////////////////////////////////////////
+
+// marks positions without a valid k-mer in the output of canonical_kmers
+const unsigned long long kmer_invalid = ~0ULL;
+
+////////////////////////////////////////////////////////////////////////////////
+// nt_code
+//
+// Code of the nucleotide 'c', without branches, as nts_to_codes computes it.
+////////////////////////////////////////////////////////////////////////////////
+inline unsigned int nt_code(char c) {
+  unsigned char u = (unsigned char)c;
+  unsigned char code = ((u >> 1) ^ (u >> 2)) & 3;
+  unsigned char hi = code >> 1;
+  unsigned char nt = 'A' + 2*code + 2*hi + 11*(hi & code);
+  return (u == nt) ? code : 4;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// kmer_roller
+//
+// The forward and reverse complement codes of the k-mer ending at the last nt
+// code added, rolled along a sequence.  Rather than branching on non-ACGT
+// nts, it shifts a bit per nt into a mask of the last k, so the k-mer is
+// valid once the mask is clear, i.e. k ACGT's have been added since the
+// start or the last other nt.
+////////////////////////////////////////////////////////////////////////////////
+class kmer_roller {
+ public:
+  kmer_roller(int _k) {
+    mer_mask = (1ULL << (2*_k)) - 1;
+    n_mask = (1ULL << _k) - 1;
+    rev_shift = 2*(_k-1);
+    reset();
+  }
+
+  void reset() {
+    fwd = 0;
+    rev = 0;
+    ns = n_mask;
+  }
+
+  void add(unsigned int code) {
+    unsigned long long nt = code & 3;
+    fwd = ((fwd << 2) | nt) & mer_mask;
+    rev = (rev >> 2) | ((3 ^ nt) << rev_shift);
+    ns = ((ns << 1) | (code >> 2)) & n_mask;
+  }
+
+  bool valid() const { return ns == 0; }
+  unsigned long long forward() const { return fwd; }
+  unsigned long long reverse() const { return rev; }
+  unsigned long long canonical() const { return (fwd < rev) ? fwd : rev; }
+
+ private:
+  unsigned long long fwd;
+  unsigned long long rev;
+  unsigned long long ns;
+  unsigned long long mer_mask;
+  unsigned long long n_mask;
+  unsigned int rev_shift;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// canonical_kmers
+//
+// Set mers[i] to the canonical k-mer starting at nt i of the 'len' nts 's',
+// or kmer_invalid if it has a non-ACGT, for i from 0 to len-k.  Returns the
+// number of non-ACGT nts.  The loop has no branches, so a batch of reads
+// streams through it at a few cycles per nt.
+////////////////////////////////////////////////////////////////////////////////
+inline unsigned int canonical_kmers(const char * s, int len, int k, unsigned long long * mers) {
+  kmer_roller roller(k);
+  unsigned int non_acgt = 0;
+  for(int i = 0; i < len; i++) {
+    unsigned int code = nt_code(s[i]);
+    non_acgt += code >> 2;
+    roller.add(code);
+    if(i >= k-1)
+      mers[i-k+1] = roller.valid() ? roller.canonical() : kmer_invalid;
+  }
+  return non_acgt;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// canonical_code_kmers
+//
+// As canonical_kmers, from nt codes already computed, so counting several k
+// codes a read once.
+////////////////////////////////////////////////////////////////////////////////
+inline void canonical_code_kmers(const unsigned int * codes, int len, int k, unsigned long long * mers) {
+  kmer_roller roller(k);
+  for(int i = 0; i < len; i++) {
+    roller.add(codes[i]);
+    if(i >= k-1)
+      mers[i-k+1] = roller.valid() ? roller.canonical() : kmer_invalid;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// encode_kmer
+//
+// Pack the k nts at 's' into 'fwd' and their reverse complement into 'rev',
+// returning false if they include a non-ACGT.
+////////////////////////////////////////////////////////////////////////////////
+inline bool encode_kmer(const char * s, int k, unsigned long long & fwd, unsigned long long & rev) {
+  kmer_roller roller(k);
+  for(int i = 0; i < k; i++)
+    roller.add(nt_code(s[i]));
+  fwd = roller.forward();
+  rev = roller.reverse();
+  return roller.valid();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// decode_kmer
+//
+// Write the k nts of 'mer' to 's', without a terminating null.
+////////////////////////////////////////////////////////////////////////////////
+inline void decode_kmer(unsigned long long mer, int k, char * s) {
+  for(int i = k-1; i >= 0; i--) {
+    s[i] = "ACGT"[mer & 3];
+    mer >>= 2;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// reverse_complement_kmer
+//
+// Reverse complement of the packed k-mer 'mer', by complementing all bits and
+// reversing the order of the 2-bit nts in the word.
+////////////////////////////////////////////////////////////////////////////////
+inline unsigned long long reverse_complement_kmer(unsigned long long mer, int k) {
+  mer = ~mer;
+  mer = ((mer >> 2) & 0x3333333333333333ULL) | ((mer & 0x3333333333333333ULL) << 2);
+  mer = ((mer >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((mer & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  mer = ((mer >> 8) & 0x00FF00FF00FF00FFULL) | ((mer & 0x00FF00FF00FF00FFULL) << 8);
+  mer = ((mer >> 16) & 0x0000FFFF0000FFFFULL) | ((mer & 0x0000FFFF0000FFFFULL) << 16);
+  mer = (mer >> 32) | (mer << 32);
+  return mer >> (64 - 2*k);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// kmer_at
+//
+// Number of A's and T's in the packed k-mer 'mer', the nts whose two bits are
+// equal, which is the same for its reverse complement.
+////////////////////////////////////////////////////////////////////////////////
+inline int kmer_at(unsigned long long mer, int k) {
+  unsigned long long same = ~(mer ^ (mer >> 1)) & 0x5555555555555555ULL;
+  return __builtin_popcountll(same & ((1ULL << 2*k) - 1));
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "memo.h"
+#include <cstdlib>
+#include <iostream>
+
+// packed correction results
+static const unsigned int memo_len_bits = 9;
+static const unsigned int memo_to_bits = 3;
+static const unsigned int memo_count_bits = 3;
+static const unsigned int memo_max_cors = 4;
+static const unsigned long long memo_published = 1ULL << 63;
+
+////////////////////////////////////////////////////////////////////////////////
+// memo_table (constructor)
+//
+// Allocate the largest power of two number of entries that fits in 'bytes'.
+////////////////////////////////////////////////////////////////////////////////
+memo_table::memo_table(unsigned long long bytes) {
+  unsigned long long size = 1;
+  while(2*size*sizeof(memo_entry) <= bytes)
+    size *= 2;
+  mask = size-1;
+
+  table = (memo_entry*)calloc(size, sizeof(memo_entry));
+  if(table == NULL) {
+    cerr << "Failed to allocate " << bytes << " bytes for a cache" << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+memo_table::~memo_table() {
+  free(table);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// lookup
+//
+// Set 'value' and return true if 'key' has a published value.
+////////////////////////////////////////////////////////////////////////////////
+bool memo_table::lookup(unsigned long long key, unsigned long long & value) const {
+  for(unsigned int p = 0; p < memo_probes; p++) {
+    const memo_entry & e = table[(key + p) & mask];
+    unsigned long long ekey = e.key;
+    if(ekey == key) {
+      value = e.value;
+      return value != 0;
+    } else if(ekey == 0)
+      return false;
+  }
+  return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// insert
+//
+// Claim an entry for 'key' and publish 'value', unless 'key' is already
+// present or its probes are full.
+////////////////////////////////////////////////////////////////////////////////
+void memo_table::insert(unsigned long long key, unsigned long long value) {
+  for(unsigned int p = 0; p < memo_probes; p++) {
+    memo_entry & e = table[(key + p) & mask];
+    unsigned long long ekey = e.key;
+    if(ekey == 0) {
+      if(__sync_bool_compare_and_swap(&e.key, 0ULL, key)) {
+	__sync_bool_compare_and_swap(&e.value, 0ULL, value);
+	return;
+      }
+      // lost the race for the entry, so look at who won
+      ekey = e.key;
+    }
+    if(ekey == key)
+      return;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// hash_bytes
+//
+// Continue the FNV-1a hash 'h' over 'len' bytes at 's'.
+////////////////////////////////////////////////////////////////////////////////
+unsigned long long hash_bytes(const char * s, unsigned int len, unsigned long long h) {
+  for(unsigned int i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mix_hash
+//
+// Spread the bits of 'h' across the whole word, so both the low bits used to
+// index a table and the full key are well distributed.
+////////////////////////////////////////////////////////////////////////////////
+unsigned long long mix_hash(unsigned long long h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return (h == 0) ? 1 : h;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// read_memo_key
+//
+// Key for the correction of read 'rec' under error model 'model', from its
+// sequence and quality values.  Headers don't affect corrections.
+////////////////////////////////////////////////////////////////////////////////
+unsigned long long read_memo_key(const fastq_record & rec, unsigned int model) {
+  unsigned long long h = 14695981039346656037ULL ^ model;
+  h = hash_bytes(rec.seq.s, rec.seq.len, h);
+  h = hash_bytes(rec.qual.s, rec.qual.len, h ^ rec.seq.len);
+  return mix_hash(h);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// pack_correction_result
+//
+// Pack a read's corrected length 'corlen' and corrections 'cors' into
+// 'value', returning false if they don't fit, i.e. the read is too long or
+// has more than memo_max_cors corrections.
+////////////////////////////////////////////////////////////////////////////////
+bool pack_correction_result(int corlen, const vector<correction> & cors, unsigned long long & value) {
+  if(corlen < 0 || corlen >= (1 << memo_len_bits) || cors.size() > memo_max_cors)
+    return false;
+
+  value = memo_published | (unsigned long long)corlen | ((unsigned long long)cors.size() << memo_len_bits);
+  unsigned int shift = memo_len_bits + memo_count_bits;
+  for(unsigned int c = 0; c < cors.size(); c++) {
+    if(cors[c].index < 0 || cors[c].index >= (1 << memo_len_bits) || cors[c].to < 0 || cors[c].to >= (1 << memo_to_bits))
+      return false;
+    value |= (unsigned long long)cors[c].index << shift;
+    value |= (unsigned long long)cors[c].to << (shift + memo_len_bits);
+    shift += memo_len_bits + memo_to_bits;
+  }
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// unpack_correction_result
+////////////////////////////////////////////////////////////////////////////////
+void unpack_correction_result(unsigned long long value, int & corlen, vector<correction> & cors) {
+  const unsigned long long len_mask = (1 << memo_len_bits) - 1;
+  const unsigned long long to_mask = (1 << memo_to_bits) - 1;
+  corlen = (int)(value & len_mask);
+  unsigned int num_cors = (unsigned int)((value >> memo_len_bits) & ((1 << memo_count_bits) - 1));
+
+  cors.clear();
+  unsigned int shift = memo_len_bits + memo_count_bits;
+  for(unsigned int c = 0; c < num_cors; c++) {
+    cors.push_back(correction((short)((value >> shift) & len_mask), (short)((value >> (shift + memo_len_bits)) & to_mask)));
+    shift += memo_len_bits + memo_to_bits;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "Read.h"
+#include "fastq.h"
+#include <vector>
+
+using namespace::std;
+
+////////////////////////////////////////////////////////////////////////////////
+// memo_table
+//
+// Fixed size, lock free hash table of 64-bit keys to 64-bit values shared by
+// all threads.  An entry is claimed by a compare and swap of its key from 0
+// and then published by a compare and swap of its value from 0, so neither 0
+// is a valid key nor a valid value, and a reader that finds a claimed entry
+// whose value isn't published yet simply misses.
+//
+// Keys are probed linearly over at most memo_probes entries, and once those
+// are all taken by other keys, new keys are dropped rather than evicting
+// anything, which bounds the table's memory at its initial size.
+////////////////////////////////////////////////////////////////////////////////
+class memo_table {
+ public:
+  memo_table(unsigned long long bytes);
+  ~memo_table();
+  bool lookup(unsigned long long key, unsigned long long & value) const;
+  void insert(unsigned long long key, unsigned long long value);
+  unsigned long long entries() const { return mask+1; }
+
+  static const unsigned int memo_probes = 8;
+
+ private:
+  struct memo_entry {
+    volatile unsigned long long key;
+    volatile unsigned long long value;
+  };
+  memo_entry * table;
+  unsigned long long mask;
+};
+
+unsigned long long hash_bytes(const char * s, unsigned int len, unsigned long long h);
+unsigned long long mix_hash(unsigned long long h);
+
+unsigned long long read_memo_key(const fastq_record & rec, unsigned int model);
+bool pack_correction_result(int corlen, const vector<correction> & cors, unsigned long long & value);
+void unpack_correction_result(unsigned long long value, int & corlen, vector<correction> & cors);
+
+#endif
@@ -0,0 +1,251 @@
+#include "mer_bins.h"
+#include "kmer.h"
+#include "memo.h"
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// most nts in a record
+static const int max_record_nts = 0xffff;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_bins (constructor)
+//
+// Make the directory 'dir' for '_bins' bin files, each buffered by each of
+// 'threads' threads in up to '_buffer_bytes'.  Store a weight per k-mer if
+// '_weights'.
+////////////////////////////////////////////////////////////////////////////////
+mer_bins::mer_bins(string _dir, unsigned int _bins, int threads, unsigned int _buffer_bytes, int _k, bool _weights) {
+  dir = _dir;
+  bins = _bins;
+  buffer_bytes = _buffer_bytes;
+  k = _k;
+  m = min(minimizer_len, k);
+  weights = _weights;
+
+  if(mkdir(dir.c_str(), S_IRWXU) != 0) {
+    cerr << "Failed to make directory " << dir << " for k-mer bins" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  files.resize(bins);
+  locks.resize(bins);
+  for(unsigned int b = 0; b < bins; b++) {
+    files[b] = fopen(file(b).c_str(), "wb");
+    if(files[b] == NULL) {
+      cerr << "Failed to open k-mer bin " << file(b) << endl;
+      exit(EXIT_FAILURE);
+    }
+    omp_init_lock(&locks[b]);
+  }
+
+  buffers.resize(threads, vector<string>(bins));
+  bin_kmers.resize(threads, vector<unsigned long long>(bins, 0));
+  hashes.resize(threads);
+}
+
+mer_bins::~mer_bins() {
+  close();
+  for(unsigned int b = 0; b < bins; b++) {
+    unlink(file(b).c_str());
+    omp_destroy_lock(&locks[b]);
+  }
+  rmdir(dir.c_str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add_read
+//
+// Split the 'len' nts 'nts' of a read into super-k-mers and write each to its
+// bin, where mers[i] is the k-mer starting at nt i, or kmer_invalid if it
+// isn't counted, and weights[i] its weight, if counting with weights.
+////////////////////////////////////////////////////////////////////////////////
+void mer_bins::add_read(int tid, const char * nts, int len, const unsigned long long * mers, const double * mer_weights) {
+  int num_mers = len-k+1;
+  if(num_mers <= 0)
+    return;
+
+  // hashes of the canonical m-mers
+  vector<unsigned long long> & h = hashes[tid];
+  h.resize(len-m+1);
+  kmer_roller roller(m);
+  for(int i = 0; i < len; i++) {
+    roller.add(nt_code(nts[i]));
+    if(i >= m-1)
+      h[i-m+1] = mix_hash(roller.canonical());
+  }
+
+  // slide the minimizer window along, cutting the read
+  // into runs of valid k-mers in the same bin
+  const int window = k-m+1;
+  int min_pos = -1;
+  int run_start = -1;
+  unsigned int run_bin = 0;
+  for(int j = 0; j < num_mers; j++) {
+    if(min_pos < j) {
+      min_pos = j;
+      for(int p = j+1; p < j+window; p++)
+	if(h[p] < h[min_pos])
+	  min_pos = p;
+    } else if(h[j+window-1] < h[min_pos])
+      min_pos = j+window-1;
+
+    if(mers[j] == kmer_invalid) {
+      if(run_start >= 0)
+	write(tid, run_bin, nts+run_start, j-1+k-run_start, mer_weights ? mer_weights+run_start : NULL);
+      run_start = -1;
+      continue;
+    }
+
+    unsigned int b = (unsigned int)(h[min_pos] % bins);
+    if(run_start >= 0 && (b != run_bin || j+k-run_start > max_record_nts)) {
+      write(tid, run_bin, nts+run_start, j-1+k-run_start, mer_weights ? mer_weights+run_start : NULL);
+      run_start = -1;
+    }
+    if(run_start < 0) {
+      run_start = j;
+      run_bin = b;
+    }
+  }
+  if(run_start >= 0)
+    write(tid, run_bin, nts+run_start, num_mers-1+k-run_start, mer_weights ? mer_weights+run_start : NULL);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write
+//
+// Buffer a record of the 'len' nts 'nts' for bin 'b'.
+////////////////////////////////////////////////////////////////////////////////
+void mer_bins::write(int tid, unsigned int b, const char * nts, int len, const double * mer_weights) {
+  string & buf = buffers[tid][b];
+  unsigned short record_nts = (unsigned short)len;
+  buf.append((const char*)&record_nts, sizeof(record_nts));
+  for(int i = 0; i < len; i += 4) {
+    unsigned char packed = 0;
+    for(int j = i; j < i+4 && j < len; j++)
+      packed |= (nt_code(nts[j]) & 3) << (2*(j-i));
+    buf.push_back((char)packed);
+  }
+  if(weights)
+    buf.append((const char*)mer_weights, (len-k+1)*sizeof(double));
+  bin_kmers[tid][b] += len-k+1;
+
+  if(buf.size() >= buffer_bytes)
+    flush(tid, b);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// flush
+////////////////////////////////////////////////////////////////////////////////
+void mer_bins::flush(int tid, unsigned int b) {
+  string & buf = buffers[tid][b];
+  omp_set_lock(&locks[b]);
+  if(fwrite(buf.data(), 1, buf.size(), files[b]) != buf.size()) {
+    cerr << "Failed to write k-mer bin " << file(b) << endl;
+    exit(EXIT_FAILURE);
+  }
+  omp_unset_lock(&locks[b]);
+  buf.clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// close
+//
+// Write out all buffers and close the bin files so they can be read.  Call
+// outside parallel regions.
+////////////////////////////////////////////////////////////////////////////////
+void mer_bins::close() {
+  for(unsigned int b = 0; b < bins; b++) {
+    if(files[b] == NULL)
+      continue;
+    for(unsigned int t = 0; t < buffers.size(); t++)
+      if(!buffers[t][b].empty())
+	flush(t, b);
+    fclose(files[b]);
+    files[b] = NULL;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// remove
+//
+// Remove the file of bin 'b' once it's counted.
+////////////////////////////////////////////////////////////////////////////////
+void mer_bins::remove(unsigned int b) {
+  unlink(file(b).c_str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// kmers
+//
+// Number of k-mers written to bin 'b'.
+////////////////////////////////////////////////////////////////////////////////
+unsigned long long mer_bins::kmers(unsigned int b) const {
+  unsigned long long sum = 0;
+  for(unsigned int t = 0; t < bin_kmers.size(); t++)
+    sum += bin_kmers[t][b];
+  return sum;
+}
+
+string mer_bins::file(unsigned int b) const {
+  stringstream binf;
+  binf << dir << "/bin" << b;
+  return binf.str();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_bin_reader (constructor)
+////////////////////////////////////////////////////////////////////////////////
+mer_bin_reader::mer_bin_reader(string binf, int _k, bool _weights) {
+  k = _k;
+  weights = _weights;
+  fp = fopen(binf.c_str(), "rb");
+  if(fp == NULL) {
+    cerr << "Failed to open k-mer bin " << binf << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+mer_bin_reader::~mer_bin_reader() {
+  fclose(fp);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// next
+//
+// Read the next super-k-mer's nt codes into 'codes' and its k-mers' weights
+// into 'mer_weights', returning false at the end of the bin.
+////////////////////////////////////////////////////////////////////////////////
+bool mer_bin_reader::next(vector<unsigned int> & codes, vector<double> & mer_weights) {
+  unsigned short record_nts;
+  if(fread(&record_nts, sizeof(record_nts), 1, fp) != 1)
+    return false;
+  int len = record_nts;
+
+  packed.resize((len+3)/4);
+  codes.resize(len);
+  bool complete = (fread(&packed[0], 1, packed.size(), fp) == packed.size());
+  for(int i = 0; i < len; i++)
+    codes[i] = (packed[i/4] >> (2*(i%4))) & 3;
+
+  if(weights) {
+    mer_weights.resize(len-k+1);
+    complete = complete && (fread(&mer_weights[0], sizeof(double), mer_weights.size(), fp) == mer_weights.size());
+  }
+
+  if(!complete) {
+    cerr << "Truncated k-mer bin" << endl;
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
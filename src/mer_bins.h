@@ -0,0 +1,81 @@
+#ifndef MER_BINS_H
+#define MER_BINS_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+using namespace::std;
+
+// length of the minimizers that choose a super-k-mer's bin
+const int minimizer_len = 9;
+// most bins, to stay well within open file limits
+const unsigned int max_mer_bins = 1024;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_bins
+//
+// On-disk partition of the k-mers of the reads for counting them bin by bin
+// in limited memory.  A read's counted k-mers are split into super-k-mers,
+// runs of consecutive k-mers sharing a minimizer, i.e. the m-mer with the
+// smallest hash among the canonical m-mers of the k-mer.  A k-mer and its
+// reverse complement have the same minimizer, so all copies of a k-mer land in
+// the same bin, and a super-k-mer of n k-mers is stored in n+k-1 nts rather
+// than n*k.
+//
+// Each bin is a file of records: the number of nts, the nts packed 2 bits
+// each, and, for quality-weighted counts, a double per k-mer.  Each thread
+// buffers its records for each bin, and writes them to the file under the
+// bin's lock when the buffer fills.
+////////////////////////////////////////////////////////////////////////////////
+class mer_bins {
+ public:
+  mer_bins(string dir, unsigned int _bins, int threads, unsigned int _buffer_bytes, int _k, bool _weights);
+  ~mer_bins();
+  void add_read(int tid, const char * nts, int len, const unsigned long long * mers, const double * weights);
+  void close();
+  void remove(unsigned int b);
+
+  unsigned int size() const { return bins; }
+  unsigned long long kmers(unsigned int b) const;
+  string file(unsigned int b) const;
+
+ private:
+  void write(int tid, unsigned int b, const char * nts, int len, const double * weights);
+  void flush(int tid, unsigned int b);
+
+  string dir;
+  unsigned int bins;
+  unsigned int buffer_bytes;
+  int k;
+  int m;
+  bool weights;
+
+  vector<FILE*> files;
+  vector<omp_lock_t> locks;
+  vector< vector<string> > buffers;  // by thread, then bin
+  vector< vector<unsigned long long> > bin_kmers;  // by thread, then bin
+  vector< vector<unsigned long long> > hashes;  // scratch, by thread
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_bin_reader
+//
+// Read back the super-k-mers of a bin as nt codes and, for quality-weighted
+// counts, their k-mers' weights.
+////////////////////////////////////////////////////////////////////////////////
+class mer_bin_reader {
+ public:
+  mer_bin_reader(string binf, int _k, bool _weights);
+  ~mer_bin_reader();
+  bool next(vector<unsigned int> & codes, vector<double> & mer_weights);
+
+ private:
+  FILE * fp;
+  int k;
+  bool weights;
+  vector<unsigned char> packed;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "mer_estimate.h"
+#include "kmer.h"
+#include "memo.h"
+#include "mer_table.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_estimate (constructor)
+//
+// Sample k-mers at a power of 2 rate keeping about mer_estimate_samples of
+// the occurrences in 'input_bytes' of fastq, or all of them if that's
+// unknown.
+////////////////////////////////////////////////////////////////////////////////
+mer_estimate::mer_estimate(const vector<int> & _ks, int threads, double input_bytes) {
+  ks = _ks;
+
+  // about half of fastq is sequence
+  unsigned long long rate = 1;
+  while(input_bytes / 2 / rate > mer_estimate_samples)
+    rate *= 2;
+  sample_mask = rate - 1;
+
+  hlls.assign(ks.size(), vector<mer_hll>(threads));
+  passed.assign(ks.size(), vector< vector<unsigned long long> >(threads, vector<unsigned long long>(mer_estimate_max_count+1, 0)));
+  for(unsigned int ki = 0; ki < ks.size(); ki++)
+    counts.push_back(new mer_count_min(mer_estimate_words));
+  codes.resize(threads);
+}
+
+mer_estimate::~mer_estimate() {
+  for(unsigned int ki = 0; ki < counts.size(); ki++)
+    delete counts[ki];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add_read
+//
+// Add the canonical k-mers of the 'len' nts 'seq' for every k, coding the nts
+// once for all of them.
+////////////////////////////////////////////////////////////////////////////////
+void mer_estimate::add_read(int tid, const char * seq, int len) {
+  vector<unsigned int> & read_codes = codes[tid];
+  read_codes.resize(len);
+  for(int i = 0; i < len; i++)
+    read_codes[i] = nt_code(seq[i]);
+
+  for(unsigned int ki = 0; ki < ks.size(); ki++) {
+    int k = ks[ki];
+    if(len < k)
+      continue;
+    mer_hll & hll = hlls[ki][tid];
+    mer_count_min & count = *counts[ki];
+    vector<unsigned long long> & k_passed = passed[ki][tid];
+
+    kmer_roller roller(k);
+    for(int i = 0; i < len; i++) {
+      roller.add(read_codes[i]);
+      if(i < k-1 || !roller.valid())
+	continue;
+      unsigned long long hash = mix_hash(roller.canonical());
+      hll.add(hash);
+      // sample by bits the sketch's word and cells don't use
+      if(((hash >> 20) & sample_mask) == 0)
+	k_passed[count.add(hash)]++;
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// distinct
+//
+// Estimate the distinct k-mers of the ki'th k from the threads' HyperLogLogs.
+////////////////////////////////////////////////////////////////////////////////
+double mer_estimate::distinct(unsigned int ki) const {
+  mer_hll hll;
+  for(unsigned int t = 0; t < hlls[ki].size(); t++)
+    hll.merge(hlls[ki][t]);
+  return hll.estimate();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// estimate
+//
+// Estimate the figures in mer_estimate.h for the ki'th k.
+////////////////////////////////////////////////////////////////////////////////
+mer_estimate::k_estimate mer_estimate::estimate(unsigned int ki) const {
+  k_estimate est;
+  est.k = ks[ki];
+
+  est.distinct = distinct(ki);
+
+  // k-mers counted >= c, scaled up from the sample
+  double rate = sample_mask + 1;
+  vector<double> at_least(mer_estimate_max_count+2, 0);
+  for(unsigned int c = 1; c <= mer_estimate_max_count; c++)
+    for(unsigned int t = 0; t < passed[ki].size(); t++)
+      at_least[c] += rate * passed[ki][t][c];
+  est.twice = at_least[2];
+
+  // histogram, with the saturated k-mers at the top count
+  vector<double> hist(mer_estimate_max_count+1, 0);
+  for(unsigned int c = 1; c <= mer_estimate_max_count; c++)
+    hist[c] = at_least[c] - at_least[c+1];
+
+  est.cutoff = 0;
+  for(unsigned int c = 2; c+1 < mer_estimate_max_count && est.cutoff == 0; c++)
+    if(hist[c] > 0 && hist[c] <= hist[c+1])
+      est.cutoff = c;
+
+  est.peak = 0;
+  est.solid = 0;
+  est.genome = 0;
+  if(est.cutoff > 0) {
+    est.peak = est.cutoff;
+    for(unsigned int c = est.cutoff; c < mer_estimate_max_count; c++)
+      if(hist[c] > hist[est.peak])
+	est.peak = c;
+    est.solid = at_least[est.cutoff];
+    for(unsigned int c = est.cutoff; c <= mer_estimate_max_count; c++)
+      est.genome += c * hist[c];
+    est.genome /= est.peak;
+  }
+  return est;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write
+//
+// Print the estimates for each k, and then the recommended k, by the rule
+// of thumb k = log4(200 G) for a genome of size G, the median of the
+// estimates, and table sizes for the tested k nearest it:
+//
+//   table_size         count-mers -s and Jellyfish -s
+//   screen_table_size  count-mers -s with --screen
+//   count_qmers_size   count_qmers -t, which rounds down to a power of 2
+//   trusted_kmers      k-mers the bithash will hold
+////////////////////////////////////////////////////////////////////////////////
+void mer_estimate::write(FILE * out) const {
+  vector<k_estimate> ests;
+  vector<double> genomes;
+  fprintf(out, "k\tdistinct\ttwice\tcutoff\tpeak\tsolid\tgenome\n");
+  for(unsigned int ki = 0; ki < ks.size(); ki++) {
+    ests.push_back(estimate(ki));
+    const k_estimate & est = ests.back();
+    fprintf(out, "%d\t%.0f\t%.0f\t%u\t%u\t%.0f\t%.0f\n", est.k, est.distinct, est.twice, est.cutoff, est.peak, est.solid, est.genome);
+    if(est.cutoff > 0)
+      genomes.push_back(est.genome);
+  }
+
+  if(genomes.empty()) {
+    cerr << "No coverage peak was found for any k, so no k is recommended. Coverage may be too low." << endl;
+    return;
+  }
+  sort(genomes.begin(), genomes.end());
+  double genome = genomes[genomes.size()/2];
+  int k = (int)floor(log(200 * genome) / log(4.0) + 0.5);
+  k = max(1, min(31, k));
+
+  unsigned int nearest = 0;
+  for(unsigned int ki = 1; ki < ests.size(); ki++)
+    if(abs(ests[ki].k - k) <= abs(ests[nearest].k - k))
+      nearest = ki;
+  const k_estimate & est = ests[nearest];
+
+  unsigned long long table_size = 1;
+  while(table_size < est.distinct / mer_max_load)
+    table_size *= 2;
+  unsigned long long screen_table_size = 1;
+  while(screen_table_size < est.twice / mer_max_load)
+    screen_table_size *= 2;
+
+  fprintf(out, "recommended_k\t%d\n", k);
+  fprintf(out, "genome_size\t%.0f\n", genome);
+  fprintf(out, "sized_k\t%d\n", est.k);
+  fprintf(out, "table_size\t%llu\n", table_size);
+  fprintf(out, "screen_table_size\t%llu\n", screen_table_size);
+  fprintf(out, "count_qmers_size\t%llu\n", 2*table_size);
+  fprintf(out, "trusted_kmers\t%.0f\n", est.solid);
+}
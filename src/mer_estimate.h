@@ -0,0 +1,66 @@
+#ifndef MER_ESTIMATE_H
+#define MER_ESTIMATE_H
+
+#include "mer_sketch.h"
+#include <cstdio>
+#include <vector>
+
+using namespace::std;
+
+// k-mer occurrences to count per k, choosing the rate k-mers are sampled at
+const unsigned long long mer_estimate_samples = 1ULL << 22;
+// count-min sketch words per k
+const unsigned long long mer_estimate_words = 1ULL << 20;
+// counts below this are histogrammed; count-min cells saturate at it
+const unsigned int mer_estimate_max_count = 255;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_estimate
+//
+// Estimates of the k-mers of the reads for several k at once, from one pass
+// over them, to choose k and size the tables before counting:
+//
+//   distinct   distinct k-mers, by a HyperLogLog per thread
+//   twice      distinct k-mers seen at least twice
+//   cutoff     the trough between error and genomic k-mers in the coverage
+//              histogram, or 0 if there's no trough
+//   peak       the genomic coverage peak past the cutoff
+//   solid      distinct k-mers counted >= cutoff
+//   genome     genome size, the k-mers counted >= cutoff over the peak
+//
+// Coverage comes from a count-min sketch of a sample of the k-mers, those
+// whose hashes have some bits clear, so a sampled k-mer's every occurrence is
+// counted and the histogram scales up by the sampling rate.  As the
+// sketch's estimates rise by 1 per occurrence, each k-mer passes each count
+// once, so counting those passes gives how many k-mers are counted >= c for
+// every c without keeping the k-mers.
+////////////////////////////////////////////////////////////////////////////////
+class mer_estimate {
+ public:
+  mer_estimate(const vector<int> & _ks, int threads, double input_bytes);
+  ~mer_estimate();
+  void add_read(int tid, const char * seq, int len);
+  void write(FILE * out) const;
+  double distinct(unsigned int ki) const;
+
+ private:
+  struct k_estimate {
+    int k;
+    double distinct;
+    double twice;
+    unsigned int cutoff;
+    unsigned int peak;
+    double solid;
+    double genome;
+  };
+  k_estimate estimate(unsigned int ki) const;
+
+  vector<int> ks;
+  unsigned long long sample_mask;
+  vector< vector<mer_hll> > hlls;                          // by k, thread
+  vector<mer_count_min*> counts;                           // by k
+  vector< vector< vector<unsigned long long> > > passed;  // by k, thread, count
+  vector< vector<unsigned int> > codes;                    // by thread
+};
+
+#endif
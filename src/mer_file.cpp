@@ -0,0 +1,346 @@
+#include "mer_file.h"
+#include "kmer.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+static const char mer_file_magic[8] = {'Q','U','A','K','E','M','E','R'};
+static const unsigned int mer_file_version = 1;
+
+static void put_varint(string & s, unsigned long long v) {
+  while(v >= 0x80) {
+    s.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  s.push_back((char)v);
+}
+
+static unsigned long long get_varint(const unsigned char * & p) {
+  unsigned long long v = 0;
+  unsigned int shift = 0;
+  while(*p & 0x80) {
+    v |= (unsigned long long)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  v |= (unsigned long long)(*p++) << shift;
+  return v;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_file_writer (constructor)
+////////////////////////////////////////////////////////////////////////////////
+mer_file_writer::mer_file_writer(string _merf, int k, bool quality, unsigned int block_mers) {
+  merf = _merf;
+  fp = fopen(merf.c_str(), "wb");
+  if(fp == NULL) {
+    cerr << "Failed to open " << merf << " for writing k-mer counts" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, mer_file_magic, sizeof(header.magic));
+  header.version = mer_file_version;
+  header.k = k;
+  header.quality = quality ? 1 : 0;
+  header.block_mers = block_mers;
+  header.count_scale = quality ? mer_quality_scale : 1.0;
+
+  // the header is written for real on close
+  fwrite(&header, sizeof(header), 1, fp);
+  offset = sizeof(header);
+  raw = NULL;
+  last_mer = 0;
+}
+
+mer_file_writer::~mer_file_writer() {
+  close();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add
+//
+// Add the count of k-mer 'mer', which must follow the last k-mer added.
+////////////////////////////////////////////////////////////////////////////////
+void mer_file_writer::add(unsigned long long mer, double count) {
+  if(raw == NULL || index.back().mers == header.block_mers) {
+    end_block();
+    raw_blocks.push_back(string());
+    raw = &raw_blocks.back();
+    mer_block_info info;
+    memset(&info, 0, sizeof(info));
+    info.first_mer = mer;
+    index.push_back(info);
+    last_mer = mer;
+  } else if(mer <= last_mer) {
+    cerr << "K-mers for " << merf << " are out of order" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  put_varint(*raw, mer - last_mer);
+  put_varint(*raw, (unsigned long long)floor(count * header.count_scale + 0.5));
+  last_mer = mer;
+  index.back().mers++;
+  header.mers++;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// end_block
+//
+// Compress and write the waiting blocks once there's a batch of them.
+////////////////////////////////////////////////////////////////////////////////
+void mer_file_writer::end_block() {
+  if(raw_blocks.size() >= mer_block_batch) {
+    write_blocks();
+    raw = NULL;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write_blocks
+//
+// Compress the waiting blocks in parallel and write them in order.
+////////////////////////////////////////////////////////////////////////////////
+void mer_file_writer::write_blocks() {
+  unsigned int num_blocks = raw_blocks.size();
+  unsigned long long first = index.size() - num_blocks;
+  vector< vector<unsigned char> > zblocks(num_blocks);
+
+#pragma omp parallel for schedule(dynamic)
+  for(int b = 0; b < (int)num_blocks; b++) {
+    uLongf zbytes = compressBound(raw_blocks[b].size());
+    zblocks[b].resize(zbytes);
+    if(compress2(&zblocks[b][0], &zbytes, (const Bytef*)raw_blocks[b].data(), raw_blocks[b].size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+      cerr << "Failed to compress k-mer counts" << endl;
+      exit(EXIT_FAILURE);
+    }
+    zblocks[b].resize(zbytes);
+  }
+
+  for(unsigned int b = 0; b < num_blocks; b++) {
+    mer_block_info & info = index[first + b];
+    info.offset = offset;
+    info.bytes = zblocks[b].size();
+    info.raw_bytes = raw_blocks[b].size();
+    if(fwrite(&zblocks[b][0], 1, info.bytes, fp) != info.bytes) {
+      cerr << "Failed to write k-mer counts to " << merf << endl;
+      exit(EXIT_FAILURE);
+    }
+    offset += info.bytes;
+  }
+  raw_blocks.clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// close
+//
+// Write the remaining blocks, the index and the header.
+////////////////////////////////////////////////////////////////////////////////
+void mer_file_writer::close() {
+  if(fp == NULL)
+    return;
+  write_blocks();
+  raw = NULL;
+
+  header.blocks = index.size();
+  header.index_offset = offset;
+  if(!index.empty())
+    fwrite(&index[0], sizeof(mer_block_info), index.size(), fp);
+  fseek(fp, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, fp);
+  if(fclose(fp) != 0) {
+    cerr << "Failed to write k-mer counts to " << merf << endl;
+    exit(EXIT_FAILURE);
+  }
+  fp = NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_file_reader (constructor)
+////////////////////////////////////////////////////////////////////////////////
+mer_file_reader::mer_file_reader(string _merf) {
+  merf = _merf;
+  struct stat st_file_info;
+  int fd = open(merf.c_str(), O_RDONLY);
+  if(fd < 0 || fstat(fd, &st_file_info) != 0 || st_file_info.st_size < (off_t)sizeof(mer_file_header)) {
+    cerr << "Failed to open k-mer counts " << merf << endl;
+    exit(EXIT_FAILURE);
+  }
+  size = st_file_info.st_size;
+  // the mapping outlives the descriptor, so merging many files needs few
+  data = (const unsigned char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(data == MAP_FAILED) {
+    cerr << "Failed to map k-mer counts " << merf << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  memcpy(&header, data, sizeof(header));
+  if(memcmp(header.magic, mer_file_magic, sizeof(header.magic)) != 0 || header.version != mer_file_version || header.index_offset + header.blocks*sizeof(mer_block_info) > size) {
+    cerr << merf << " is not a valid k-mer count file" << endl;
+    exit(EXIT_FAILURE);
+  }
+  index = (const mer_block_info *)(data + header.index_offset);
+}
+
+mer_file_reader::~mer_file_reader() {
+  munmap((void*)data, size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// is_mer_file
+//
+// Return true if 'merf' starts like a mer file, rather than text.
+////////////////////////////////////////////////////////////////////////////////
+bool mer_file_reader::is_mer_file(string merf) {
+  char magic[sizeof(mer_file_magic)];
+  FILE * fp = fopen(merf.c_str(), "rb");
+  if(fp == NULL)
+    return false;
+  bool is_mer = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, mer_file_magic, sizeof(magic)) == 0);
+  fclose(fp);
+  return is_mer;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// read_block
+//
+// Decode block 'b' into 'mers'.
+////////////////////////////////////////////////////////////////////////////////
+void mer_file_reader::read_block(unsigned long long b, vector<mer_count> & mers) const {
+  const mer_block_info & info = index[b];
+  vector<unsigned char> raw(info.raw_bytes + 1);
+  uLongf raw_bytes = info.raw_bytes;
+  if(info.offset + info.bytes > size || uncompress(&raw[0], &raw_bytes, data + info.offset, info.bytes) != Z_OK || raw_bytes != info.raw_bytes) {
+    cerr << "Corrupt block " << b << " in k-mer counts " << merf << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  mers.resize(info.mers);
+  const unsigned char * p = &raw[0];
+  unsigned long long mer = info.first_mer;
+  for(unsigned int i = 0; i < info.mers; i++) {
+    mer += get_varint(p);
+    mers[i].mer = mer;
+    mers[i].count = get_varint(p) / header.count_scale;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_file_merger (constructor)
+////////////////////////////////////////////////////////////////////////////////
+mer_file_merger::mer_file_merger(const vector<string> & merfs) {
+  for(unsigned int r = 0; r < merfs.size(); r++) {
+    readers.push_back(new mer_file_reader(merfs[r]));
+    if(readers[r]->k() != readers[0]->k() || readers[r]->quality() != readers[0]->quality()) {
+      cerr << "K-mer counts " << merfs[r] << " don't match " << merfs[0] << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  cursors.resize(readers.size());
+  for(unsigned int r = 0; r < readers.size(); r++) {
+    cursors[r].block = 0;
+    cursors[r].pos = 0;
+    if(readers[r]->blocks() > 0) {
+      readers[r]->read_block(0, cursors[r].mers);
+      heap.push_back(r);
+    }
+  }
+  for(int h = (int)heap.size()/2 - 1; h >= 0; h--)
+    sift_down(h);
+}
+
+mer_file_merger::~mer_file_merger() {
+  for(unsigned int r = 0; r < readers.size(); r++)
+    delete readers[r];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// next
+//
+// Set 'mc' to the next k-mer and its total count, returning false after the
+// last.
+////////////////////////////////////////////////////////////////////////////////
+bool mer_file_merger::next(mer_count & mc) {
+  if(heap.empty())
+    return false;
+
+  unsigned int r = heap[0];
+  mc = cursors[r].mers[cursors[r].pos];
+  mc.count = 0;
+  while(!heap.empty() && cursors[heap[0]].mers[cursors[heap[0]].pos].mer == mc.mer) {
+    r = heap[0];
+    mc.count += cursors[r].mers[cursors[r].pos].count;
+    if(!advance(r)) {
+      heap[0] = heap.back();
+      heap.pop_back();
+    }
+    if(!heap.empty())
+      sift_down(0);
+  }
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// advance
+//
+// Move reader 'r' on to its next k-mer, returning false if it has no more.
+////////////////////////////////////////////////////////////////////////////////
+bool mer_file_merger::advance(unsigned int r) {
+  cursor & c = cursors[r];
+  if(++c.pos < c.mers.size())
+    return true;
+  c.pos = 0;
+  while(++c.block < readers[r]->blocks()) {
+    readers[r]->read_block(c.block, c.mers);
+    if(!c.mers.empty())
+      return true;
+  }
+  return false;
+}
+
+void mer_file_merger::sift_down(unsigned int h) {
+  while(true) {
+    unsigned int least = h;
+    for(unsigned int child = 2*h+1; child <= 2*h+2 && child < heap.size(); child++)
+      if(cursors[heap[child]].mers[cursors[heap[child]].pos].mer < cursors[heap[least]].mers[cursors[heap[least]].pos].mer)
+	least = child;
+    if(least == h)
+      return;
+    swap(heap[h], heap[least]);
+    h = least;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// append_mer_text
+//
+// Append 'mc' to 'out' as a text line, the way the k-mer counters print it.
+////////////////////////////////////////////////////////////////////////////////
+void append_mer_text(string & out, const mer_count & mc, int k, bool quality) {
+  char line[64];
+  decode_kmer(mc.mer, k, line);
+  if(quality)
+    sprintf(line+k, "\t%f\n", mc.count);
+  else
+    sprintf(line+k, "\t%llu\n", (unsigned long long)mc.count);
+  out += line;
+}
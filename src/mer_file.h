@@ -0,0 +1,147 @@
+#ifndef MER_FILE_H
+#define MER_FILE_H
+
+#include "mer_table.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace::std;
+
+// k-mers per block, unless the writer is given fewer
+const unsigned int mer_block_mers = 1 << 14;
+// blocks compressed in parallel by a writer
+const unsigned int mer_block_batch = 64;
+// counts stored per unit of quality-weighted count, as precise as "%f"
+const double mer_quality_scale = 1e6;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer file format
+//
+// Binary file of k-mer counts sorted by packed k-mer, little-endian:
+//
+//   header   mer_file_header, 64 bytes
+//   blocks   each a zlib-compressed run of up to block_mers k-mers, each
+//            a varint of its difference from the previous k-mer (the first
+//            from the block's first k-mer) and a varint of its count times
+//            count_scale, rounded
+//   index    a mer_block_info per block
+//
+// Readers map the file into memory, find a block from the index and decode
+// it independently of the others, so threads can read blocks in parallel and
+// binary search the index by k-mer.
+////////////////////////////////////////////////////////////////////////////////
+struct mer_file_header {
+  char magic[8];
+  unsigned int version;
+  unsigned int k;
+  unsigned int quality;    // 1 if counts are quality-weighted
+  unsigned int block_mers;
+  double count_scale;
+  unsigned long long mers;
+  unsigned long long blocks;
+  unsigned long long index_offset;
+  char pad[8];
+};
+
+struct mer_block_info {
+  unsigned long long first_mer;
+  unsigned long long offset;
+  unsigned int bytes;
+  unsigned int raw_bytes;
+  unsigned int mers;
+  unsigned int pad;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_file_writer
+//
+// Write k-mer counts, added in increasing order of k-mer, to a mer file, in
+// blocks of up to 'block_mers' k-mers.
+////////////////////////////////////////////////////////////////////////////////
+class mer_file_writer {
+ public:
+  mer_file_writer(string _merf, int k, bool quality, unsigned int block_mers = mer_block_mers);
+  ~mer_file_writer();
+  void add(unsigned long long mer, double count);
+  void close();
+
+ private:
+  void end_block();
+  void write_blocks();
+
+  string merf;
+  FILE * fp;
+  mer_file_header header;
+  vector<mer_block_info> index;
+  unsigned long long offset;
+
+  // blocks waiting to be compressed
+  vector<string> raw_blocks;
+  string * raw;
+  unsigned long long last_mer;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_file_reader
+//
+// Read a mer file mapped into memory.  read_block may be called by many
+// threads at once.
+////////////////////////////////////////////////////////////////////////////////
+class mer_file_reader {
+ public:
+  mer_file_reader(string _merf);
+  ~mer_file_reader();
+  void read_block(unsigned long long b, vector<mer_count> & mers) const;
+  static bool is_mer_file(string merf);
+
+  int k() const { return header.k; }
+  bool quality() const { return header.quality != 0; }
+  unsigned long long mers() const { return header.mers; }
+  unsigned long long blocks() const { return header.blocks; }
+
+ private:
+  string merf;
+  const unsigned char * data;
+  unsigned long long size;
+  mer_file_header header;
+  const mer_block_info * index;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_file_merger
+//
+// Merge the k-mer counts of several mer files in order of k-mer, summing the
+// counts of k-mers found in more than one.  Each file has a block decoded at
+// a time, so merging many files needs them written in small blocks.
+////////////////////////////////////////////////////////////////////////////////
+class mer_file_merger {
+ public:
+  mer_file_merger(const vector<string> & merfs);
+  ~mer_file_merger();
+  bool next(mer_count & mc);
+
+  int k() const { return readers[0]->k(); }
+  bool quality() const { return readers[0]->quality(); }
+
+ private:
+  bool advance(unsigned int r);
+  void sift_down(unsigned int h);
+
+  struct cursor {
+    unsigned long long block;
+    unsigned int pos;
+    vector<mer_count> mers;
+  };
+  vector<mer_file_reader*> readers;
+  vector<cursor> cursors;
+  vector<unsigned int> heap;  // readers with k-mers left, by their next k-mer
+};
+
+inline bool mer_count_less(const mer_count & a, const mer_count & b) {
+  return a.mer < b.mer;
+}
+
+void append_mer_text(string & out, const mer_count & mc, int k, bool quality);
+
+#endif
@@ -0,0 +1,171 @@
+#include "mer_sketch.h"
+#include "memo.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace::std;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_sketch (constructor)
+//
+// Size the sketch for about 'mers' distinct k-mers, rounding up to a power
+// of 2 words.
+////////////////////////////////////////////////////////////////////////////////
+mer_sketch::mer_sketch(unsigned long long mers) {
+  unsigned long long num_words = 1 << 10;
+  while(num_words * 32 < mers * mer_sketch_cells_per_mer)
+    num_words *= 2;
+  mask = num_words - 1;
+
+  words = new unsigned long long[num_words];
+  memset(words, 0, num_words * sizeof(unsigned long long));
+}
+
+mer_sketch::~mer_sketch() {
+  delete[] words;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add
+//
+// Count a sighting of 'mer', returning how many times it was seen before, up
+// to 3.
+////////////////////////////////////////////////////////////////////////////////
+unsigned int mer_sketch::add(unsigned long long mer) {
+  unsigned long long h = mix_hash(mer);
+  unsigned long long * word = &words[h & mask];
+  unsigned int a = 2 * ((h >> 40) & 31);
+  unsigned int b = 2 * ((h >> 50) & 31);
+  if(a == b)
+    b ^= 2;
+
+  unsigned long long old_word = *word;
+  while(true) {
+    unsigned int ca = (old_word >> a) & 3;
+    unsigned int cb = (old_word >> b) & 3;
+    unsigned int seen = (ca < cb) ? ca : cb;
+    if(seen == 3)
+      return 3;
+
+    unsigned long long new_word = old_word;
+    if(ca == seen)
+      new_word += 1ULL << a;
+    if(cb == seen)
+      new_word += 1ULL << b;
+
+    unsigned long long prev = __sync_val_compare_and_swap(word, old_word, new_word);
+    if(prev == old_word)
+      return seen;
+    old_word = prev;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// collision_rate
+//
+// Bound the chance that a k-mer never seen finds both its cells taken, or
+// at 'seen' or more, from the fraction of cells so filled now.  Cells fill as
+// k-mers are added, so k-mers seen earlier had a smaller chance.
+////////////////////////////////////////////////////////////////////////////////
+double mer_sketch::collision_rate(unsigned int seen) const {
+  unsigned long long used = 0;
+  for(unsigned long long w = 0; w <= mask; w++) {
+    unsigned long long lo = words[w] & 0x5555555555555555ULL;
+    unsigned long long hi = (words[w] >> 1) & 0x5555555555555555ULL;
+    unsigned long long at_least = (seen <= 1) ? (lo | hi) : (seen == 2 ? hi : (lo & hi));
+    used += __builtin_popcountll(at_least);
+  }
+  double fill = (double)used / (32.0 * (mask+1));
+  return fill * fill;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_hll::merge
+////////////////////////////////////////////////////////////////////////////////
+void mer_hll::merge(const mer_hll & other) {
+  for(unsigned int r = 0; r < registers.size(); r++)
+    if(other.registers[r] > registers[r])
+      registers[r] = other.registers[r];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_hll::estimate
+//
+// The harmonic mean estimate, or linear counting of empty registers when
+// that's small.
+////////////////////////////////////////////////////////////////////////////////
+double mer_hll::estimate() const {
+  double m = registers.size();
+  double sum = 0;
+  unsigned int zeros = 0;
+  for(unsigned int r = 0; r < registers.size(); r++) {
+    sum += ldexp(1.0, -registers[r]);
+    if(registers[r] == 0)
+      zeros++;
+  }
+  double e = 0.7213 / (1 + 1.079/m) * m * m / sum;
+  if(e <= 2.5 * m && zeros > 0)
+    e = m * log(m / zeros);
+  return e;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_count_min (constructor)
+//
+// Round 'num_words' up to a power of 2.
+////////////////////////////////////////////////////////////////////////////////
+mer_count_min::mer_count_min(unsigned long long num_words) {
+  unsigned long long size = 1 << 10;
+  while(size < num_words)
+    size *= 2;
+  mask = size - 1;
+
+  words = new unsigned long long[size];
+  memset(words, 0, size * sizeof(unsigned long long));
+}
+
+mer_count_min::~mer_count_min() {
+  delete[] words;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_count_min::add
+//
+// Count the k-mer with 'hash', returning its estimated count including this
+// one, or 0 once that's saturated at 255.
+////////////////////////////////////////////////////////////////////////////////
+unsigned int mer_count_min::add(unsigned long long hash) {
+  unsigned long long * word = &words[hash & mask];
+  unsigned int a = 8 * ((hash >> 40) & 7);
+  unsigned int b = 8 * ((hash >> 50) & 7);
+  if(a == b)
+    b ^= 8;
+
+  unsigned long long old_word = *word;
+  while(true) {
+    unsigned int ca = (old_word >> a) & 255;
+    unsigned int cb = (old_word >> b) & 255;
+    unsigned int count = (ca < cb) ? ca : cb;
+    if(count == 255)
+      return 0;
+
+    unsigned long long new_word = old_word;
+    if(ca == count)
+      new_word += 1ULL << a;
+    if(cb == count)
+      new_word += 1ULL << b;
+
+    unsigned long long prev = __sync_val_compare_and_swap(word, old_word, new_word);
+    if(prev == old_word)
+      return count + 1;
+    old_word = prev;
+  }
+}
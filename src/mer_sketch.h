@@ -0,0 +1,87 @@
+#ifndef MER_SKETCH_H
+#define MER_SKETCH_H
+
+#include <vector>
+
+// 2-bit cells per distinct k-mer expected, keeping collisions near 1%
+const unsigned int mer_sketch_cells_per_mer = 16;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_sketch
+//
+// Lock free sketch of 2-bit saturating counters screening out k-mers seen
+// once before they take an entry in the exact table.  A k-mer's two cells
+// share a 64-bit word, so a compare and swap sees and increments both at
+// once, and the smaller of the two, counting up to 3, is how many times it
+// was seen before.  Only the smaller cells are incremented, which keeps
+// collisions from inflating the counts of other k-mers.
+//
+// A k-mer is counted from its second sighting on, and its first is added
+// back when it's inserted in the exact table, not when the sketch says it
+// was seen once, as others may fill its cells between its sightings.  So
+// only k-mers seen once go uncounted, and the only error is a k-mer seen
+// for the first time whose cells were already taken by others, counted
+// once too many, at a rate bounded by collision_rate.
+//
+// The sketch is sized by distinct k-mers, not occurrences, at 4 bytes each,
+// so callers estimate those first, e.g. by a mer_hll.
+////////////////////////////////////////////////////////////////////////////////
+class mer_sketch {
+ public:
+  mer_sketch(unsigned long long mers);
+  ~mer_sketch();
+  unsigned int add(unsigned long long mer);
+  double collision_rate(unsigned int seen = 1) const;
+  unsigned long long bytes() const { return (mask+1) * 8; }
+
+ private:
+  unsigned long long * words;
+  unsigned long long mask;
+};
+
+// bits of hash choosing a mer_hll register
+const int mer_hll_bits = 14;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_hll
+//
+// HyperLogLog estimate of the number of distinct k-mers added by their
+// hashes, in 2^mer_hll_bits byte registers, to within about 1%.  Threads
+// keep their own and merge them.
+////////////////////////////////////////////////////////////////////////////////
+class mer_hll {
+ public:
+  mer_hll() : registers(1 << mer_hll_bits, 0) {}
+  void add(unsigned long long hash) {
+    unsigned int r = hash >> (64 - mer_hll_bits);
+    unsigned char rank = __builtin_clzll((hash << mer_hll_bits) | (1ULL << (mer_hll_bits-1))) + 1;
+    if(rank > registers[r])
+      registers[r] = rank;
+  }
+  void merge(const mer_hll & other);
+  double estimate() const;
+
+ private:
+  std::vector<unsigned char> registers;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_count_min
+//
+// Lock free count-min sketch of k-mer counts by their hashes, in 8-bit
+// saturating cells.  As in mer_sketch, a k-mer's two cells share a 64-bit
+// word and only the smaller is incremented, so a k-mer's estimate rises by
+// exactly 1 per add until it saturates, passing each count once.
+////////////////////////////////////////////////////////////////////////////////
+class mer_count_min {
+ public:
+  mer_count_min(unsigned long long num_words);
+  ~mer_count_min();
+  unsigned int add(unsigned long long hash);
+
+ private:
+  unsigned long long * words;
+  unsigned long long mask;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "mer_stats.h"
+#include "kmer.h"
+#include "memo.h"
+#include "mer_file.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_stats (constructor)
+////////////////////////////////////////////////////////////////////////////////
+mer_stats::mer_stats(int _k, bool _quality, unsigned int _sample_size) {
+  k = _k;
+  quality = _quality;
+  sample_size = _sample_size;
+  at_hists.resize(k+1);
+  at_samples.resize(k+1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add
+//
+// Add counted k-mer 'mer' to the histograms and samples.  Quality-weighted
+// counts are first rounded to the mer file's precision, since summing a
+// k-mer's weights in another order, e.g. by bins or threads, can move an
+// integer count by a rounding error across a coverage bin's edge.
+////////////////////////////////////////////////////////////////////////////////
+void mer_stats::add(unsigned long long mer, double count) {
+  if(quality)
+    count = floor(count * mer_quality_scale + 0.5) / mer_quality_scale;
+  unsigned long long cov = (unsigned long long)ceil(count);
+  int at = kmer_at(mer, k);
+  hist.add(cov);
+  at_hists[at].add(cov);
+
+  unsigned long long hash = mix_hash(mer);
+  sample.add(hash, count, sample_size);
+  at_samples[at].add(hash, count, sample_size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add_screened
+//
+// Add 'mers' k-mers seen once but screened out of the counts to the overall
+// histogram at coverage 1.
+////////////////////////////////////////////////////////////////////////////////
+void mer_stats::add_screened(unsigned long long mers) {
+  if(mers > 0)
+    hist.add(1, mers);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// merge
+//
+// Add the k-mers of 'other', which must be distinct from these.
+////////////////////////////////////////////////////////////////////////////////
+void mer_stats::merge(const mer_stats & other) {
+  hist.merge(other.hist);
+  for(int at = 0; at <= k; at++)
+    at_hists[at].merge(other.at_hists[at]);
+
+  for(unsigned int i = 0; i < other.sample.heap.size(); i++)
+    sample.add(other.sample.heap[i].first, other.sample.heap[i].second, sample_size);
+  for(int at = 0; at <= k; at++)
+    for(unsigned int i = 0; i < other.at_samples[at].heap.size(); i++)
+      at_samples[at].add(other.at_samples[at].heap[i].first, other.at_samples[at].heap[i].second, sample_size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write
+//
+// Write the files named in mer_stats.h.
+////////////////////////////////////////////////////////////////////////////////
+void mer_stats::write(const string & prefix) const {
+  string suffixes[4] = {".hist", ".at.hist", ".sample", ".at.sample"};
+  FILE * outs[4];
+  for(int f = 0; f < 4; f++) {
+    outs[f] = fopen((prefix + suffixes[f]).c_str(), "w");
+    if(outs[f] == NULL) {
+      cerr << "Failed to open " << prefix << suffixes[f] << " for writing" << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  hist.write(outs[0], -1);
+  for(int at = 0; at <= k; at++)
+    at_hists[at].write(outs[1], at);
+  sample.write(outs[2], -1, quality);
+  for(int at = 0; at <= k; at++)
+    at_samples[at].write(outs[3], at, quality);
+
+  for(int f = 0; f < 4; f++)
+    fclose(outs[f]);
+}
+
+
+void mer_stats::histogram::add(unsigned long long cov, unsigned long long mers) {
+  if(cov < mer_hist_dense) {
+    if(dense.empty())
+      dense.resize(mer_hist_dense, 0);
+    dense[cov] += mers;
+  } else
+    sparse[cov] += mers;
+}
+
+void mer_stats::histogram::merge(const histogram & other) {
+  if(!other.dense.empty()) {
+    if(dense.empty())
+      dense.resize(mer_hist_dense, 0);
+    for(unsigned long long cov = 0; cov < mer_hist_dense; cov++)
+      dense[cov] += other.dense[cov];
+  }
+  map<unsigned long long, unsigned long long>::const_iterator it;
+  for(it = other.sparse.begin(); it != other.sparse.end(); it++)
+    sparse[it->first] += it->second;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// histogram::write
+//
+// Print the non-zero coverages, after the AT content 'at' unless it's -1.
+////////////////////////////////////////////////////////////////////////////////
+void mer_stats::histogram::write(FILE * out, int at) const {
+  for(unsigned long long cov = 0; cov < dense.size(); cov++) {
+    if(dense[cov] == 0)
+      continue;
+    if(at >= 0)
+      fprintf(out, "%d\t", at);
+    fprintf(out, "%llu\t%llu\n", cov, dense[cov]);
+  }
+  map<unsigned long long, unsigned long long>::const_iterator it;
+  for(it = sparse.begin(); it != sparse.end(); it++) {
+    if(at >= 0)
+      fprintf(out, "%d\t", at);
+    fprintf(out, "%llu\t%llu\n", it->first, it->second);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// reservoir::add
+//
+// Keep 'count' if its k-mer's 'hash' is among the 'size' smallest.
+////////////////////////////////////////////////////////////////////////////////
+void mer_stats::reservoir::add(unsigned long long hash, double count, unsigned int size) {
+  if(heap.size() < size) {
+    heap.push_back(make_pair(hash, count));
+    push_heap(heap.begin(), heap.end());
+  } else if(size > 0 && hash < heap.front().first) {
+    pop_heap(heap.begin(), heap.end());
+    heap.back() = make_pair(hash, count);
+    push_heap(heap.begin(), heap.end());
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// reservoir::write
+//
+// Print the sampled counts in order of hash, so the same k-mers always give
+// the same file, after the AT content 'at' unless it's -1.
+////////////////////////////////////////////////////////////////////////////////
+void mer_stats::reservoir::write(FILE * out, int at, bool quality) const {
+  vector< pair<unsigned long long, double> > sorted(heap);
+  sort(sorted.begin(), sorted.end());
+  for(unsigned int i = 0; i < sorted.size(); i++) {
+    if(at >= 0)
+      fprintf(out, "%d\t", at);
+    if(quality)
+      fprintf(out, "%f\n", sorted[i].second);
+    else
+      fprintf(out, "%llu\n", (unsigned long long)sorted[i].second);
+  }
+}
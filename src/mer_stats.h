@@ -0,0 +1,71 @@
+#ifndef MER_STATS_H
+#define MER_STATS_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace::std;
+
+// coverages below this are counted in an array, the rest in a map
+const unsigned long long mer_hist_dense = 1 << 12;
+// default k-mers sampled overall and per AT content
+const unsigned int mer_sample_size = 50000;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_stats
+//
+// Coverage statistics of counted k-mers for the coverage model, gathered as
+// the counter finishes so the model never re-reads the counts:
+//
+//   <prefix>.hist       coverage and k-mers, for all k-mers
+//   <prefix>.at.hist    AT content, coverage and k-mers
+//   <prefix>.sample     counts of a uniform sample of all k-mers
+//   <prefix>.at.sample  AT content and count of a uniform sample of the
+//                       k-mers of each AT content
+//
+// Quality-weighted counts are rounded to the mer file's precision and then
+// up to integer coverages, as the model's histograms bin them, so the files
+// don't depend on the order the weights were summed in.  Each sample keeps the k-mers with the
+// smallest hashes, a reservoir that doesn't depend on the order k-mers are
+// added in, so threads keep their own mer_stats and merge them at the end.
+// K-mers screened out as seen once are known only by number, so they're in
+// the overall histogram but not by AT content or in the samples.
+////////////////////////////////////////////////////////////////////////////////
+class mer_stats {
+ public:
+  mer_stats(int _k, bool _quality, unsigned int _sample_size);
+  void add(unsigned long long mer, double count);
+  void add_screened(unsigned long long mers);
+  void merge(const mer_stats & other);
+  void write(const string & prefix) const;
+
+ private:
+  struct histogram {
+    vector<unsigned long long> dense;
+    map<unsigned long long, unsigned long long> sparse;
+
+    void add(unsigned long long cov, unsigned long long mers = 1);
+    void merge(const histogram & other);
+    void write(FILE * out, int at) const;
+  };
+
+  struct reservoir {
+    vector< pair<unsigned long long, double> > heap;  // max heap by hash
+
+    void add(unsigned long long hash, double count, unsigned int size);
+    void write(FILE * out, int at, bool quality) const;
+  };
+
+  int k;
+  bool quality;
+  unsigned int sample_size;
+  histogram hist;
+  vector<histogram> at_hists;
+  reservoir sample;
+  vector<reservoir> at_samples;
+};
+
+#endif
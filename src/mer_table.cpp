@@ -0,0 +1,171 @@
+#include "mer_table.h"
+#include "memo.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+union count_bits {
+  double d;
+  unsigned long long u;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_table (constructor)
+//
+// Allocate the smallest power of two number of entries >= 'entries'.
+////////////////////////////////////////////////////////////////////////////////
+mer_table::mer_table(unsigned long long entries, bool _quality) {
+  unsigned long long size = 1;
+  while(size < entries)
+    size *= 2;
+  table = allocate(size);
+  mask = size-1;
+  num_distinct = 0;
+  quality = _quality;
+}
+
+mer_table::~mer_table() {
+  free(table);
+}
+
+mer_table::entry * mer_table::allocate(unsigned long long size) {
+  entry * t = (entry*)calloc(size, sizeof(entry));
+  if(t == NULL) {
+    cerr << "Failed to allocate a k-mer table of " << size << " entries" << endl;
+    exit(EXIT_FAILURE);
+  }
+  return t;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add
+//
+// Add 'count' to k-mer 'mer', setting 'inserted' if it's new to the table,
+// or return false if its probes are full.  Callers total up the k-mers they
+// inserted and pass them to inserted now and then.
+////////////////////////////////////////////////////////////////////////////////
+bool mer_table::add(unsigned long long mer, double count, bool & inserted) {
+  unsigned long long key = mer + 1;
+  unsigned long long h = mix_hash(key);
+  inserted = false;
+
+  for(unsigned int p = 0; p < mer_probes; p++) {
+    entry & e = table[(h + p) & mask];
+    unsigned long long ekey = e.key;
+    if(ekey == 0) {
+      if(__sync_bool_compare_and_swap(&e.key, 0ULL, key)) {
+	inserted = true;
+	ekey = key;
+      } else
+	// lost the race for the entry, so look at who won
+	ekey = e.key;
+    }
+
+    if(ekey == key) {
+      if(quality) {
+	count_bits old_count, new_count;
+	do {
+	  // read the count once, or the sum and the swap may see different counts
+	  old_count.u = *(volatile unsigned long long *)&e.count;
+	  new_count.d = old_count.d + count;
+	} while(!__sync_bool_compare_and_swap(&e.count, old_count.u, new_count.u));
+      } else
+	__sync_fetch_and_add(&e.count, (unsigned long long)count);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// inserted
+//
+// Count 'n' more distinct k-mers in the table.
+////////////////////////////////////////////////////////////////////////////////
+void mer_table::inserted(unsigned long long n) {
+  __sync_fetch_and_add(&num_distinct, n);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// grow
+//
+// Move the entries into a table twice the size, or larger still if some
+// entry's probes are full.  Call outside parallel regions.
+////////////////////////////////////////////////////////////////////////////////
+void mer_table::grow() {
+  unsigned long long old_size = size();
+  unsigned long long new_size = 2*old_size;
+
+  while(true) {
+    entry * grown = allocate(new_size);
+    unsigned long long new_mask = new_size-1;
+    bool fits = true;
+
+#pragma omp parallel for reduction(&&:fits)
+    for(long long i = 0; i < (long long)old_size; i++) {
+      const entry & old_e = table[i];
+      if(old_e.key == 0)
+	continue;
+
+      unsigned long long h = mix_hash(old_e.key);
+      bool placed = false;
+      for(unsigned int p = 0; p < mer_probes && !placed; p++) {
+	entry & e = grown[(h + p) & new_mask];
+	if(e.key == 0 && __sync_bool_compare_and_swap(&e.key, 0ULL, old_e.key)) {
+	  e.count = old_e.count;
+	  placed = true;
+	}
+      }
+      fits = fits && placed;
+    }
+
+    if(fits) {
+      free(table);
+      table = grown;
+      mask = new_mask;
+      return;
+    }
+    free(grown);
+    new_size *= 2;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// compact
+//
+// Move the entries to the front of the table, sorted by k-mer, and return
+// how many there are.  The table can't be added to afterward.
+////////////////////////////////////////////////////////////////////////////////
+unsigned long long mer_table::compact() {
+  unsigned long long n = 0;
+  for(unsigned long long i = 0; i < size(); i++)
+    if(table[i].key != 0)
+      table[n++] = table[i];
+  for(unsigned long long i = n; i < size(); i++)
+    table[i].key = 0;
+  // keys are the k-mers + 1, so they sort in the same order
+  sort(table, table + n, key_less);
+  return n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// get
+////////////////////////////////////////////////////////////////////////////////
+bool mer_table::get(unsigned long long i, unsigned long long & mer, double & count) const {
+  const entry & e = table[i];
+  if(e.key == 0)
+    return false;
+  mer = e.key - 1;
+  if(quality) {
+    count_bits c;
+    c.u = e.count;
+    count = c.d;
+  } else
+    count = (double)e.count;
+  return true;
+}
@@ -0,0 +1,73 @@
+#ifndef MER_TABLE_H
+#define MER_TABLE_H
+
+#include <vector>
+
+using namespace::std;
+
+// entries probed by an add before it gives up until the table grows
+const unsigned int mer_probes = 64;
+// fraction of entries in use above which the table should grow
+const double mer_max_load = 0.6;
+// bytes per entry
+const unsigned int mer_entry_bytes = 16;
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_count
+//
+// A k-mer and a count that didn't fit in a mer_table, kept to add again once
+// the table has grown.
+////////////////////////////////////////////////////////////////////////////////
+struct mer_count {
+  unsigned long long mer;
+  double count;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// mer_table
+//
+// Lock free hash table of k-mer counts shared by all counting threads, in 16
+// bytes per entry: the k-mer + 1, so 0 marks an empty entry, and its count,
+// either an integer or the bits of a double for quality-weighted counts.
+// An entry is claimed by a compare and swap of its key from 0 and counted by
+// an atomic add, or a compare and swap loop for doubles.
+//
+// Keys are probed linearly over at most mer_probes entries.  If those are all
+// taken, add returns false and the caller keeps the count aside until the
+// table grows, which must happen while no thread is adding.
+//
+// compact sorts the entries in place for writing them out, after which the
+// table can still be read by get but no longer added to.
+////////////////////////////////////////////////////////////////////////////////
+class mer_table {
+ public:
+  mer_table(unsigned long long entries, bool _quality);
+  ~mer_table();
+  bool add(unsigned long long mer, double count, bool & inserted);
+  void inserted(unsigned long long n);
+  void grow();
+  unsigned long long compact();
+
+  unsigned long long size() const { return mask+1; }
+  unsigned long long distinct() const { return num_distinct; }
+  double load() const { return (double)num_distinct / size(); }
+  bool quality_counts() const { return quality; }
+
+  // entry i, which is empty if it returns false
+  bool get(unsigned long long i, unsigned long long & mer, double & count) const;
+
+ private:
+  struct entry {
+    unsigned long long key;
+    unsigned long long count;
+  };
+  static entry * allocate(unsigned long long size);
+  static bool key_less(const entry & a, const entry & b) { return a.key < b.key; }
+
+  entry * table;
+  unsigned long long mask;
+  unsigned long long num_distinct;
+  bool quality;
+};
+
+#endif
@@ -0,0 +1,336 @@
+#include "metrics.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <omp.h>
+
+// names of the cc_code outcomes
+static const char* cc_code_names[cc_codes] = {"corrected", "ambiguous", "chaotic", "none"};
+
+////////////////////////////////////////////////////////////////////////////////
+// histogram
+////////////////////////////////////////////////////////////////////////////////
+histogram::histogram() {
+  memset(buckets, 0, sizeof(buckets));
+  count = 0;
+  sum = 0;
+}
+
+void histogram::add_log2(unsigned long long value) {
+  unsigned int b = 0;
+  while(b < histogram_buckets-1 && (value >> b) != 0)
+    b++;
+  buckets[b]++;
+  count++;
+  sum += value;
+}
+
+void histogram::add(unsigned long long value) {
+  buckets[(value < histogram_buckets) ? value : histogram_buckets-1]++;
+  count++;
+  sum += value;
+}
+
+void histogram::merge(const histogram & h) {
+  for(unsigned int b = 0; b < histogram_buckets; b++)
+    buckets[b] += h.buckets[b];
+  count += h.count;
+  sum += h.sum;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// thread_metrics
+////////////////////////////////////////////////////////////////////////////////
+thread_metrics::thread_metrics() {
+  reads = 0;
+  bases = 0;
+  fast_path = 0;
+  validated = 0;
+  corrected = 0;
+  trimmed = 0;
+  trimmed_only = 0;
+  removed = 0;
+  memo_lookups = 0;
+  memo_hits = 0;
+  context_lookups = 0;
+  context_hits = 0;
+  context_verified = 0;
+  input_seconds = 0;
+  screen_seconds = 0;
+  correct_seconds = 0;
+  output_seconds = 0;
+  for(int c = 0; c < cc_codes; c++)
+    cc_results[c] = 0;
+}
+
+void thread_metrics::merge(const thread_metrics & m) {
+  reads += m.reads;
+  bases += m.bases;
+  fast_path += m.fast_path;
+  validated += m.validated;
+  corrected += m.corrected;
+  trimmed += m.trimmed;
+  trimmed_only += m.trimmed_only;
+  removed += m.removed;
+  memo_lookups += m.memo_lookups;
+  memo_hits += m.memo_hits;
+  context_lookups += m.context_lookups;
+  context_hits += m.context_hits;
+  context_verified += m.context_verified;
+  input_seconds += m.input_seconds;
+  screen_seconds += m.screen_seconds;
+  correct_seconds += m.correct_seconds;
+  output_seconds += m.output_seconds;
+  for(int c = 0; c < cc_codes; c++)
+    cc_results[c] += m.cc_results[c];
+  queue_adds.merge(m.queue_adds);
+  trust_checks.merge(m.trust_checks);
+  nt99.merge(m.nt99);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// metrics_export (constructor)
+//
+// Export to files starting with 'prefix' at most every 'interval' seconds.
+////////////////////////////////////////////////////////////////////////////////
+metrics_export::metrics_export(string _prefix, double _interval) {
+  prefix = _prefix;
+  interval = _interval;
+  start_time = omp_get_wtime();
+  last_time = start_time;
+  live = NULL;
+  num_live = 0;
+  files = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// watch
+//
+// Include the 'num_metrics' threads' 'metrics' for the file 'fqf' in
+// exports until retire is called.
+////////////////////////////////////////////////////////////////////////////////
+void metrics_export::watch(string fqf, thread_metrics * metrics, int num_metrics) {
+  live_file = fqf;
+  live = metrics;
+  num_live = num_metrics;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// retire
+//
+// Add the watched metrics to the totals of finished files, before they're
+// freed.
+////////////////////////////////////////////////////////////////////////////////
+void metrics_export::retire() {
+  for(int t = 0; t < num_live; t++)
+    retired.merge(live[t]);
+  live = NULL;
+  num_live = 0;
+  files++;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// poll
+//
+// Write the metrics if 'interval' seconds have passed since they were last
+// written.  Call from one thread at a time.
+////////////////////////////////////////////////////////////////////////////////
+void metrics_export::poll() {
+  if(omp_get_wtime() - last_time >= interval)
+    write();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write
+////////////////////////////////////////////////////////////////////////////////
+void metrics_export::write() {
+  last_time = omp_get_wtime();
+  thread_metrics m = total();
+  write_json(m, last_time - start_time);
+  write_prometheus(m, last_time - start_time);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// total
+////////////////////////////////////////////////////////////////////////////////
+thread_metrics metrics_export::total() const {
+  thread_metrics m = retired;
+  for(int t = 0; t < num_live; t++)
+    m.merge(live[t]);
+  return m;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// replace_file
+//
+// Rename the finished temporary file 'tmpf' to 'outf'.
+////////////////////////////////////////////////////////////////////////////////
+static void replace_file(const string & tmpf, const string & outf) {
+  if(rename(tmpf.c_str(), outf.c_str()) != 0) {
+    cerr << "Failed to write metrics to " << outf << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// json_string
+//
+// Escape 's' for a JSON string: quotes, backslashes and control characters.
+////////////////////////////////////////////////////////////////////////////////
+static string json_string(const string & s) {
+  string escaped;
+  char hex[8];
+  for(unsigned int i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    if(c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if(c < 0x20) {
+      sprintf(hex, "\\u%04x", c);
+      escaped += hex;
+    } else
+      escaped += c;
+  }
+  return escaped;
+}
+
+static double per_second(double count, double elapsed) {
+  return (elapsed > 0) ? count / elapsed : 0.0;
+}
+
+static void json_histogram(ofstream & out, const char* name, const histogram & h, bool log2) {
+  out << "    \"" << name << "\": {\"scale\": \"" << (log2 ? "log2" : "linear") << "\", \"count\": " << h.count << ", \"sum\": " << h.sum << ", \"buckets\": [";
+  for(unsigned int b = 0; b < histogram_buckets; b++)
+    out << (b > 0 ? ", " : "") << h.buckets[b];
+  out << "]}";
+}
+
+static void prometheus_histogram(ofstream & out, const char* name, const char* help, const histogram & h, bool log2) {
+  out << "# HELP quake_" << name << " " << help << "\n";
+  out << "# TYPE quake_" << name << " histogram\n";
+  unsigned long long cumulative = 0;
+  for(unsigned int b = 0; b < histogram_buckets-1; b++) {
+    cumulative += h.buckets[b];
+    // buckets up to b hold values below 2^b, or up to b
+    unsigned long long le = log2 ? ((1ULL << b) - 1) : b;
+    out << "quake_" << name << "_bucket{le=\"" << le << "\"} " << cumulative << "\n";
+  }
+  out << "quake_" << name << "_bucket{le=\"+Inf\"} " << h.count << "\n";
+  out << "quake_" << name << "_sum " << h.sum << "\n";
+  out << "quake_" << name << "_count " << h.count << "\n";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write_json
+////////////////////////////////////////////////////////////////////////////////
+void metrics_export::write_json(const thread_metrics & m, double elapsed) {
+  string outf = prefix + ".json";
+  string tmpf = outf + ".tmp";
+  ofstream out(tmpf.c_str());
+  out << fixed << setprecision(3);
+  out << "{\n";
+  out << "  \"file\": \"" << json_string(live_file) << "\",\n";
+  out << "  \"files_done\": " << files << ",\n";
+  out << "  \"elapsed_seconds\": " << elapsed << ",\n";
+  out << "  \"reads\": " << m.reads << ",\n";
+  out << "  \"bases\": " << m.bases << ",\n";
+  out << "  \"reads_per_second\": " << per_second(m.reads, elapsed) << ",\n";
+  out << "  \"bases_per_second\": " << per_second(m.bases, elapsed) << ",\n";
+  out << "  \"outcomes\": {\"fast_path\": " << m.fast_path << ", \"validated\": " << m.validated << ", \"corrected\": " << m.corrected << ", \"trimmed\": " << m.trimmed << ", \"trimmed_only\": " << m.trimmed_only << ", \"removed\": " << m.removed << "},\n";
+  out << "  \"stage_seconds\": {\"input\": " << m.input_seconds << ", \"screen\": " << m.screen_seconds << ", \"correct\": " << m.correct_seconds << ", \"output\": " << m.output_seconds << "},\n";
+  out << "  \"caches\": {\"duplicate_lookups\": " << m.memo_lookups << ", \"duplicate_hits\": " << m.memo_hits << ", \"context_lookups\": " << m.context_lookups << ", \"context_hits\": " << m.context_hits << ", \"context_verified\": " << m.context_verified << "},\n";
+  out << "  \"correct_cc\": {\n";
+  out << "    \"results\": {";
+  for(int c = 0; c < cc_codes; c++)
+    out << (c > 0 ? ", " : "") << "\"" << cc_code_names[c] << "\": " << m.cc_results[c];
+  out << "},\n";
+  json_histogram(out, "queue_adds", m.queue_adds, true);
+  out << ",\n";
+  json_histogram(out, "trust_checks", m.trust_checks, true);
+  out << ",\n";
+  json_histogram(out, "nt99", m.nt99, false);
+  out << "\n  }\n";
+  out << "}\n";
+  out.close();
+  replace_file(tmpf, outf);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write_prometheus
+////////////////////////////////////////////////////////////////////////////////
+void metrics_export::write_prometheus(const thread_metrics & m, double elapsed) {
+  string outf = prefix + ".prom";
+  string tmpf = outf + ".tmp";
+  ofstream out(tmpf.c_str());
+  out << fixed << setprecision(3);
+
+  out << "# HELP quake_elapsed_seconds Seconds since correct started.\n";
+  out << "# TYPE quake_elapsed_seconds gauge\n";
+  out << "quake_elapsed_seconds " << elapsed << "\n";
+  out << "# HELP quake_files_done Fastq files finished.\n";
+  out << "# TYPE quake_files_done counter\n";
+  out << "quake_files_done " << files << "\n";
+  out << "# HELP quake_reads_total Reads screened.\n";
+  out << "# TYPE quake_reads_total counter\n";
+  out << "quake_reads_total " << m.reads << "\n";
+  out << "# HELP quake_bases_total Bases screened.\n";
+  out << "# TYPE quake_bases_total counter\n";
+  out << "quake_bases_total " << m.bases << "\n";
+  out << "# HELP quake_reads_per_second Reads screened per second overall.\n";
+  out << "# TYPE quake_reads_per_second gauge\n";
+  out << "quake_reads_per_second " << per_second(m.reads, elapsed) << "\n";
+  out << "# HELP quake_bases_per_second Bases screened per second overall.\n";
+  out << "# TYPE quake_bases_per_second gauge\n";
+  out << "quake_bases_per_second " << per_second(m.bases, elapsed) << "\n";
+
+  out << "# HELP quake_read_outcomes_total Reads by outcome.\n";
+  out << "# TYPE quake_read_outcomes_total counter\n";
+  out << "quake_read_outcomes_total{outcome=\"fast_path\"} " << m.fast_path << "\n";
+  out << "quake_read_outcomes_total{outcome=\"validated\"} " << m.validated << "\n";
+  out << "quake_read_outcomes_total{outcome=\"corrected\"} " << m.corrected << "\n";
+  out << "quake_read_outcomes_total{outcome=\"trimmed\"} " << m.trimmed << "\n";
+  out << "quake_read_outcomes_total{outcome=\"trimmed_only\"} " << m.trimmed_only << "\n";
+  out << "quake_read_outcomes_total{outcome=\"removed\"} " << m.removed << "\n";
+
+  out << "# HELP quake_stage_seconds_total Thread seconds spent in each stage.\n";
+  out << "# TYPE quake_stage_seconds_total counter\n";
+  out << "quake_stage_seconds_total{stage=\"input\"} " << m.input_seconds << "\n";
+  out << "quake_stage_seconds_total{stage=\"screen\"} " << m.screen_seconds << "\n";
+  out << "quake_stage_seconds_total{stage=\"correct\"} " << m.correct_seconds << "\n";
+  out << "quake_stage_seconds_total{stage=\"output\"} " << m.output_seconds << "\n";
+
+  out << "# HELP quake_cache_lookups_total Cache lookups.\n";
+  out << "# TYPE quake_cache_lookups_total counter\n";
+  out << "quake_cache_lookups_total{cache=\"duplicate\"} " << m.memo_lookups << "\n";
+  out << "quake_cache_lookups_total{cache=\"context\"} " << m.context_lookups << "\n";
+  out << "# HELP quake_cache_hits_total Cache hits.\n";
+  out << "# TYPE quake_cache_hits_total counter\n";
+  out << "quake_cache_hits_total{cache=\"duplicate\"} " << m.memo_hits << "\n";
+  out << "quake_cache_hits_total{cache=\"context\"} " << m.context_hits << "\n";
+  out << "# HELP quake_context_cache_verified_total Context cache hits whose correction was trusted.\n";
+  out << "# TYPE quake_context_cache_verified_total counter\n";
+  out << "quake_context_cache_verified_total " << m.context_verified << "\n";
+
+  out << "# HELP quake_correct_cc_total Error region searches by result.\n";
+  out << "# TYPE quake_correct_cc_total counter\n";
+  for(int c = 0; c < cc_codes; c++)
+    out << "quake_correct_cc_total{result=\"" << cc_code_names[c] << "\"} " << m.cc_results[c] << "\n";
+  prometheus_histogram(out, "correct_cc_queue_adds", "Corrected reads queued per error region search.", m.queue_adds, true);
+  prometheus_histogram(out, "correct_cc_trust_checks", "Kmers checked per error region search.", m.trust_checks, true);
+  prometheus_histogram(out, "correct_cc_nt99", "Error region nts with quality below 20.", m.nt99, false);
+  out.close();
+  replace_file(tmpf, outf);
+}
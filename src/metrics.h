@@ -0,0 +1,111 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+
+using namespace::std;
+
+// histogram buckets, by powers of two or linear values
+const unsigned int histogram_buckets = 32;
+
+////////////////////////////////////////////////////////////////////////////////
+// histogram
+//
+// Counts of observed values in histogram_buckets buckets, either by the
+// number of bits in the value (add_log2), so bucket b holds values of b
+// bits, or by the value itself (add), with the last bucket taking the rest.
+////////////////////////////////////////////////////////////////////////////////
+struct histogram {
+  histogram();
+  void add_log2(unsigned long long value);
+  void add(unsigned long long value);
+  void merge(const histogram & h);
+
+  unsigned long long buckets[histogram_buckets];
+  unsigned long long count;
+  unsigned long long sum;
+};
+
+// outcomes of Read::correct_cc, by its return code
+enum cc_code { cc_corrected, cc_ambiguous, cc_chaotic, cc_none, cc_codes };
+
+////////////////////////////////////////////////////////////////////////////////
+// thread_metrics
+//
+// Counters kept by one thread, for one file.  Each thread gets its own so
+// updates never need synchronizing, and the padding keeps the hot counters
+// of neighbouring threads in an array off each other's cache lines.
+////////////////////////////////////////////////////////////////////////////////
+struct thread_metrics {
+  thread_metrics();
+  void merge(const thread_metrics & m);
+
+  // reads
+  unsigned long long reads;
+  unsigned long long bases;
+  unsigned long long fast_path;
+  unsigned long long validated;
+  unsigned long long corrected;
+  unsigned long long trimmed;
+  unsigned long long trimmed_only;
+  unsigned long long removed;
+
+  // caches
+  unsigned long long memo_lookups;
+  unsigned long long memo_hits;
+  unsigned long long context_lookups;
+  unsigned long long context_hits;
+  unsigned long long context_verified;
+
+  // seconds by stage
+  double input_seconds;
+  double screen_seconds;
+  double correct_seconds;
+  double output_seconds;
+
+  // Read::correct_cc searches
+  unsigned long long cc_results[cc_codes];
+  histogram queue_adds;
+  histogram trust_checks;
+  histogram nt99;
+
+  char pad[64];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// metrics_export
+//
+// Periodically write the totals of all threads' metrics to <prefix>.json and
+// to <prefix>.prom in the Prometheus text format, for monitoring long runs.
+// The metrics of the file being processed are read while the threads update
+// them, so a snapshot may be a little behind, but never torn on 64-bit
+// systems.  Files are written to a temporary name and renamed, so readers
+// never see a partial file.
+////////////////////////////////////////////////////////////////////////////////
+class metrics_export {
+ public:
+  metrics_export(string _prefix, double _interval);
+  void watch(string fqf, thread_metrics * metrics, int num_metrics);
+  void retire();
+  void poll();
+  void write();
+
+ private:
+  thread_metrics total() const;
+  void write_json(const thread_metrics & m, double elapsed);
+  void write_prometheus(const thread_metrics & m, double elapsed);
+
+  string prefix;
+  double interval;
+  double start_time;
+  double last_time;
+
+  string live_file;
+  thread_metrics * live;
+  int num_live;
+  thread_metrics retired;
+  unsigned int files;
+};
+
+#endif
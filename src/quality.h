@@ -0,0 +1,92 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <algorithm>
+#include <cmath>
+
+////////////////////////////////////////////////////////////////////////////////
+// quality kernel
+//
+// Probabilities that nts are correct given their quality values q, i.e.
+// max(.25, 1-10^(-q/10)), looked up in a table rather than computed per nt,
+// with their logs in fixed point so the probability of a k-mer is a sliding
+// window sum of integers that doesn't drift along a read, as a running
+// product multiplying in and dividing out nts does.
+////////////////////////////////////////////////////////////////////////////////
+
+// fixed point units of log probability per natural log unit
+const double quality_log_unit = 4294967296.0;
+
+class quality_table {
+ public:
+  quality_table() {
+    for(int q = -offset; q < offset; q++) {
+      probs[q+offset] = std::max(.25, 1.0-pow(10.0,-(q/10.0)));
+      log_probs[q+offset] = (long long)floor(log(probs[q+offset]) * quality_log_unit + 0.5);
+    }
+  }
+
+  // quality value q, i.e. the ASCII value minus the scale
+  double prob(int q) const { return probs[q+offset]; }
+  long long log_prob(int q) const { return log_probs[q+offset]; }
+
+ private:
+  // quality values range over ASCII values minus a scale
+  static const int offset = 256;
+  double probs[2*offset];
+  long long log_probs[2*offset];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// quality_lookup
+//
+// The one quality_table, built on first use.
+////////////////////////////////////////////////////////////////////////////////
+inline const quality_table & quality_lookup() {
+  static const quality_table table;
+  return table;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// qmer_logs
+//
+// Set 'logs' of len+1 entries to the prefix sums of the log probabilities of
+// the 'len' ASCII quality values 'q' on 'scale'.
+////////////////////////////////////////////////////////////////////////////////
+inline void qmer_logs(const char * q, int len, int scale, long long * logs) {
+  const quality_table & table = quality_lookup();
+  logs[0] = 0;
+  for(int i = 0; i < len; i++)
+    logs[i+1] = logs[i] + table.log_prob((int)(unsigned char)q[i] - scale);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// qmer_window_weights
+//
+// Set weights[i] from the prefix sums 'logs' as qmer_weights does, so
+// several k can share one pass of qmer_logs.
+////////////////////////////////////////////////////////////////////////////////
+inline void qmer_window_weights(const long long * logs, int len, int k, double min_prob, double * weights) {
+  const long long min_log = (long long)floor(log(min_prob) * quality_log_unit);
+  for(int i = 0; i+k <= len; i++) {
+    long long window = logs[i+k] - logs[i];
+    weights[i] = (window > min_log) ? exp(window / quality_log_unit) : 0.0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// qmer_weights
+//
+// Set weights[i] to the probability that the k-mer starting at nt i of the
+// 'len' ASCII quality values 'q' on 'scale' is correct, or 0 if that's not
+// more than 'min_prob', for i from 0 to len-k, using 'logs' of len+1 entries
+// as scratch.  The prefix sums of log probabilities take one pass, after
+// which each window is a subtraction, so the second loop has no dependence
+// between positions.
+////////////////////////////////////////////////////////////////////////////////
+inline void qmer_weights(const char * q, int len, int scale, int k, double min_prob, long long * logs, double * weights) {
+  qmer_logs(q, len, scale, logs);
+  qmer_window_weights(logs, len, k, min_prob, weights);
+}
+
+#endif
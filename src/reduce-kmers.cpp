@@ -1,5 +1,10 @@
 #include  <string>
+#include  <vector>
 #include  <iostream>
+#include  <cstdio>
+#include  <cstdlib>
+#include  <unistd.h>
+#include "mer_file.h"
 using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -7,12 +12,62 @@ using namespace std;
 //
 // Accept sorted input from count-kmers and reduce by summing counts with the
 // same header (which will always be adjacent).
+//
+// Or given binary mer files as arguments, merge them, printing text or, with
+// -o, writing another mer file.
 ////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// reduce_mer_files
+//
+// Merge the mer files and write the summed counts to the
+// mer file 'outf', or print them if it's NULL.
+////////////////////////////////////////////////////////////
+static void reduce_mer_files(const vector<string> & merfs, const char * outf)
+{
+  mer_file_merger merger(merfs);
+  mer_file_writer * writer = NULL;
+  if(outf != NULL)
+    writer = new mer_file_writer(outf, merger.k(), merger.quality());
+
+  mer_count mc;
+  string out;
+  while(merger.next(mc)) {
+    if(writer != NULL)
+      writer->add(mc.mer, mc.count);
+    else {
+      append_mer_text(out, mc, merger.k(), merger.quality());
+      if(out.size() >= 1 << 20) {
+	fwrite(out.data(), 1, out.size(), stdout);
+	out.clear();
+      }
+    }
+  }
+  fwrite(out.data(), 1, out.size(), stdout);
+  delete writer;
+}
+
 int  main (int argc, char * argv [])
 {
   string mykmer, kmer;
   int mycount, count;
   
+  // mer files
+  char * outf = NULL;
+  int ch;
+  while((ch = getopt(argc, argv, "o:")) != EOF) {
+    if(ch == 'o')
+      outf = optarg;
+    else {
+      cerr << "Usage: reduce-kmers [-o out.mers] [in.mers ...] < sorted counts" << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(optind < argc) {
+    reduce_mer_files(vector<string>(argv+optind, argv+argc), outf);
+    return 0;
+  }
+
   // read initial line
   cin >> mykmer;
   cin >> mycount;
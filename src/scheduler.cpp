@@ -0,0 +1,152 @@
+#include "scheduler.h"
+#include <algorithm>
+
+// aim for tasks of about this long once costs are observed
+const double task_scheduler::task_seconds = .1;
+// and of about this much input before
+const double task_scheduler::task_bytes = 1 << 20;
+
+// weight of the latest observation of a unit's cost
+static const double unit_seconds_weight = .5;
+
+////////////////////////////////////////////////////////////////////////////////
+// task_scheduler (constructor)
+////////////////////////////////////////////////////////////////////////////////
+task_scheduler::task_scheduler(int _threads) {
+  threads = _threads;
+  ordered = false;
+  omp_init_lock(&front_lock);
+  for(int t = 0; t < threads; t++) {
+    worker * w = new worker;
+    omp_init_lock(&w->lock);
+    w->grain = 1;
+    w->unit_seconds = 0;
+    workers.push_back(w);
+  }
+}
+
+task_scheduler::~task_scheduler() {
+  for(int t = 0; t < threads; t++) {
+    omp_destroy_lock(&workers[t]->lock);
+    delete workers[t];
+  }
+  omp_destroy_lock(&front_lock);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// start
+//
+// Split 'units' units of work, each about 'unit_bytes' of input, between the
+// threads, or if 'in_order', share them in one range.  Call outside of the
+// parallel region working through them.
+////////////////////////////////////////////////////////////////////////////////
+void task_scheduler::start(unsigned int units, double unit_bytes, bool in_order) {
+  ordered = in_order;
+  front.begin = 0;
+  front.end = units;
+  for(int t = 0; t < threads; t++) {
+    worker * w = workers[t];
+    w->ranges.clear();
+
+    task share;
+    share.begin = (unsigned int)((unsigned long long)units * t / threads);
+    share.end = (unsigned int)((unsigned long long)units * (t+1) / threads);
+    if(!ordered && share.begin < share.end)
+      w->ranges.push_back(share);
+
+    if(w->unit_seconds == 0)
+      w->grain = (unit_bytes > 0) ? max(1u, (unsigned int)(task_bytes / unit_bytes)) : 1;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// next
+//
+// Set 't' to thread 'tid's next task, stealing one if its own deque is
+// empty, or if ordered, from the front of the shared range.  Return false
+// once there is no work left.
+////////////////////////////////////////////////////////////////////////////////
+bool task_scheduler::next(int tid, task & t) {
+  worker * w = workers[tid];
+  if(ordered) {
+    omp_set_lock(&front_lock);
+    t.begin = front.begin;
+    t.end = (front.end - front.begin > w->grain) ? front.begin + w->grain : front.end;
+    front.begin = t.end;
+    omp_unset_lock(&front_lock);
+    return t.begin < t.end;
+  }
+
+  while(true) {
+    omp_set_lock(&w->lock);
+    if(!w->ranges.empty()) {
+      task & r = w->ranges.front();
+      t.begin = r.begin;
+      t.end = (r.end - r.begin > w->grain) ? r.begin + w->grain : r.end;
+      r.begin = t.end;
+      if(r.begin == r.end)
+	w->ranges.pop_front();
+      omp_unset_lock(&w->lock);
+      return true;
+    }
+    omp_unset_lock(&w->lock);
+
+    task stolen;
+    if(!steal(tid, stolen))
+      return false;
+    omp_set_lock(&w->lock);
+    w->ranges.push_back(stolen);
+    omp_unset_lock(&w->lock);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// steal
+//
+// Take the back half of the last range of the next thread after 'tid' that
+// has work.
+////////////////////////////////////////////////////////////////////////////////
+bool task_scheduler::steal(int tid, task & stolen) {
+  for(int i = 1; i < threads; i++) {
+    worker * v = workers[(tid + i) % threads];
+    omp_set_lock(&v->lock);
+    if(!v->ranges.empty()) {
+      task & r = v->ranges.back();
+      stolen.begin = r.begin + (r.end - r.begin) / 2;
+      stolen.end = r.end;
+      r.end = stolen.begin;
+      if(r.begin == r.end)
+	v->ranges.pop_back();
+      omp_unset_lock(&v->lock);
+      return true;
+    }
+    omp_unset_lock(&v->lock);
+  }
+  return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// done
+//
+// Note that thread 'tid' took 'seconds' for the task 't', and size its next
+// tasks to take about task_seconds.
+////////////////////////////////////////////////////////////////////////////////
+void task_scheduler::done(int tid, const task & t, double seconds) {
+  if(t.end <= t.begin)
+    return;
+  worker * w = workers[tid];
+  double unit_seconds = seconds / (t.end - t.begin);
+  if(w->unit_seconds == 0)
+    w->unit_seconds = unit_seconds;
+  else
+    w->unit_seconds = unit_seconds_weight*unit_seconds + (1-unit_seconds_weight)*w->unit_seconds;
+
+  if(w->unit_seconds > 0) {
+    double grain = task_seconds / w->unit_seconds;
+    w->grain = (grain < 1) ? 1 : (grain > 1e9 ? 1000000000u : (unsigned int)grain);
+  }
+}
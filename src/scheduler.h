@@ -0,0 +1,67 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <deque>
+#include <vector>
+#include <omp.h>
+
+using namespace::std;
+
+////////////////////////////////////////////////////////////////////////////////
+// task
+//
+// A range [begin, end) of units of work, e.g. read index entries.
+////////////////////////////////////////////////////////////////////////////////
+struct task {
+  unsigned int begin;
+  unsigned int end;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// task_scheduler
+//
+// Work stealing scheduler for a pool of threads working through a range of
+// units.  start gives each thread a contiguous share of the units in its own
+// deque.  A thread takes tasks off the front of its deque, and once it's
+// empty, steals the back half of another thread's last range, so threads
+// mostly read their input sequentially and only contend at the end.
+//
+// Started in order, the threads instead all take their tasks off the front
+// of one shared range, so tasks begin in order and those running at once
+// are near each other, e.g. for output committed in order.
+//
+// Each thread sizes its tasks to take about task_seconds from the cost per
+// unit it has observed through done, starting from task_bytes of input, and
+// keeps its estimate from one start to the next, e.g. across the files of a
+// -f list.
+////////////////////////////////////////////////////////////////////////////////
+class task_scheduler {
+ public:
+  task_scheduler(int _threads);
+  ~task_scheduler();
+  void start(unsigned int units, double unit_bytes, bool in_order = false);
+  bool next(int tid, task & t);
+  void done(int tid, const task & t, double seconds);
+  int num_threads() const { return threads; }
+
+  static const double task_seconds;
+  static const double task_bytes;
+
+ private:
+  struct worker {
+    omp_lock_t lock;
+    deque<task> ranges;
+    unsigned int grain;   // units per task
+    double unit_seconds;  // observed cost per unit, or 0 if none yet
+    char pad[64];         // keep workers on separate cache lines
+  };
+  bool steal(int tid, task & stolen);
+
+  int threads;
+  vector<worker*> workers;
+  bool ordered;
+  omp_lock_t front_lock;
+  task front;           // the shared range, if ordered
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <map>
 #include <cstring>
 #include <getopt.h>
+#include "fastq.h"
 
 #include <ext/hash_map>
 namespace Sgi = ::__gnu_cxx;         // GCC 4.0 and later
@@ -115,7 +116,7 @@ static void parse_command_line(int argc, char **argv) {
 // main
 ////////////////////////////////////////////////////////////
 int main(int argc, char **argv) {
-  string header, seq, mid, qual;
+  string header, seq;
   const char * nts = "ACGT";
 
   unsigned long oread_count = 0;
@@ -133,18 +134,22 @@ int main(int argc, char **argv) {
   ////////////////////////////////////////
   seq_hash corrected_reads;
   ifstream correctionsf(corf);
+  fastq_reader corrections(&correctionsf);
+  str_view line;
   unsigned int ci;
   const char* crhead;
-  while(getline(correctionsf, header)) {
+  while(corrections.next_line(line)) {
+    line.assign_to(header);
     if(contrail_out) {
       unsigned int line_tab = header.find('\t');
       seq = header.substr(line_tab+1, header.size()-1-line_tab);
       //qual = garbage...
       header = header.substr(0, line_tab);
     } else {
-      getline(correctionsf, seq);
-      getline(correctionsf, mid);
-      getline(correctionsf, qual);
+      corrections.next_line(line);
+      line.assign_to(seq);
+      corrections.next_line(line);
+      corrections.next_line(line);
     }
 
     cread_count++;
@@ -160,12 +165,13 @@ int main(int argc, char **argv) {
   // parse original file
   ////////////////////////////////////////
   ifstream originalf(fastqf);
+  fastq_reader originals(&originalf);
+  fastq_record rec;
   seq_hash::iterator fi;
   string cseq;
-  while(getline(originalf, header)) {
-    getline(originalf, seq);
-    getline(originalf, mid);
-    getline(originalf, qual);
+  while(originals.next(rec)) {
+    rec.header.assign_to(header);
+    rec.seq.assign_to(seq);
 
     oread_count++;
 
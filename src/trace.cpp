@@ -0,0 +1,80 @@
+#include "trace.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+trace_log * tracer = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+// trace_log (constructor)
+//
+// Trace 'threads' threads into the file 'tracef'.
+////////////////////////////////////////////////////////////////////////////////
+trace_log::trace_log(string _tracef, int threads) {
+  tracef = _tracef;
+  start_time = omp_get_wtime();
+  rings.resize(threads);
+  for(int t = 0; t < threads; t++) {
+    rings[t].events.resize(trace_capacity);
+    rings[t].added = 0;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// add
+//
+// Record a span from 'start' to 'end' in the calling thread's ring.
+////////////////////////////////////////////////////////////////////////////////
+void trace_log::add(const char* cat, const char* name, double start, double end, long long arg) {
+  unsigned int tid = omp_get_thread_num();
+  if(tid >= rings.size())
+    return;
+  ring & r = rings[tid];
+  trace_event & e = r.events[r.added % trace_capacity];
+  e.cat = cat;
+  e.name = name;
+  e.start = start;
+  e.end = end;
+  e.arg = arg;
+  r.added++;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// write
+//
+// Write the recorded spans as complete ("X") events, with times in
+// microseconds since the trace started.  Call outside parallel regions.
+////////////////////////////////////////////////////////////////////////////////
+void trace_log::write() {
+  ofstream trace_out(tracef.c_str());
+  if(!trace_out.good()) {
+    cerr << "Failed to write trace to " << tracef << endl;
+    exit(EXIT_FAILURE);
+  }
+  trace_out << fixed << setprecision(3);
+  trace_out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+  bool first = true;
+  for(unsigned int t = 0; t < rings.size(); t++) {
+    ring & r = rings[t];
+    if(!first)
+      trace_out << ",\n";
+    first = false;
+    trace_out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << t << ", \"args\": {\"name\": \"thread " << t << "\"}}";
+
+    unsigned long long oldest = (r.added > trace_capacity) ? r.added - trace_capacity : 0;
+    for(unsigned long long i = oldest; i < r.added; i++) {
+      const trace_event & e = r.events[i % trace_capacity];
+      trace_out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"" << e.cat << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << t;
+      trace_out << ", \"ts\": " << 1e6*(e.start - start_time) << ", \"dur\": " << 1e6*(e.end - e.start);
+      if(e.arg >= 0)
+	trace_out << ", \"args\": {\"entry\": " << e.arg << "}";
+      trace_out << "}";
+    }
+  }
+  trace_out << "\n]}\n";
+  trace_out.close();
+}
@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <omp.h>
+
+using namespace::std;
+
+// events kept per thread, after which the oldest are overwritten
+const unsigned int trace_capacity = 1 << 16;
+
+////////////////////////////////////////////////////////////////////////////////
+// trace_event
+//
+// A span of time spent by a thread on a stage, with an optional number,
+// e.g. the read index entry a task started at, or -1.
+////////////////////////////////////////////////////////////////////////////////
+struct trace_event {
+  const char* cat;
+  const char* name;
+  double start;
+  double end;
+  long long arg;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// trace_log
+//
+// Timeline of the spans recorded by each thread, written as Chrome trace
+// event JSON for chrome://tracing or Perfetto.  Each thread records into its
+// own ring buffer, so recording takes no locks, and a long run keeps the
+// last trace_capacity spans of each thread.  Names must be string literals.
+////////////////////////////////////////////////////////////////////////////////
+class trace_log {
+ public:
+  trace_log(string _tracef, int threads);
+  void add(const char* cat, const char* name, double start, double end, long long arg = -1);
+  void write();
+
+ private:
+  struct ring {
+    vector<trace_event> events;
+    unsigned long long added;
+    char pad[64];
+  };
+
+  string tracef;
+  double start_time;
+  vector<ring> rings;
+};
+
+// the trace, or NULL unless tracing
+extern trace_log * tracer;
+
+////////////////////////////////////////////////////////////////////////////////
+// trace_span
+//
+// Record the calling thread's time from construction to destruction, if
+// tracing.  Otherwise it costs little more than a test of tracer at each end.
+////////////////////////////////////////////////////////////////////////////////
+class trace_span {
+ public:
+  trace_span(const char* _cat, const char* _name, long long _arg = -1)
+    : cat(_cat), name(_name), arg(_arg), start(0) {
+    if(tracer != NULL)
+      start = omp_get_wtime();
+  }
+  ~trace_span() {
+    if(tracer != NULL)
+      tracer->add(cat, name, start, omp_get_wtime(), arg);
+  }
+
+ private:
+  const char* cat;
+  const char* name;
+  long long arg;
+  double start;
+};
+
+#endif
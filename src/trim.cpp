@@ -1,6 +1,9 @@
 #include "Read.h"
 #include "bithash.h"
 #include "edit.h"
+#include "fastq.h"
+#include "scheduler.h"
+#include "trace.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -16,7 +19,12 @@
 ////////////////////////////////////////////////////////////
 // options
 ////////////////////////////////////////////////////////////
-const static char* myopts = "r:f:t:q:l:p:h";
+const static char* myopts = "r:f:t:q:l:p:zh";
+static struct option  long_options [] = {
+  {"bgzf", 0, 0, 1000},
+  {"trace", 1, 0, 1001},
+  {0, 0, 0, 0}
+};
 // -r, fastq file of reads
 //char* fastqf;
 // -f, file of fastq files of reads
@@ -29,11 +37,12 @@ const static char* myopts = "r:f:t:q:l:p:h";
 static int trim_t = 30;
 // -p, number of threads
 //int threads;
-
-// constants
-static char* nts = "ACGTN";
-
-//unsigned int chunks_per_thread;
+// -z, zip output files
+//bool zip_output = false;
+// --bgzf, zip output files as BGZF with read indexes
+//bool bgzf_output = false;
+// --trace, file for a Chrome trace of the run
+static char* tracef = NULL;
 
 ////////////////////////////////////////////////////////////
 // Usage
@@ -65,6 +74,14 @@ static void  Usage(char * command)
 	   "    specified, it will guess.\n"
 	   " -t <num>=3\n"
 	   "    Use BWA trim parameter <num>\n"
+	   " -z\n"
+	   "    Write output files as gzipped.\n"
+	   " --bgzf\n"
+	   "    Write output files as gzipped in BGZF blocks, with a\n"
+	   "    read index <file>.ridx for random access.\n"
+	   " --trace <file>\n"
+	   "    Write a timeline of each thread's stages and tasks to\n"
+	   "    <file> as Chrome trace events.\n"
            "\n");
 
    return;
@@ -78,10 +95,11 @@ static void parse_command_line(int argc, char **argv) {
   bool errflg = false;
   int ch;
   optarg = NULL;
+  int option_index = 0;
   char* p;
   
   // parse args
-  while(!errflg && ((ch = getopt(argc, argv, myopts)) != EOF)) {
+  while(!errflg && ((ch = getopt_long(argc, argv, myopts, long_options, &option_index)) != EOF)) {
     switch(ch) {
     case 'r':
       fastqf = strdup(optarg);
@@ -123,6 +141,19 @@ static void parse_command_line(int argc, char **argv) {
       }
       break;
 
+    case 'z':
+      zip_output = true;
+      break;
+
+    case 1000:
+      zip_output = true;
+      bgzf_output = true;
+      break;
+
+    case 1001:
+      tracef = strdup(optarg);
+      break;
+
     case 'h':
       Usage(argv[0]);
       exit(EXIT_FAILURE);
@@ -159,60 +190,56 @@ static void parse_command_line(int argc, char **argv) {
 ////////////////////////////////////////////////////////////
 // trim_reads
 ////////////////////////////////////////////////////////////
-static void trim_reads(string fqf, int pe_code, vector<streampos> & starts, vector<unsigned long long> & counts) {
+static void trim_reads(string fqf, int pe_code, fastq_index & index, task_scheduler & scheduler) {
   //format output file
-  string path_suffix = split(fqf,'/').back();
+  string path_suffix = split(strip_gz(fqf),'/').back();
   string out_dir("."+path_suffix);
   mkdir(out_dir.c_str(), S_IRWXU);
 
-  unsigned int chunk = 0;
-#pragma omp parallel //shared(trusted)
+  scheduler.start(index.entries(), index.entry_bytes);
+#pragma omp parallel num_threads(scheduler.num_threads()) //shared(trusted)
   {
     int tid = omp_get_thread_num();
 
     // input
-    ifstream reads_in(fqf.c_str());
+    istream * reads_in = open_fastq(fqf);
+    fastq_reader reads(reads_in);
+    fastq_record rec;
     
-    unsigned int tchunk;
+    task t;
     string header,ntseq,strqual,mid;
-    char* nti;
     Read *r;
     vector<int> untrusted;  // dummy
     vector<correction> cor; // dummy
     
-    #pragma omp critical
-    tchunk = chunk++;
-
-    while(tchunk < starts.size()) {
-      reads_in.seekg(starts[tchunk]);
+    while(scheduler.next(tid, t)) {
+      trace_span span("task", "trim", t.begin);
+      double start = omp_get_wtime();
+      reads.seek(index.start(t.begin));
 
       // output
       string toutf(out_dir+"/");
       stringstream tconvert;
-      tconvert << tchunk;
+      tconvert << t.begin;
       toutf += tconvert.str();
-      ofstream reads_out(toutf.c_str());
+
+      // paired end chunks are combined by parsing them
+      ostream * reads_out;
+      if(pe_code == 0)
+	reads_out = open_output(toutf);
+      else
+	reads_out = new ofstream(toutf.c_str());
       
+      unsigned long long count = index.count(t.begin, t.end);
       unsigned long long tcount = 0;
-      while(tcount++ < counts[tchunk] && getline(reads_in, header)) {
-	//cout << header << endl;
-	
-	// get sequence
-	getline(reads_in, ntseq);
-	//cout << ntseq << endl;
-	
+      while(tcount++ < count && reads.next(rec)) {
+	rec.header.assign_to(header);
+	rec.mid.assign_to(mid);
+	rec.qual.assign_to(strqual);
+
 	// convert ntseq to iseq
-	vector<unsigned int> iseq;
-	for(int i = 0; i < ntseq.size(); i++) {
-	  nti = strchr(nts, ntseq[i]);	
-	  iseq.push_back(nti - nts);
-	}     
-	
-	// get quality values
-	getline(reads_in,mid);
-	//cout << mid << endl;
-	getline(reads_in,strqual);
-	//cout << strqual << endl;
+	vector<unsigned int> iseq(rec.seq.len);
+	nts_to_codes(rec.seq.s, rec.seq.len, &iseq[0]);
 	
 	// trim
 	r = new Read(header, &iseq[0], strqual, untrusted, iseq.size());      
@@ -221,23 +248,24 @@ static void trim_reads(string fqf, int pe_code, vector<streampos> & starts, vect
 	
 	// print if large enough
 	if(ntseq.size() >= trim_t) {
-	  reads_out << header << endl << ntseq << endl << mid << endl << strqual.substr(0, ntseq.size()) << endl;
+	  *reads_out << header << endl << ntseq << endl << mid << endl << strqual.substr(0, ntseq.size()) << endl;
 	} else if(pe_code > 0) {
-	  reads_out << header << " error" << endl << ntseq << endl << mid << endl << strqual.substr(0, ntseq.size()) << endl;
+	  *reads_out << header << " error" << endl << ntseq << endl << mid << endl << strqual.substr(0, ntseq.size()) << endl;
 	}
 	
 	delete r;
       }
-      reads_out.close();
+      delete reads_out;
 
-      #pragma omp critical
-      tchunk = chunk++;
+      scheduler.done(tid, t, omp_get_wtime() - start);
     }
-    reads_in.close();
+    delete reads_in;
   }
 
-  if(pe_code == 0)
-       combine_output(fqf, string("trim"), false);
+  if(pe_code == 0) {
+    trace_span span("stage", "combine output");
+    combine_output(strip_gz(fqf), string("trim"), false);
+  }
 }
 
 
@@ -246,6 +274,9 @@ static void trim_reads(string fqf, int pe_code, vector<streampos> & starts, vect
 ////////////////////////////////////////////////////////////
 int main(int argc, char **argv) {
   parse_command_line(argc, argv);
+  omp_set_num_threads(threads);
+  if(tracef != NULL)
+    tracer = new trace_log(tracef, threads);
 
   // make list of files
   vector<string> fastqfs;
@@ -256,27 +287,34 @@ int main(int argc, char **argv) {
   if(Read::quality_scale == -1)
     guess_quality_scale(fastqfs[0]);
 
+  // one pool of threads works through every file
+  task_scheduler scheduler(threads);
+
   // process each file
   string fqf;
   for(int f = 0; f < fastqfs.size(); f++) {
     fqf = fastqfs[f];
     cout << fqf << endl; 
 
-    // split up file
-    vector<streampos> starts;
-    vector<unsigned long long> counts;
-    chunkify_fastq(fqf, starts, counts);
-    
-    /*
-    for(int i = 0; i < counts.size(); i++)
-      cout << i << " " << starts[i] << " " << counts[i] << endl;
-    */
-    
-    trim_reads(fqf, pairedend_codes[f], starts, counts);
+    // index file
+    fastq_index index;
+    double index_start = omp_get_wtime();
+    index_fastq_file(fqf, index, Read::quality_scale);
+    if(tracer != NULL)
+      tracer->add("stage", "index", index_start, omp_get_wtime());
+
+    trim_reads(fqf, pairedend_codes[f], index, scheduler);
 
     // combine paired end
-    if(pairedend_codes[f] == 2)
-	 combine_output_paired(fastqfs[f-1], fqf, string("trim"), false);
+    if(pairedend_codes[f] == 2) {
+      trace_span span("stage", "combine output");
+      combine_output_paired(strip_gz(fastqfs[f-1]), strip_gz(fqf), string("trim"), false);
+    }
+  }
+
+  if(tracer != NULL) {
+    tracer->write();
+    delete tracer;
   }
 
   return 0;